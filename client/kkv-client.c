@@ -27,18 +27,222 @@ void print_usage()
     printf("usage:\n"\
            "\t kkv-client {file} {operation}\n"\
            "\t operation:\n"\
-           "\t\t config {ip} {port}\n"\
+           "\t\t config {ip} {port} [memcached]\n"\
            "\t\t deconfig\n"\
            "\t\t get {key}\n"\
+           "\t\t gets {key}\n"\
+           "\t\t getrange {key} {offset} {length}\n"\
+           "\t\t mget {key} [key ...]\n"\
+           "\t\t multi {set|add|replace {key} {value} | delete {key}} [...]\n"\
            "\t\t set {key} {value}\n"\
            "\t\t add {key} {value}\n"\
            "\t\t replace {key} {value}\n"\
+           "\t\t append {key} {value}\n"\
+           "\t\t prepend {key} {value}\n"\
+           "\t\t cas {key} {value} {cas}\n"\
+           "\t\t lget {key}\n"\
+           "\t\t lset {key} {value} {token}\n"\
+           "\t\t snapshot\n"\
+           "\t\t sget {snapshot} {key}\n"\
+           "\t\t release {snapshot}\n"\
+           "\t\t setrange {key} {offset} {value}\n"\
            "\t\t delete {key}\n"\
+           "\t\t delete_prefix {prefix}\n"\
+           "\t\t incr {key} {delta}\n"\
+           "\t\t decr {key} {delta}\n"\
+           "\t\t hget {key} {field}\n"\
+           "\t\t hset {key} {field} {value}\n"\
+           "\t\t hdel {key} {field}\n"\
+           "\t\t hgetall {key}\n"\
+           "\t\t setbit {key} {offset} {0|1}\n"\
+           "\t\t getbit {key} {offset}\n"\
+           "\t\t bitcount {key} [offset length]\n"\
+           "\t\t bitop {and|or|xor|not} {destkey} {key} [key ...]\n"\
+           "\t\t pfadd {key} [element ...]\n"\
+           "\t\t pfcount {key} [key ...]\n"\
+           "\t\t pfmerge {destkey} {key} [key ...]\n"\
            "\t\t shrink\n"\
+           "\t\t hotkeys\n"\
+           "\t\t stats\n"\
+           "\t\t flush\n"\
            "\n"\
           );
 }
 
+static int mget(kkv_handler *kh, int nr, char **keys)
+{
+    int i;
+    int ret;
+    uint32_t *key_lens, *value_lens;
+    char **values;
+
+    key_lens=malloc(nr*sizeof(uint32_t));
+    value_lens=malloc(nr*sizeof(uint32_t));
+    values=malloc(nr*sizeof(char*));
+    for(i=0; i<nr; i++)
+        key_lens[i]=strlen(keys[i])+1;
+
+    ret=libkkv_mget(kh,nr,keys,key_lens,values,value_lens);
+    if(ret==LIBKKV_RESULT_OK) {
+        for(i=0; i<nr; i++) {
+            printf("key=%s, value_len=%u, value=%s\n",keys[i],value_lens[i],values[i]);
+            free(values[i]);
+        }
+    }
+
+    free(values);
+    free(value_lens);
+    free(key_lens);
+    return ret;
+}
+
+static int multi(kkv_handler *kh, int argc, char **argv)
+{
+    static const char *names[]= {"set","add","replace","delete"};
+    int i, nr=0;
+    int ret;
+    uint32_t op;
+    uint32_t *ops, *key_lens, *value_lens;
+    char **keys, **values;
+    int *results;
+
+    ops=malloc(argc*sizeof(uint32_t));
+    key_lens=malloc(argc*sizeof(uint32_t));
+    value_lens=malloc(argc*sizeof(uint32_t));
+    keys=malloc(argc*sizeof(char*));
+    values=malloc(argc*sizeof(char*));
+    results=malloc(argc*sizeof(int));
+
+    ret=LIBKKV_RESULT_ERROR;
+    for(i=0; i<argc; nr++) {
+        for(op=LIBKKV_OP_SET; op<=LIBKKV_OP_DELETE&&strcmp(argv[i],names[op]); op++)
+            ;
+        if(op>LIBKKV_OP_DELETE||i+(op==LIBKKV_OP_DELETE?2:3)>argc) {
+            print_usage();
+            goto exit;
+        }
+        ops[nr]=op;
+        keys[nr]=argv[i+1];
+        key_lens[nr]=strlen(keys[nr])+1;
+        values[nr]=op==LIBKKV_OP_DELETE?NULL:argv[i+2];
+        value_lens[nr]=values[nr]?strlen(values[nr])+1:0;
+        results[nr]=LIBKKV_RESULT_ERROR;
+        i+=op==LIBKKV_OP_DELETE?2:3;
+    }
+
+    ret=libkkv_multi(kh,nr,ops,keys,key_lens,values,value_lens,results);
+    for(i=0; i<nr; i++)
+        printf("operation=%s, key=%s, result=%d\n",names[ops[i]],keys[i],results[i]);
+
+exit:
+    free(results);
+    free(values);
+    free(keys);
+    free(value_lens);
+    free(key_lens);
+    free(ops);
+    return ret;
+}
+
+static int bitop(kkv_handler *kh, int nr, char **args)
+{
+    int i;
+    int ret;
+    uint32_t op;
+    uint32_t key_lens[LIBKKV_BITOP_MAX+1];
+    uint64_t len;
+
+    if(nr<3||nr-2>LIBKKV_BITOP_MAX)
+        return LIBKKV_RESULT_ERROR;
+    if(!strcmp(args[0],"and"))
+        op=LIBKKV_BITOP_AND;
+    else if(!strcmp(args[0],"or"))
+        op=LIBKKV_BITOP_OR;
+    else if(!strcmp(args[0],"xor"))
+        op=LIBKKV_BITOP_XOR;
+    else if(!strcmp(args[0],"not"))
+        op=LIBKKV_BITOP_NOT;
+    else
+        return LIBKKV_RESULT_ERROR;
+    for(i=1; i<nr; i++)
+        key_lens[i-1]=strlen(args[i])+1;
+
+    ret=libkkv_bitop(kh,op,args[1],key_lens[0],nr-2,args+2,key_lens+1,&len);
+    if(ret==LIBKKV_RESULT_OK)
+        printf("len=%llu\n",(unsigned long long)len);
+    return ret;
+}
+
+/*
+ * args are the key followed by the elements for pfadd, the keys for pfcount,
+ * or the destination key followed by the source keys for pfmerge.
+ */
+static int hll(kkv_handler *kh, char *op, int nr, char **args)
+{
+    int i;
+    int ret;
+    uint32_t *key_lens;
+    uint64_t num;
+
+    if(nr<1)
+        return LIBKKV_RESULT_ERROR;
+    key_lens=malloc(nr*sizeof(uint32_t));
+    if(!key_lens)
+        return LIBKKV_RESULT_ERROR;
+    for(i=0; i<nr; i++)
+        key_lens[i]=strlen(args[i])+1;
+
+    if(!strcmp(op,"pfadd"))
+        ret=libkkv_pfadd(kh,args[0],key_lens[0],nr-1,args+1,key_lens+1,&num);
+    else if(!strcmp(op,"pfcount"))
+        ret=libkkv_pfcount(kh,nr,args,key_lens,&num);
+    else
+        ret=libkkv_pfmerge(kh,args[0],key_lens[0],nr-1,args+1,key_lens+1,&num);
+    if(ret==LIBKKV_RESULT_OK)
+        printf("%s=%llu\n",strcmp(op,"pfadd")?"count":"changed",(unsigned long long)num);
+    free(key_lens);
+    return ret;
+}
+
+#define MAX_HFIELDS 64
+
+static int hgetall(kkv_handler *kh, char *key, uint32_t key_len)
+{
+    uint32_t i, nr=MAX_HFIELDS;
+    int ret;
+    char *fields[MAX_HFIELDS], *values[MAX_HFIELDS];
+    uint32_t field_lens[MAX_HFIELDS], value_lens[MAX_HFIELDS];
+
+    ret=libkkv_hgetall(kh,key,key_len,&nr,fields,field_lens,values,value_lens);
+    if(ret==LIBKKV_RESULT_OK) {
+        for(i=0; i<nr; i++) {
+            printf("field=%.*s, value=%.*s\n",(int)field_lens[i],fields[i],(int)value_lens[i],values[i]);
+            free(fields[i]);
+            free(values[i]);
+        }
+    }
+    return ret;
+}
+
+#define MAX_HOTKEYS 32
+
+static int hotkeys(kkv_handler *kh)
+{
+    uint32_t i, nr=MAX_HOTKEYS;
+    int ret;
+    char *keys[MAX_HOTKEYS];
+    uint32_t key_lens[MAX_HOTKEYS], rates[MAX_HOTKEYS];
+
+    ret=libkkv_hotkeys(kh,&nr,keys,key_lens,rates);
+    if(ret==LIBKKV_RESULT_OK) {
+        for(i=0; i<nr; i++) {
+            printf("key=%.*s, rate=%u/s\n",(int)key_lens[i],keys[i],rates[i]);
+            free(keys[i]);
+        }
+    }
+    return ret;
+}
+
 int main(int argc, char *argv[])
 {
     char *op;
@@ -49,6 +253,9 @@ int main(int argc, char *argv[])
     uint32_t value_len=0;
     char *key=NULL;
     char *value=NULL;
+    uint64_t num, num2, num3;
+    uint32_t offset;
+    char num_buf[32];
 
     if(argc<3) {
         print_usage();
@@ -72,21 +279,126 @@ int main(int argc, char *argv[])
     }
 
     if(!strcmp(op,"config")) {
-        ret=libkkv_config(kh,key,value);//ip, port
+        if(argc>5&&!strcmp(argv[5],"memcached"))
+            ret=libkkv_config_frontend(kh,key,value,LIBKKV_FRONTEND_MEMCACHED);//ip, port
+        else
+            ret=libkkv_config(kh,key,value);//ip, port
     } else if(!strcmp(op,"deconfig")) {
         ret=libkkv_deconfig(kh);
+    } else if(!strcmp(op,"mget")) {
+        ret=mget(kh,argc-3,argv+3);
+    } else if(!strcmp(op,"multi")) {
+        ret=multi(kh,argc-3,argv+3);
     } else if(!strcmp(op,"get")) {
         ret=libkkv_get(kh,key,key_len,&value,&value_len);
+    } else if(!strcmp(op,"gets")) {
+        ret=libkkv_gets(kh,key,key_len,&value,&value_len,&num);
+        if(ret==LIBKKV_RESULT_OK)
+            printf("cas=%llu\n",(unsigned long long)num);
+    } else if(!strcmp(op,"getrange")) {
+        offset=value?strtoul(value,NULL,10):0;
+        num=argc>5?strtoull(argv[5],NULL,10):0;
+        ret=libkkv_getrange(kh,key,key_len,offset,num,&value,&value_len);
+        if(ret==LIBKKV_RESULT_OK) {
+            value=realloc(value,value_len+1);
+            value[value_len]='\0';
+        }
+    } else if(!strcmp(op,"setrange")) {
+        offset=value?strtoul(value,NULL,10):0;
+        value=argc>5?argv[5]:"";
+        value_len=strlen(value);
+        ret=libkkv_setrange(kh,key,key_len,offset,value,value_len);
+    } else if(!strcmp(op,"cas")) {
+        num=argc>5?strtoull(argv[5],NULL,10):0;
+        ret=libkkv_cas(kh,key,key_len,value,value_len,&num);
+        printf("cas=%llu\n",(unsigned long long)num);
+    } else if(!strcmp(op,"lget")) {
+        ret=libkkv_lget(kh,key,key_len,&value,&value_len,&num);
+        if(ret==LIBKKV_RESULT_MISS)
+            printf("token=%llu\n",(unsigned long long)num);
+    } else if(!strcmp(op,"lset")) {
+        num=argc>5?strtoull(argv[5],NULL,10):0;
+        ret=libkkv_lset(kh,key,key_len,value,value_len,num);
+    } else if(!strcmp(op,"snapshot")) {
+        ret=libkkv_snapshot(kh,&num);
+        if(ret==LIBKKV_RESULT_OK)
+            printf("snapshot=%llu\n",(unsigned long long)num);
+    } else if(!strcmp(op,"sget")) {
+        num=key?strtoull(key,NULL,10):0;
+        key=value;
+        key_len=value_len;
+        ret=libkkv_snapshot_get(kh,num,key,key_len,&value,&value_len);
+    } else if(!strcmp(op,"release")) {
+        num=key?strtoull(key,NULL,10):0;
+        ret=libkkv_release(kh,num);
     } else if(!strcmp(op,"set")) {
         ret=libkkv_set(kh,key,key_len,value,value_len);
     } else if(!strcmp(op,"add")) {
         ret=libkkv_add(kh,key,key_len,value,value_len);
     } else if(!strcmp(op,"replace")) {
         ret=libkkv_replace(kh,key,key_len,value,value_len);
+    } else if(!strcmp(op,"append")) {
+        ret=libkkv_append(kh,key,key_len,value,value_len);
+    } else if(!strcmp(op,"prepend")) {
+        ret=libkkv_prepend(kh,key,key_len,value,value_len);
     } else if(!strcmp(op,"delete")) {
         ret=libkkv_delete(kh,key,key_len);
+    } else if(!strcmp(op,"delete_prefix")) {
+        //the prefix doesn't include the terminating NUL stored with the keys.
+        ret=libkkv_delete_prefix(kh,key,key_len?key_len-1:0,&num);
+        if(ret==LIBKKV_RESULT_OK)
+            printf("deleted=%llu\n",(unsigned long long)num);
+    } else if(!strcmp(op,"incr")||!strcmp(op,"decr")) {
+        num=value?strtoull(value,NULL,10):1;
+        if(!strcmp(op,"incr"))
+            ret=libkkv_incr(kh,key,key_len,num,&num);
+        else
+            ret=libkkv_decr(kh,key,key_len,num,&num);
+        value_len=snprintf(num_buf,sizeof(num_buf),"%llu",(unsigned long long)num);
+        value=num_buf;
     } else if(!strcmp(op,"shrink")) {
         ret=libkkv_shrink(kh);
+    } else if(!strcmp(op,"setbit")||!strcmp(op,"getbit")) {
+        num=value?strtoull(value,NULL,10):0;
+        if(!strcmp(op,"setbit"))
+            ret=libkkv_setbit(kh,key,key_len,num,argc>5?atoi(argv[5]):0,&offset);
+        else
+            ret=libkkv_getbit(kh,key,key_len,num,&offset);
+        if(ret==LIBKKV_RESULT_OK)
+            printf("bit=%u\n",offset);
+    } else if(!strcmp(op,"bitcount")) {
+        offset=value?strtoul(value,NULL,10):0;
+        ret=libkkv_bitcount(kh,key,key_len,offset,argc>5?strtoul(argv[5],NULL,10):0,&num);
+        if(ret==LIBKKV_RESULT_OK)
+            printf("count=%llu\n",(unsigned long long)num);
+    } else if(!strcmp(op,"bitop")) {
+        ret=bitop(kh,argc-3,argv+3);
+    } else if(!strcmp(op,"pfadd")||!strcmp(op,"pfcount")||!strcmp(op,"pfmerge")) {
+        ret=hll(kh,op,argc-3,argv+3);
+    } else if(!strcmp(op,"hget")) {
+        ret=libkkv_hget(kh,key,key_len,value,value_len,&value,&value_len);
+        if(ret==LIBKKV_RESULT_OK) {
+            value=realloc(value,value_len+1);
+            value[value_len]='\0';
+        }
+    } else if(!strcmp(op,"hset")) {
+        ret=libkkv_hset(kh,key,key_len,value,value_len,argc>5?argv[5]:"",argc>5?strlen(argv[5])+1:1);
+    } else if(!strcmp(op,"hdel")) {
+        ret=libkkv_hdel(kh,key,key_len,value,value_len);
+    } else if(!strcmp(op,"hgetall")) {
+        ret=hgetall(kh,key,key_len);
+    } else if(!strcmp(op,"hotkeys")) {
+        ret=hotkeys(kh);
+    } else if(!strcmp(op,"stats")) {
+        ret=libkkv_keyspace_stats(kh,&num,&num2);
+        if(ret==LIBKKV_RESULT_OK)
+            printf("items=%llu, mem=%llu\n",(unsigned long long)num,(unsigned long long)num2);
+        if(ret==LIBKKV_RESULT_OK)
+            ret=libkkv_dedup_stats(kh,&num,&num2,&num3);
+        if(ret==LIBKKV_RESULT_OK)
+            printf("shared values=%llu, keys=%llu, saved=%llu\n",(unsigned long long)num,(unsigned long long)num2,(unsigned long long)num3);
+    } else if(!strcmp(op,"flush")) {
+        ret=libkkv_flush(kh);
     } else {
         print_usage();
         ret=-1;
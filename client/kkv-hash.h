@@ -0,0 +1,91 @@
+/*
+ * Key hashing shared by the userspace clients of In-Kernel Key/Value Store.
+ *
+ * Copyright (C) 2013 jilinxpd.
+ *
+ * This file is released under the GPL.
+ */
+
+#ifndef _KKV_HASH_H
+#define _KKV_HASH_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define rot(x,k) (((x)<<(k)) | ((x)>>(32-(k))))
+
+/*
+ * hash() of kkv_kmod/hash.c, reading the key a byte at a time,
+ * which gives the same hash on a little-endian host.
+ */
+static uint32_t hash(const char *key, uint32_t length)
+{
+    const uint8_t *k=(const uint8_t*)key;
+    uint32_t a,b,c;
+
+    a=b=c=0xdeadbeef+length;
+    while(length>12) {
+        a+=k[0]+((uint32_t)k[1]<<8)+((uint32_t)k[2]<<16)+((uint32_t)k[3]<<24);
+        b+=k[4]+((uint32_t)k[5]<<8)+((uint32_t)k[6]<<16)+((uint32_t)k[7]<<24);
+        c+=k[8]+((uint32_t)k[9]<<8)+((uint32_t)k[10]<<16)+((uint32_t)k[11]<<24);
+        a-=c; a^=rot(c,4); c+=b;
+        b-=a; b^=rot(a,6); a+=c;
+        c-=b; c^=rot(b,8); b+=a;
+        a-=c; a^=rot(c,16); c+=b;
+        b-=a; b^=rot(a,19); a+=c;
+        c-=b; c^=rot(b,4); b+=a;
+        length-=12;
+        k+=12;
+    }
+
+    switch(length) {
+    case 12: c+=(uint32_t)k[11]<<24; /* fallthrough */
+    case 11: c+=(uint32_t)k[10]<<16; /* fallthrough */
+    case 10: c+=(uint32_t)k[9]<<8; /* fallthrough */
+    case 9: c+=k[8]; /* fallthrough */
+    case 8: b+=(uint32_t)k[7]<<24; /* fallthrough */
+    case 7: b+=(uint32_t)k[6]<<16; /* fallthrough */
+    case 6: b+=(uint32_t)k[5]<<8; /* fallthrough */
+    case 5: b+=k[4]; /* fallthrough */
+    case 4: a+=(uint32_t)k[3]<<24; /* fallthrough */
+    case 3: a+=(uint32_t)k[2]<<16; /* fallthrough */
+    case 2: a+=(uint32_t)k[1]<<8; /* fallthrough */
+    case 1: a+=k[0];
+        break;
+    case 0: return c;
+    }
+
+    c^=b; c-=rot(b,14);
+    a^=c; a-=rot(c,11);
+    b^=a; b-=rot(a,25);
+    c^=b; c-=rot(b,16);
+    a^=c; a-=rot(c,4);
+    b^=a; b-=rot(a,14);
+    c^=b; c-=rot(b,24);
+    return c;
+}
+
+/*
+ * key_hash() of kkv_kmod/hash.c, the hash the server files the key under.
+ */
+static uint32_t key_hash(const char *key, uint32_t key_len)
+{
+    uint64_t k,k2;
+
+    if(key_len!=8&&key_len!=16)
+        return hash(key,key_len);
+
+    memcpy(&k,key,8);
+    if(key_len==16) {
+        memcpy(&k2,key+8,8);
+        k+=k2*0x9e3779b97f4a7c15ULL;
+    }
+    k^=k>>33;
+    k*=0xff51afd7ed558ccdULL;
+    k^=k>>33;
+    k*=0xc4ceb9fe1a85ec53ULL;
+    k^=k>>33;
+    return (uint32_t)k;
+}
+
+#endif
@@ -18,10 +18,12 @@
 #include <linux/types.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/time.h>
 
 #include "libkkv.h"
 
 #define BUF_SIZE 4096
+#define DEFAULT_BATCH 16
 
 #ifdef VERBOSE_KKV_CLIENT
 #define PRINTF(...) printf(__VA_ARGS__)
@@ -140,14 +142,128 @@ static void rush_delete(int nr, char *buf, char seed, uint32_t key_len, kkv_hand
     }
 }
 
+/*
+ * the keys and values of one batch.
+ */
+typedef struct {
+    char *buf;
+    char **keys;
+    char **values;
+    uint32_t *key_lens;
+    uint32_t *value_lens;
+} kv_batch;
+
+static kv_batch *alloc_batch(int batch, uint32_t key_len, uint32_t value_len)
+{
+    kv_batch *b;
+
+    b=malloc(sizeof(kv_batch));
+    b->buf=malloc(batch*(key_len+value_len));
+    b->keys=malloc(batch*sizeof(char*));
+    b->values=malloc(batch*sizeof(char*));
+    b->key_lens=malloc(batch*sizeof(uint32_t));
+    b->value_lens=malloc(batch*sizeof(uint32_t));
+    return b;
+}
+
+static void free_batch(kv_batch *b)
+{
+    free(b->value_lens);
+    free(b->key_lens);
+    free(b->values);
+    free(b->keys);
+    free(b->buf);
+    free(b);
+}
+
+/*
+ * generate the k/v pairs from i to i+n-1 into the batch.
+ */
+static void fill_batch(kv_batch *b, int i, int n, char seed, uint32_t key_len, uint32_t value_len)
+{
+    int j;
+
+    for(j=0; j<n; j++) {
+        generate_key_value(i+j,b->buf+j*(key_len+value_len),seed,&b->keys[j],key_len,
+                           value_len?&b->values[j]:NULL,value_len);
+        b->key_lens[j]=key_len;
+        b->value_lens[j]=value_len;
+    }
+}
+
+static void rush_mget(int nr, int batch, char seed, uint32_t key_len, kkv_handler *kh)
+{
+    int i,j,n;
+    int ret;
+    kv_batch *b;
+
+    b=alloc_batch(batch,key_len,0);
+    for(i=0; i<nr; i+=n) {
+        n=nr-i<batch?nr-i:batch;
+        fill_batch(b,i,n,seed,key_len,0);
+
+        ret=libkkv_mget(kh,n,b->keys,b->key_lens,b->values,b->value_lens);
+        if(ret!=LIBKKV_RESULT_OK) {
+            printf("libkkv_mget() failed: ret=%d\n",ret);
+            continue;
+        }
+        PRINTF("i=%d, n=%d, key_len=%u\n",i,n,key_len);
+        for(j=0; j<n; j++)
+            free(b->values[j]);
+    }
+    free_batch(b);
+}
+
+static void rush_mset(int nr, int batch, char seed, uint32_t key_len, uint32_t value_len, kkv_handler *kh)
+{
+    int i,n;
+    int ret;
+    kv_batch *b;
+
+    b=alloc_batch(batch,key_len,value_len);
+    for(i=0; i<nr; i+=n) {
+        n=nr-i<batch?nr-i:batch;
+        fill_batch(b,i,n,seed,key_len,value_len);
+
+        ret=libkkv_mset(kh,n,b->keys,b->key_lens,b->values,b->value_lens,NULL);
+        if(ret!=LIBKKV_RESULT_OK) {
+            printf("libkkv_mset() failed: ret=%d\n",ret);
+        }
+        PRINTF("i=%d, n=%d, key_len=%u, value_len=%u\n",i,n,key_len,value_len);
+    }
+    free_batch(b);
+}
+
+static void rush_mdelete(int nr, int batch, char seed, uint32_t key_len, kkv_handler *kh)
+{
+    int i,n;
+    int ret;
+    kv_batch *b;
+
+    b=alloc_batch(batch,key_len,0);
+    for(i=0; i<nr; i+=n) {
+        n=nr-i<batch?nr-i:batch;
+        fill_batch(b,i,n,seed,key_len,0);
+
+        ret=libkkv_mdelete(kh,n,b->keys,b->key_lens,NULL);
+        if(ret!=LIBKKV_RESULT_OK) {
+            printf("libkkv_mdelete() failed: ret=%d\n",ret);
+        }
+        PRINTF("i=%d, n=%d, key_len=%u\n",i,n,key_len);
+    }
+    free_batch(b);
+}
+
 void print_usage()
 {
     printf("\nusage:\n"
            "kkv-rush {options} {file}\n"
-           "\t-o {s|a|r|d|g} the operation, one of set, add, replace, delete, get.\n"
+           "\t-o {s|a|r|d|g|S|D|G} the operation, one of set, add, replace, delete, get,\n"
+           "\t\tand the batched mset, mdelete, mget.\n"
            "\t-k the length of key.\n"
            "\t-v the length of value.\n"
-           "\t-n the # of k/v pairs.\n\n"
+           "\t-n the # of k/v pairs.\n"
+           "\t-b the # of k/v pairs per batch, for the batched operations.\n\n"
           );
 }
 
@@ -156,7 +272,10 @@ int main(int argc, char *argv[])
 {
     int i;
     int nr;
+    int batch=DEFAULT_BATCH;
     int ret=0;
+    long usec;
+    struct timeval start,end;
     uint32_t key_len,value_len;
     char op;
     char seed='0';
@@ -186,6 +305,9 @@ int main(int argc, char *argv[])
         case 'n':
             nr=atoi(argv[i+1]);
             break;
+        case 'b':
+            batch=atoi(argv[i+1]);
+            break;
         case 'o':
             op=argv[i+1][0];
         }
@@ -193,10 +315,13 @@ int main(int argc, char *argv[])
 
     if(nr<=0)
         nr=102400;
+    if(batch<=0)
+        batch=DEFAULT_BATCH;
     file_path=argv[argc-1];
 
     kh=libkkv_create(file_path);
 
+    gettimeofday(&start,NULL);
     switch(op) {
     case 's':
         rush_set(nr,buf,seed,key_len,value_len,kh);
@@ -213,10 +338,25 @@ int main(int argc, char *argv[])
     case 'g':
         rush_get(nr,buf,seed,key_len,kh);
         break;
+    case 'S':
+        rush_mset(nr,batch,seed,key_len,value_len,kh);
+        break;
+    case 'D':
+        rush_mdelete(nr,batch,seed,key_len,kh);
+        break;
+    case 'G':
+        rush_mget(nr,batch,seed,key_len,kh);
+        break;
     default:
         print_usage();
         ret= -1;
     }
+    gettimeofday(&end,NULL);
+
+    if(!ret) {
+        usec=(end.tv_sec-start.tv_sec)*1000000+(end.tv_usec-start.tv_usec);
+        printf("op=%c, nr=%d, time=%ldus, throughput=%.0f ops/s\n",op,nr,usec,usec?nr*1e6/usec:0);
+    }
 
     libkkv_free(kh);
     return ret;
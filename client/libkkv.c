@@ -21,9 +21,10 @@
 #include <netdb.h>
 
 #include "libkkv.h"
+#include "kkv-hash.h"
 
 
-#define BUF_SIZE 1024
+#define BUF_SIZE 8192 //same as KKV_REQ_BUF_SIZE in kkv_kmod.
 
 #define COMMAND_CONFIG 0
 #define COMMAND_DECONFIG 1
@@ -35,6 +36,46 @@
 #define COMMAND_SHRINK 15
 #define COMMAND_ACK 20
 #define COMMAND_NACK 21
+#define COMMAND_RETRY 22
+#define COMMAND_MGET 30
+#define COMMAND_MSET 31
+#define COMMAND_MDELETE 32
+#define COMMAND_INCR 33
+#define COMMAND_DECR 34
+#define COMMAND_APPEND 35
+#define COMMAND_PREPEND 36
+#define COMMAND_CAS 37
+#define COMMAND_GETRANGE 38
+#define COMMAND_SETRANGE 39
+#define COMMAND_MULTI 40
+#define COMMAND_STATS 41
+#define COMMAND_FLUSH 42
+#define COMMAND_HGET 43
+#define COMMAND_HSET 44
+#define COMMAND_HDEL 45
+#define COMMAND_HGETALL 46
+#define COMMAND_SETBIT 47
+#define COMMAND_GETBIT 48
+#define COMMAND_BITCOUNT 49
+#define COMMAND_BITOP 50
+#define COMMAND_PFADD 51
+#define COMMAND_PFCOUNT 52
+#define COMMAND_PFMERGE 53
+#define COMMAND_LGET 54
+#define COMMAND_LSET 55
+#define COMMAND_DELETE_PREFIX 56
+#define COMMAND_SNAPSHOT 57
+#define COMMAND_RELEASE 58
+#define COMMAND_NOOP 59
+
+#define KKV_STATS_HOTKEYS "hotkeys"
+#define KKV_STATS_KEYSPACE "keyspace"
+#define KKV_STATS_DEDUP "dedup"
+
+//the flags of a request packet.
+#define KKV_FLAG_HASH 0x1 //the hash field holds libkkv_key_hash() of the key.
+
+#define PADDED_KEY_SIZE(size) ((uint32_t)((size + 3) / 4) * 4)
 
 
 typedef struct {
@@ -42,14 +83,63 @@ typedef struct {
     uint32_t command;
     uint32_t key_len;
     uint32_t value_len;
+    uint64_t cas;
+    uint32_t hash;
+    uint32_t flags;
     char data[0];
 } kkv_packet;
 
+typedef struct {
+    uint32_t key_len;
+    char key[0];
+} kkv_mkey;
+
+typedef struct {
+    uint32_t key_len;
+    uint32_t value_len;
+    char data[0];
+} kkv_mkv;
+
+typedef struct {
+    uint32_t command;
+    uint32_t key_len;
+    uint32_t value_len;
+    char data[0];
+} kkv_mop;
+
+typedef struct {
+    uint32_t key_len;
+    uint32_t rate;
+    char key[0];
+} kkv_hotkey;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t bit;
+} kkv_bit;
+
+typedef struct {
+    uint64_t nr_items;
+    uint64_t mem;
+} kkv_keyspace_stats;
+
+typedef struct {
+    uint64_t nr_values;
+    uint64_t nr_refs;
+    uint64_t saved;
+} kkv_dedup_stats;
+
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} kkv_range;
+
 
 typedef struct {
     __s32 family;
     __s32 type;
     __s32 protocol;
+    __s32 frontend;
     __s32 addrlen;
     __u8  addr[0];
 } sock_entry_t ;
@@ -66,6 +156,15 @@ static int send_request(int fd, char *buf, uint32_t len)
     return ret;
 }
 
+/*
+ * the hash the server files the key under, same as key_hash() in kkv_kmod,
+ * it's sent with the request so that the server doesn't hash the key again.
+ */
+uint32_t libkkv_key_hash(char *key, uint32_t key_len)
+{
+    return key_hash(key,key_len);
+}
+
 static uint32_t create_request(char *buf, uint32_t id, uint32_t command, char *key, uint32_t key_len, char *value, uint32_t value_len)
 {
     kkv_packet *pk;
@@ -83,10 +182,241 @@ static uint32_t create_request(char *buf, uint32_t id, uint32_t command, char *k
     if(value_len) {
         memcpy(pk->data+key_len,value,value_len);
     }
+    pk->cas=0;
+    pk->hash=key_len?libkkv_key_hash(key,key_len):0;
+    pk->flags=key_len?KKV_FLAG_HASH:0;
 
     return sizeof(kkv_packet)+key_len+value_len;
 }
 
+/*
+ * pack the keys into the key part as a list of kkv_mkey.
+ */
+static uint32_t create_multi_request(char *buf, uint32_t id, uint32_t command, uint32_t nr, char **keys, uint32_t *key_lens)
+{
+    uint32_t i;
+    char *pos;
+    kkv_packet *pk;
+    kkv_mkey *mk;
+
+    pk=(kkv_packet*)buf;
+    pk->id=id;
+    pk->command=command;
+
+    pos=pk->data;
+    for(i=0; i<nr; i++) {
+        if(pos+sizeof(kkv_mkey)+PADDED_KEY_SIZE(key_lens[i])>buf+BUF_SIZE)
+            return 0;
+        mk=(kkv_mkey*)pos;
+        mk->key_len=key_lens[i];
+        memcpy(mk->key,keys[i],key_lens[i]);
+        pos+=sizeof(kkv_mkey)+PADDED_KEY_SIZE(key_lens[i]);
+    }
+    pk->key_len=pos-pk->data;
+    pk->value_len=0;
+    pk->cas=0;
+    pk->hash=0;
+    pk->flags=0;
+
+    return sizeof(kkv_packet)+pk->key_len;
+}
+
+/*
+ * pack the key/value pairs into the key part as a list of kkv_mkv.
+ */
+static uint32_t create_mset_request(char *buf, uint32_t id, uint32_t nr, char **keys, uint32_t *key_lens, char **values, uint32_t *value_lens)
+{
+    uint32_t i;
+    char *pos;
+    kkv_packet *pk;
+    kkv_mkv *mkv;
+
+    pk=(kkv_packet*)buf;
+    pk->id=id;
+    pk->command=COMMAND_MSET;
+
+    pos=pk->data;
+    for(i=0; i<nr; i++) {
+        if(pos+sizeof(kkv_mkv)+PADDED_KEY_SIZE(key_lens[i])+PADDED_KEY_SIZE(value_lens[i])>buf+BUF_SIZE)
+            return 0;
+        mkv=(kkv_mkv*)pos;
+        mkv->key_len=key_lens[i];
+        mkv->value_len=value_lens[i];
+        memcpy(mkv->data,keys[i],key_lens[i]);
+        pos=mkv->data+PADDED_KEY_SIZE(key_lens[i]);
+        memcpy(pos,values[i],value_lens[i]);
+        pos+=PADDED_KEY_SIZE(value_lens[i]);
+    }
+    pk->key_len=pos-pk->data;
+    pk->value_len=0;
+    pk->cas=0;
+    pk->hash=0;
+    pk->flags=0;
+
+    return sizeof(kkv_packet)+pk->key_len;
+}
+
+/*
+ * pack the operations into the key part as a list of kkv_mop.
+ */
+static uint32_t create_mop_request(char *buf, uint32_t id, uint32_t nr, uint32_t *ops, char **keys, uint32_t *key_lens, char **values, uint32_t *value_lens)
+{
+    static const uint32_t commands[]= {COMMAND_SET,COMMAND_ADD,COMMAND_REPLACE,COMMAND_DELETE};
+    uint32_t i;
+    uint32_t value_len;
+    char *pos;
+    kkv_packet *pk;
+    kkv_mop *mop;
+
+    pk=(kkv_packet*)buf;
+    pk->id=id;
+    pk->command=COMMAND_MULTI;
+
+    pos=pk->data;
+    for(i=0; i<nr; i++) {
+        if(ops[i]>LIBKKV_OP_DELETE)
+            return 0;
+        value_len=ops[i]==LIBKKV_OP_DELETE?0:value_lens[i];
+        if(pos+sizeof(kkv_mop)+PADDED_KEY_SIZE(key_lens[i])+PADDED_KEY_SIZE(value_len)>buf+BUF_SIZE)
+            return 0;
+        mop=(kkv_mop*)pos;
+        mop->command=commands[ops[i]];
+        mop->key_len=key_lens[i];
+        mop->value_len=value_len;
+        memcpy(mop->data,keys[i],key_lens[i]);
+        pos=mop->data+PADDED_KEY_SIZE(key_lens[i]);
+        if(value_len)
+            memcpy(pos,values[i],value_len);
+        pos+=PADDED_KEY_SIZE(value_len);
+    }
+    pk->key_len=pos-pk->data;
+    pk->value_len=0;
+    pk->cas=0;
+    pk->hash=0;
+    pk->flags=0;
+
+    return sizeof(kkv_packet)+pk->key_len;
+}
+
+/*
+ * the value part carries the result of each operation, 0 on success.
+ * an aborted multi request is answered with NACK, but still carries the results.
+ * @return: the # of failed operations.
+ */
+static int parse_multi_response(char *buf, uint32_t id, uint32_t nr, int *results)
+{
+    uint32_t i;
+    int failed=0;
+    int32_t *res;
+    kkv_packet *pk;
+
+    pk=(kkv_packet*)buf;
+    if(pk->id!=id)
+        return -1;
+
+    if(pk->value_len<nr*sizeof(int32_t))
+        return -2;
+
+    res=(int32_t*)(pk->data+pk->key_len);
+    for(i=0; i<nr; i++) {
+        if(res[i]<0)
+            failed++;
+        if(results)
+            results[i]=res[i]<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+    }
+    return failed;
+}
+
+/*
+ * the value part carries the length of each value, negative if not found,
+ * followed by the found values back to back.
+ */
+static int parse_mget_response(char *buf, uint32_t id, uint32_t nr, char **values, uint32_t *value_lens)
+{
+    uint32_t i;
+    int32_t *lens;
+    char *pos;
+    kkv_packet *pk;
+
+    pk=(kkv_packet*)buf;
+    if(pk->id!=id)
+        return -1;
+
+    if(pk->command==COMMAND_NACK||pk->value_len<nr*sizeof(int32_t))
+        return -2;
+
+    lens=(int32_t*)(pk->data+pk->key_len);
+    pos=(char*)(lens+nr);
+    for(i=0; i<nr; i++) {
+        if(lens[i]<0) {
+            values[i]=NULL;
+            value_lens[i]=0;
+            continue;
+        }
+        values[i]=malloc(lens[i]);
+        memcpy(values[i],pos,lens[i]);
+        value_lens[i]=lens[i];
+        pos+=lens[i];
+    }
+    return nr;
+}
+
+/*
+ * the value part starts with a kkv_range, followed by the bytes to write if value is given.
+ */
+static uint32_t create_range_request(char *buf, uint32_t id, uint32_t command, char *key, uint32_t key_len, uint32_t offset, uint32_t length, char *value)
+{
+    uint32_t len;
+    kkv_packet *pk;
+    kkv_range range;
+
+    len=create_request(buf,id,command,key,key_len,NULL,0);
+    if(len+sizeof(kkv_range)+(value?length:0)>BUF_SIZE)
+        return 0;
+
+    range.offset=offset;
+    range.length=length;
+    memcpy(buf+len,&range,sizeof(kkv_range));
+    len+=sizeof(kkv_range);
+    if(value) {
+        memcpy(buf+len,value,length);
+        len+=length;
+    }
+
+    pk=(kkv_packet*)buf;
+    pk->value_len=len-sizeof(kkv_packet)-key_len;
+    return len;
+}
+
+/*
+ * put the field and its value into the value part as a kkv_mkv.
+ */
+static uint32_t create_hset_request(char *buf, uint32_t id, char *key, uint32_t key_len, char *field, uint32_t field_len, char *value, uint32_t value_len)
+{
+    uint32_t len;
+    kkv_packet *pk;
+    kkv_mkv mkv;
+
+    len=create_request(buf,id,COMMAND_HSET,key,key_len,NULL,0);
+    if(len+sizeof(kkv_mkv)+PADDED_KEY_SIZE(field_len)+value_len>BUF_SIZE)
+        return 0;
+
+    //the kkv_mkv follows the key, so it may be unaligned.
+    mkv.key_len=field_len;
+    mkv.value_len=value_len;
+    memcpy(buf+len,&mkv,sizeof(kkv_mkv));
+    len+=sizeof(kkv_mkv);
+    memset(buf+len,0,PADDED_KEY_SIZE(field_len));
+    memcpy(buf+len,field,field_len);
+    len+=PADDED_KEY_SIZE(field_len);
+    memcpy(buf+len,value,value_len);
+    len+=value_len;
+
+    pk=(kkv_packet*)buf;
+    pk->value_len=len-sizeof(kkv_packet)-key_len;
+    return len;
+}
+
 static int parse_response(char *buf, uint32_t id, char **value, uint32_t *value_len)
 {
     uint32_t len;
@@ -171,7 +501,22 @@ int libkkv_replace(kkv_handler *kh, char *key, uint32_t key_len, char *value, ui
     return __libkkv_add(kh,key,key_len,value,value_len,COMMAND_REPLACE);
 }
 
+int libkkv_append(kkv_handler *kh, char *key, uint32_t key_len, char *value, uint32_t value_len)
+{
+    return __libkkv_add(kh,key,key_len,value,value_len,COMMAND_APPEND);
+}
+
+int libkkv_prepend(kkv_handler *kh, char *key, uint32_t key_len, char *value, uint32_t value_len)
+{
+    return __libkkv_add(kh,key,key_len,value,value_len,COMMAND_PREPEND);
+}
+
 int libkkv_get(kkv_handler *kh, char *key, uint32_t key_len, char **value, uint32_t *value_len)
+{
+    return libkkv_gets(kh,key,key_len,value,value_len,NULL);
+}
+
+int libkkv_gets(kkv_handler *kh, char *key, uint32_t key_len, char **value, uint32_t *value_len, uint64_t *cas)
 {
     uint32_t len;
     int ret;
@@ -181,9 +526,690 @@ int libkkv_get(kkv_handler *kh, char *key, uint32_t key_len, char **value, uint3
     ret=send_request(kh->fd,kh->buf,len);
     if(ret>=0)
         ret=parse_response(kh->buf,id,value,value_len);
+    if(ret>=0&&cas)
+        *cas=((kkv_packet*)kh->buf)->cas;
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * store the value only if the version of the key is still *cas.
+ * *cas is updated to the new version on success,
+ * or to the current version if the key was modified by others.
+ */
+int libkkv_cas(kkv_handler *kh, char *key, uint32_t key_len, char *value, uint32_t value_len, uint64_t *cas)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_CAS,key,key_len,value,value_len);
+    pk=(kkv_packet*)kh->buf;
+    pk->cas=*cas;
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0||pk->id!=id)
+        return LIBKKV_RESULT_ERROR;
+    if(pk->command==COMMAND_ACK) {
+        *cas=pk->cas;
+        return LIBKKV_RESULT_OK;
+    }
+    if(pk->command==COMMAND_NACK&&pk->cas) {
+        *cas=pk->cas;
+        return LIBKKV_RESULT_EXISTS;
+    }
+    return LIBKKV_RESULT_ERROR;
+}
+
+/*
+ * get the value, or take a lease on the missing key.
+ * on LIBKKV_RESULT_MISS, *token is the lease to fill the key with libkkv_lset(),
+ * or 0 if none was handed out; on LIBKKV_RESULT_RETRY another client is filling the key,
+ * so the caller should retry shortly rather than going to the backing store.
+ */
+int libkkv_lget(kkv_handler *kh, char *key, uint32_t key_len, char **value, uint32_t *value_len, uint64_t *token)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_LGET,key,key_len,NULL,0);
+    ret=send_request(kh->fd,kh->buf,len);
+    pk=(kkv_packet*)kh->buf;
+    if(ret<0||pk->id!=id)
+        return LIBKKV_RESULT_ERROR;
+    *token=pk->cas;
+    if(pk->command==COMMAND_RETRY)
+        return LIBKKV_RESULT_RETRY;
+    if(pk->command==COMMAND_NACK)
+        return LIBKKV_RESULT_MISS;
+    *token=0;
+    ret=parse_response(kh->buf,id,value,value_len);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * fill the key with the lease token from libkkv_lget().
+ * LIBKKV_RESULT_STALE is returned if the key was written or deleted since, or the lease expired.
+ */
+int libkkv_lset(kkv_handler *kh, char *key, uint32_t key_len, char *value, uint32_t value_len, uint64_t token)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_LSET,key,key_len,value,value_len);
+    pk=(kkv_packet*)kh->buf;
+    pk->cas=token;
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0||pk->id!=id)
+        return LIBKKV_RESULT_ERROR;
+    if(pk->command==COMMAND_NACK&&pk->cas)
+        return LIBKKV_RESULT_STALE;
+    return pk->command==COMMAND_NACK?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * read at most length bytes of the value from offset.
+ */
+int libkkv_getrange(kkv_handler *kh, char *key, uint32_t key_len, uint32_t offset, uint32_t length, char **value, uint32_t *value_len)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    __u32 id=kh->accu_id++;
+
+    len=create_range_request(kh->buf,id,COMMAND_GETRANGE,key,key_len,offset,length,NULL);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0)
+        return LIBKKV_RESULT_ERROR;
+    pk=(kkv_packet*)kh->buf;
+    if(pk->command==COMMAND_NACK)
+        return LIBKKV_RESULT_ERROR;
+    //nothing is copied back for an empty range.
+    if(pk->command!=COMMAND_ACK)
+        pk->value_len=0;
+    ret=parse_response(kh->buf,id,value,value_len);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * overwrite the value from offset, the value is grown with zeros if needed.
+ */
+int libkkv_setrange(kkv_handler *kh, char *key, uint32_t key_len, uint32_t offset, char *value, uint32_t value_len)
+{
+    uint32_t len;
+    int ret;
+    __u32 id=kh->accu_id++;
+
+    len=create_range_request(kh->buf,id,COMMAND_SETRANGE,key,key_len,offset,value_len,value);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    ret=send_request(kh->fd,kh->buf,len);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+int libkkv_mget(kkv_handler *kh, uint32_t nr, char **keys, uint32_t *key_lens, char **values, uint32_t *value_lens)
+{
+    uint32_t len;
+    int ret;
+    __u32 id=kh->accu_id++;
+
+    len=create_multi_request(kh->buf,id,COMMAND_MGET,nr,keys,key_lens);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret>=0)
+        ret=parse_mget_response(kh->buf,id,nr,values,value_lens);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * take a snapshot of the keyspace of the session: the keys read at it with
+ * libkkv_snapshot_get() and libkkv_snapshot_mget() are seen as they were when it was taken,
+ * however they are written meanwhile. a snapshot not read for a while expires.
+ */
+int libkkv_snapshot(kkv_handler *kh, uint64_t *snap)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_SNAPSHOT,NULL,0,NULL,0);
+    ret=send_request(kh->fd,kh->buf,len);
+    pk=(kkv_packet*)kh->buf;
+    if(ret<0||pk->id!=id||pk->command!=COMMAND_ACK||!pk->cas)
+        return LIBKKV_RESULT_ERROR;
+    *snap=pk->cas;
+    return LIBKKV_RESULT_OK;
+}
+
+int libkkv_release(kkv_handler *kh, uint64_t snap)
+{
+    uint32_t len;
+    int ret;
+
+    len=create_request(kh->buf,kh->accu_id++,COMMAND_RELEASE,NULL,0,NULL,0);
+    ((kkv_packet*)kh->buf)->cas=snap;
+    ret=send_request(kh->fd,kh->buf,len);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * get the value as it was when the snapshot was taken,
+ * LIBKKV_RESULT_STALE is returned if the snapshot has been released or has expired.
+ */
+int libkkv_snapshot_get(kkv_handler *kh, uint64_t snap, char *key, uint32_t key_len, char **value, uint32_t *value_len)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_GET,key,key_len,NULL,0);
+    pk=(kkv_packet*)kh->buf;
+    pk->cas=snap;
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0||pk->id!=id)
+        return LIBKKV_RESULT_ERROR;
+    if(pk->command==COMMAND_NACK&&pk->cas)
+        return LIBKKV_RESULT_STALE;
+    ret=parse_response(kh->buf,id,value,value_len);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * get the values as they were when the snapshot was taken, see libkkv_mget().
+ */
+int libkkv_snapshot_mget(kkv_handler *kh, uint64_t snap, uint32_t nr, char **keys, uint32_t *key_lens, char **values, uint32_t *value_lens)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    __u32 id=kh->accu_id++;
+
+    len=create_multi_request(kh->buf,id,COMMAND_MGET,nr,keys,key_lens);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    pk=(kkv_packet*)kh->buf;
+    pk->cas=snap;
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0||pk->id!=id)
+        return LIBKKV_RESULT_ERROR;
+    if(pk->command==COMMAND_NACK&&pk->cas)
+        return LIBKKV_RESULT_STALE;
+    ret=parse_mget_response(kh->buf,id,nr,values,value_lens);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+int libkkv_mset(kkv_handler *kh, uint32_t nr, char **keys, uint32_t *key_lens, char **values, uint32_t *value_lens, int *results)
+{
+    uint32_t len;
+    int ret;
+    __u32 id=kh->accu_id++;
+
+    len=create_mset_request(kh->buf,id,nr,keys,key_lens,values,value_lens);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret>=0)
+        ret=parse_multi_response(kh->buf,id,nr,results);
+    return ret!=0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+int libkkv_mdelete(kkv_handler *kh, uint32_t nr, char **keys, uint32_t *key_lens, int *results)
+{
+    uint32_t len;
+    int ret;
+    __u32 id=kh->accu_id++;
+
+    len=create_multi_request(kh->buf,id,COMMAND_MDELETE,nr,keys,key_lens);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret>=0)
+        ret=parse_multi_response(kh->buf,id,nr,results);
+    return ret!=0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * apply the operations all or nothing, ops[i] is one of LIBKKV_OP_*,
+ * values[i] is ignored for LIBKKV_OP_DELETE.
+ * if the batch is aborted, results[i] tells which operations failed.
+ */
+int libkkv_multi(kkv_handler *kh, uint32_t nr, uint32_t *ops, char **keys, uint32_t *key_lens, char **values, uint32_t *value_lens, int *results)
+{
+    uint32_t len;
+    int ret;
+    __u32 id=kh->accu_id++;
+
+    len=create_mop_request(kh->buf,id,nr,ops,keys,key_lens,values,value_lens);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret>=0)
+        ret=parse_multi_response(kh->buf,id,nr,results);
+    return ret!=0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * fetch at most *nr of the hottest keys with their accesses per second, the hottest first.
+ * keys[i] is malloc()ed, and *nr is set to the # of keys fetched.
+ */
+int libkkv_hotkeys(kkv_handler *kh, uint32_t *nr, char **keys, uint32_t *key_lens, uint32_t *rates)
+{
+    uint32_t len;
+    uint32_t n=0;
+    int ret;
+    char *pos, *end;
+    kkv_packet *pk;
+    kkv_hotkey *hk;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_STATS,KKV_STATS_HOTKEYS,strlen(KKV_STATS_HOTKEYS),NULL,0);
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0)
+        return LIBKKV_RESULT_ERROR;
+    pk=(kkv_packet*)kh->buf;
+    if(pk->id!=id||pk->command==COMMAND_NACK)
+        return LIBKKV_RESULT_ERROR;
+
+    //nothing is copied back if no key is tracked yet.
+    if(pk->command==COMMAND_ACK) {
+        pos=pk->data+pk->key_len;
+        end=pos+pk->value_len;
+        while(n<*nr&&pos+sizeof(kkv_hotkey)<=end) {
+            hk=(kkv_hotkey*)pos;
+            keys[n]=malloc(hk->key_len);
+            memcpy(keys[n],hk->key,hk->key_len);
+            key_lens[n]=hk->key_len;
+            rates[n]=hk->rate;
+            n++;
+            pos+=sizeof(kkv_hotkey)+PADDED_KEY_SIZE(hk->key_len);
+        }
+    }
+    *nr=n;
+    return LIBKKV_RESULT_OK;
+}
+
+/*
+ * fetch the value of a field of the hash-map key.
+ */
+int libkkv_hget(kkv_handler *kh, char *key, uint32_t key_len, char *field, uint32_t field_len, char **value, uint32_t *value_len)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_HGET,key,key_len,field,field_len);
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0)
+        return LIBKKV_RESULT_ERROR;
+    pk=(kkv_packet*)kh->buf;
+    if(pk->command==COMMAND_NACK)
+        return LIBKKV_RESULT_ERROR;
+    //nothing is copied back for an empty value.
+    if(pk->command!=COMMAND_ACK)
+        pk->value_len=0;
+    ret=parse_response(kh->buf,id,value,value_len);
     return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
 }
 
+/*
+ * store the value into a field of the hash-map key, the key is created if missing.
+ */
+int libkkv_hset(kkv_handler *kh, char *key, uint32_t key_len, char *field, uint32_t field_len, char *value, uint32_t value_len)
+{
+    uint32_t len;
+    int ret;
+    __u32 id=kh->accu_id++;
+
+    len=create_hset_request(kh->buf,id,key,key_len,field,field_len,value,value_len);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    ret=send_request(kh->fd,kh->buf,len);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * remove a field of the hash-map key, the key is removed with its last field.
+ */
+int libkkv_hdel(kkv_handler *kh, char *key, uint32_t key_len, char *field, uint32_t field_len)
+{
+    uint32_t len;
+    int ret;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_HDEL,key,key_len,field,field_len);
+    ret=send_request(kh->fd,kh->buf,len);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * fetch at most *nr fields of the hash-map key and their values,
+ * *nr is set to the # of fields fetched.
+ */
+int libkkv_hgetall(kkv_handler *kh, char *key, uint32_t key_len, uint32_t *nr, char **fields, uint32_t *field_lens, char **values, uint32_t *value_lens)
+{
+    uint32_t len;
+    uint32_t n=0;
+    int ret;
+    char *pos, *end;
+    kkv_packet *pk;
+    kkv_mkv *mkv;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_HGETALL,key,key_len,NULL,0);
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0)
+        return LIBKKV_RESULT_ERROR;
+    pk=(kkv_packet*)kh->buf;
+    if(pk->id!=id||pk->command!=COMMAND_ACK)
+        return LIBKKV_RESULT_ERROR;
+
+    pos=pk->data+pk->key_len;
+    end=pos+pk->value_len;
+    while(n<*nr&&pos+sizeof(kkv_mkv)<=end) {
+        mkv=(kkv_mkv*)pos;
+        fields[n]=malloc(mkv->key_len);
+        memcpy(fields[n],mkv->data,mkv->key_len);
+        field_lens[n]=mkv->key_len;
+        values[n]=malloc(mkv->value_len);
+        memcpy(values[n],mkv->data+PADDED_KEY_SIZE(mkv->key_len),mkv->value_len);
+        value_lens[n]=mkv->value_len;
+        n++;
+        pos+=sizeof(kkv_mkv)+PADDED_KEY_SIZE(mkv->key_len)+PADDED_KEY_SIZE(mkv->value_len);
+    }
+    *nr=n;
+    return LIBKKV_RESULT_OK;
+}
+
+/*
+ * send the request and fetch the __u64 result of a bit operation.
+ */
+static int bit_request(kkv_handler *kh, uint32_t id, uint32_t len, uint64_t *result)
+{
+    int ret;
+    kkv_packet *pk;
+
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0)
+        return LIBKKV_RESULT_ERROR;
+    pk=(kkv_packet*)kh->buf;
+    if(pk->id!=id||pk->command!=COMMAND_ACK||pk->value_len!=sizeof(uint64_t))
+        return LIBKKV_RESULT_ERROR;
+    if(result)
+        memcpy(result,pk->data+pk->key_len,sizeof(uint64_t));
+    return LIBKKV_RESULT_OK;
+}
+
+/*
+ * set or clear the bit at offset, the value is grown with zeros if needed.
+ * bit 0 is the highest bit of the first byte. the previous bit is put into *old.
+ */
+int libkkv_setbit(kkv_handler *kh, char *key, uint32_t key_len, uint64_t offset, uint32_t bit, uint32_t *old)
+{
+    uint32_t len;
+    int ret;
+    uint64_t result;
+    kkv_bit kb;
+    __u32 id=kh->accu_id++;
+
+    kb.offset=offset;
+    kb.bit=bit;
+    len=create_request(kh->buf,id,COMMAND_SETBIT,key,key_len,(char*)&kb,sizeof(kkv_bit));
+    ret=bit_request(kh,id,len,&result);
+    if(ret==LIBKKV_RESULT_OK&&old)
+        *old=result;
+    return ret;
+}
+
+/*
+ * fetch the bit at offset, a missing key or a bit past the end reads as 0.
+ */
+int libkkv_getbit(kkv_handler *kh, char *key, uint32_t key_len, uint64_t offset, uint32_t *bit)
+{
+    uint32_t len;
+    int ret;
+    uint64_t result;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_GETBIT,key,key_len,(char*)&offset,sizeof(uint64_t));
+    ret=bit_request(kh,id,len,&result);
+    if(ret==LIBKKV_RESULT_OK)
+        *bit=result;
+    return ret;
+}
+
+/*
+ * count the set bits in length bytes of the value from offset,
+ * or up to the end if length is 0.
+ */
+int libkkv_bitcount(kkv_handler *kh, char *key, uint32_t key_len, uint32_t offset, uint32_t length, uint64_t *nr)
+{
+    uint32_t len;
+    __u32 id=kh->accu_id++;
+
+    len=create_range_request(kh->buf,id,COMMAND_BITCOUNT,key,key_len,offset,length,NULL);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    return bit_request(kh,id,len,nr);
+}
+
+/*
+ * store the values of the nr source keys combined by op, one of LIBKKV_BITOP_*, into dkey.
+ * the length of the result is put into *result_len.
+ */
+int libkkv_bitop(kkv_handler *kh, uint32_t op, char *dkey, uint32_t dkey_len, uint32_t nr, char **keys, uint32_t *key_lens, uint64_t *result_len)
+{
+    uint32_t len, i;
+    char *all_keys[LIBKKV_BITOP_MAX+1];
+    uint32_t all_key_lens[LIBKKV_BITOP_MAX+1];
+    kkv_packet *pk;
+    __u32 id=kh->accu_id++;
+
+    if(nr>LIBKKV_BITOP_MAX)
+        return LIBKKV_RESULT_ERROR;
+    all_keys[0]=dkey;
+    all_key_lens[0]=dkey_len;
+    for(i=0; i<nr; i++) {
+        all_keys[i+1]=keys[i];
+        all_key_lens[i+1]=key_lens[i];
+    }
+    len=create_multi_request(kh->buf,id,COMMAND_BITOP,nr+1,all_keys,all_key_lens);
+    if(!len||len+sizeof(uint32_t)>BUF_SIZE)
+        return LIBKKV_RESULT_ERROR;
+    memcpy(kh->buf+len,&op,sizeof(uint32_t));
+    len+=sizeof(uint32_t);
+    pk=(kkv_packet*)kh->buf;
+    pk->value_len=sizeof(uint32_t);
+    return bit_request(kh,id,len,result_len);
+}
+
+/*
+ * add the nr elements to the HyperLogLog of key, which is created if missing.
+ * *changed is set to 1 if the estimated cardinality may have changed, or to 0.
+ */
+int libkkv_pfadd(kkv_handler *kh, char *key, uint32_t key_len, uint32_t nr, char **elems, uint32_t *elem_lens, uint64_t *changed)
+{
+    uint32_t len, i;
+    char **all_keys;
+    uint32_t *all_key_lens;
+    __u32 id=kh->accu_id++;
+
+    all_keys=malloc((nr+1)*sizeof(char*));
+    all_key_lens=malloc((nr+1)*sizeof(uint32_t));
+    if(!all_keys||!all_key_lens) {
+        free(all_keys);
+        free(all_key_lens);
+        return LIBKKV_RESULT_ERROR;
+    }
+    all_keys[0]=key;
+    all_key_lens[0]=key_len;
+    for(i=0; i<nr; i++) {
+        all_keys[i+1]=elems[i];
+        all_key_lens[i+1]=elem_lens[i];
+    }
+    len=create_multi_request(kh->buf,id,COMMAND_PFADD,nr+1,all_keys,all_key_lens);
+    free(all_keys);
+    free(all_key_lens);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    return bit_request(kh,id,len,changed);
+}
+
+/*
+ * estimate the cardinality of the union of the HyperLogLogs of the nr keys,
+ * missing keys count as empty.
+ */
+int libkkv_pfcount(kkv_handler *kh, uint32_t nr, char **keys, uint32_t *key_lens, uint64_t *count)
+{
+    uint32_t len;
+    __u32 id=kh->accu_id++;
+
+    if(!nr||nr>LIBKKV_HLL_MAX)
+        return LIBKKV_RESULT_ERROR;
+    len=create_multi_request(kh->buf,id,COMMAND_PFCOUNT,nr,keys,key_lens);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    return bit_request(kh,id,len,count);
+}
+
+/*
+ * merge the HyperLogLogs of the nr source keys into that of dkey,
+ * and fetch the estimated cardinality of the result.
+ */
+int libkkv_pfmerge(kkv_handler *kh, char *dkey, uint32_t dkey_len, uint32_t nr, char **keys, uint32_t *key_lens, uint64_t *count)
+{
+    uint32_t len, i;
+    char *all_keys[LIBKKV_HLL_MAX+1];
+    uint32_t all_key_lens[LIBKKV_HLL_MAX+1];
+    __u32 id=kh->accu_id++;
+
+    if(nr>LIBKKV_HLL_MAX)
+        return LIBKKV_RESULT_ERROR;
+    all_keys[0]=dkey;
+    all_key_lens[0]=dkey_len;
+    for(i=0; i<nr; i++) {
+        all_keys[i+1]=keys[i];
+        all_key_lens[i+1]=key_lens[i];
+    }
+    len=create_multi_request(kh->buf,id,COMMAND_PFMERGE,nr+1,all_keys,all_key_lens);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    return bit_request(kh,id,len,count);
+}
+
+/*
+ * delete all the keys starting with prefix, *nr is set to the # of keys deleted.
+ */
+int libkkv_delete_prefix(kkv_handler *kh, char *prefix, uint32_t prefix_len, uint64_t *nr)
+{
+    uint32_t len;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_DELETE_PREFIX,prefix,prefix_len,NULL,0);
+    return bit_request(kh,id,len,nr);
+}
+
+/*
+ * fetch the # of keys and the memory taken by them in the keyspace of the session.
+ */
+int libkkv_keyspace_stats(kkv_handler *kh, uint64_t *nr_items, uint64_t *mem)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    kkv_keyspace_stats *kss;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_STATS,KKV_STATS_KEYSPACE,strlen(KKV_STATS_KEYSPACE),NULL,0);
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0)
+        return LIBKKV_RESULT_ERROR;
+    pk=(kkv_packet*)kh->buf;
+    if(pk->id!=id||pk->command!=COMMAND_ACK||pk->value_len!=sizeof(kkv_keyspace_stats))
+        return LIBKKV_RESULT_ERROR;
+    kss=(kkv_keyspace_stats*)(pk->data+pk->key_len);
+    *nr_items=kss->nr_items;
+    *mem=kss->mem;
+    return LIBKKV_RESULT_OK;
+}
+
+/*
+ * fetch the # of values shared by the keys holding the same bytes,
+ * the # of keys holding them and the bytes saved by the sharing, in all the keyspaces.
+ */
+int libkkv_dedup_stats(kkv_handler *kh, uint64_t *nr_values, uint64_t *nr_refs, uint64_t *saved)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    kkv_dedup_stats *ds;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_STATS,KKV_STATS_DEDUP,strlen(KKV_STATS_DEDUP),NULL,0);
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0)
+        return LIBKKV_RESULT_ERROR;
+    pk=(kkv_packet*)kh->buf;
+    if(pk->id!=id||pk->command!=COMMAND_ACK||pk->value_len!=sizeof(kkv_dedup_stats))
+        return LIBKKV_RESULT_ERROR;
+    ds=(kkv_dedup_stats*)(pk->data+pk->key_len);
+    *nr_values=ds->nr_values;
+    *nr_refs=ds->nr_refs;
+    *saved=ds->saved;
+    return LIBKKV_RESULT_OK;
+}
+
+/*
+ * drop all the keys in the keyspace of the session.
+ */
+int libkkv_flush(kkv_handler *kh)
+{
+    uint32_t len;
+    int ret;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_FLUSH,NULL,0,NULL,0);
+    ret=send_request(kh->fd,kh->buf,len);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+static int __libkkv_incr(kkv_handler *kh, char *key, uint32_t key_len, uint64_t delta, uint64_t *value, uint32_t command)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,command,key,key_len,(char*)&delta,sizeof(uint64_t));
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret>=0) {
+        pk=(kkv_packet*)kh->buf;
+        if(pk->id!=id||pk->command!=COMMAND_ACK||pk->value_len!=sizeof(uint64_t))
+            return LIBKKV_RESULT_ERROR;
+        if(value)
+            memcpy(value,pk->data+pk->key_len,sizeof(uint64_t));
+    }
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+int libkkv_incr(kkv_handler *kh, char *key, uint32_t key_len, uint64_t delta, uint64_t *value)
+{
+    return __libkkv_incr(kh,key,key_len,delta,value,COMMAND_INCR);
+}
+
+int libkkv_decr(kkv_handler *kh, char *key, uint32_t key_len, uint64_t delta, uint64_t *value)
+{
+    return __libkkv_incr(kh,key,key_len,delta,value,COMMAND_DECR);
+}
+
 int libkkv_delete(kkv_handler *kh, char *key, uint32_t key_len)
 {
     uint32_t len;
@@ -212,7 +1238,7 @@ int libkkv_free(kkv_handler *kh)
     return LIBKKV_RESULT_OK;
 }
 
-static int create_sock_entry(char *buf,char *ip, char *port)
+static int create_sock_entry(char *buf,char *ip, char *port, int frontend)
 {
     int ret;
     struct addrinfo hints;
@@ -235,6 +1261,7 @@ static int create_sock_entry(char *buf,char *ip, char *port)
     se->family=result->ai_family;
     se->type=result->ai_socktype;
     se->protocol=result->ai_protocol;
+    se->frontend=frontend;
     se->addrlen=result->ai_addrlen;
     memcpy(se->addr,result->ai_addr,se->addrlen);
 
@@ -244,6 +1271,14 @@ static int create_sock_entry(char *buf,char *ip, char *port)
 }
 
 int libkkv_config(kkv_handler *kh, char *ip, char *port)
+{
+    return libkkv_config_frontend(kh,ip,port,LIBKKV_FRONTEND_KKV);
+}
+
+/*
+ * listen on ip:port, and speak the protocol given by frontend to the clients there.
+ */
+int libkkv_config_frontend(kkv_handler *kh, char *ip, char *port, int frontend)
 {
     uint32_t len;
     uint32_t value_len;
@@ -251,7 +1286,7 @@ int libkkv_config(kkv_handler *kh, char *ip, char *port)
     char value[BUF_SIZE];
 
     memset(value,0,BUF_SIZE);
-    if((value_len=create_sock_entry(value,ip,port))<=0)
+    if((value_len=create_sock_entry(value,ip,port,frontend))<=0)
         return LIBKKV_RESULT_ERROR;
 
     len=create_request(kh->buf,kh->accu_id++,COMMAND_CONFIG,NULL,0,value,value_len);
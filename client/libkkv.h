@@ -11,6 +11,29 @@
 
 #define LIBKKV_RESULT_OK 0
 #define LIBKKV_RESULT_ERROR 1
+#define LIBKKV_RESULT_EXISTS 2 //the version of the key doesn't match in libkkv_cas().
+#define LIBKKV_RESULT_MISS 3 //the key is missing in libkkv_lget().
+#define LIBKKV_RESULT_RETRY 4 //another client holds the lease on the missing key in libkkv_lget().
+#define LIBKKV_RESULT_STALE 5 //the lease in libkkv_lset(), or the snapshot, is no longer valid.
+
+//the operations of libkkv_multi().
+#define LIBKKV_OP_SET 0
+#define LIBKKV_OP_ADD 1
+#define LIBKKV_OP_REPLACE 2
+#define LIBKKV_OP_DELETE 3
+
+//the operations of libkkv_bitop().
+#define LIBKKV_BITOP_AND 0
+#define LIBKKV_BITOP_OR 1
+#define LIBKKV_BITOP_XOR 2
+#define LIBKKV_BITOP_NOT 3 //takes a single source key.
+
+//the protocols a listener of libkkv_config_frontend() can speak.
+#define LIBKKV_FRONTEND_KKV 0
+#define LIBKKV_FRONTEND_MEMCACHED 1 //memcached text and binary protocols.
+
+#define LIBKKV_BITOP_MAX 16 //max # of source keys of libkkv_bitop().
+#define LIBKKV_HLL_MAX 16 //max # of keys of libkkv_pfcount() and source keys of libkkv_pfmerge().
 
 
 typedef struct {
@@ -24,10 +47,46 @@ kkv_handler *libkkv_create(char *kkv_path);
 int libkkv_set(kkv_handler *kh, char *key, uint32_t key_len, char *value, uint32_t value_len);
 int libkkv_add(kkv_handler *kh, char *key, uint32_t key_len, char *value, uint32_t value_len);
 int libkkv_replace(kkv_handler *kh, char *key, uint32_t key_len, char *value, uint32_t value_len);
+int libkkv_append(kkv_handler *kh, char *key, uint32_t key_len, char *value, uint32_t value_len);
+int libkkv_prepend(kkv_handler *kh, char *key, uint32_t key_len, char *value, uint32_t value_len);
 int libkkv_get(kkv_handler *kh, char *key, uint32_t key_len, char **value, uint32_t *value_len);
+int libkkv_gets(kkv_handler *kh, char *key, uint32_t key_len, char **value, uint32_t *value_len, uint64_t *cas);
+int libkkv_cas(kkv_handler *kh, char *key, uint32_t key_len, char *value, uint32_t value_len, uint64_t *cas);
+int libkkv_lget(kkv_handler *kh, char *key, uint32_t key_len, char **value, uint32_t *value_len, uint64_t *token);
+int libkkv_lset(kkv_handler *kh, char *key, uint32_t key_len, char *value, uint32_t value_len, uint64_t token);
+int libkkv_getrange(kkv_handler *kh, char *key, uint32_t key_len, uint32_t offset, uint32_t length, char **value, uint32_t *value_len);
+int libkkv_setrange(kkv_handler *kh, char *key, uint32_t key_len, uint32_t offset, char *value, uint32_t value_len);
+int libkkv_mget(kkv_handler *kh, uint32_t nr, char **keys, uint32_t *key_lens, char **values, uint32_t *value_lens);
+int libkkv_snapshot(kkv_handler *kh, uint64_t *snap);
+int libkkv_release(kkv_handler *kh, uint64_t snap);
+int libkkv_snapshot_get(kkv_handler *kh, uint64_t snap, char *key, uint32_t key_len, char **value, uint32_t *value_len);
+int libkkv_snapshot_mget(kkv_handler *kh, uint64_t snap, uint32_t nr, char **keys, uint32_t *key_lens, char **values, uint32_t *value_lens);
+int libkkv_mset(kkv_handler *kh, uint32_t nr, char **keys, uint32_t *key_lens, char **values, uint32_t *value_lens, int *results);
+int libkkv_mdelete(kkv_handler *kh, uint32_t nr, char **keys, uint32_t *key_lens, int *results);
+int libkkv_multi(kkv_handler *kh, uint32_t nr, uint32_t *ops, char **keys, uint32_t *key_lens, char **values, uint32_t *value_lens, int *results);
+int libkkv_hget(kkv_handler *kh, char *key, uint32_t key_len, char *field, uint32_t field_len, char **value, uint32_t *value_len);
+int libkkv_hset(kkv_handler *kh, char *key, uint32_t key_len, char *field, uint32_t field_len, char *value, uint32_t value_len);
+int libkkv_hdel(kkv_handler *kh, char *key, uint32_t key_len, char *field, uint32_t field_len);
+int libkkv_hgetall(kkv_handler *kh, char *key, uint32_t key_len, uint32_t *nr, char **fields, uint32_t *field_lens, char **values, uint32_t *value_lens);
+int libkkv_setbit(kkv_handler *kh, char *key, uint32_t key_len, uint64_t offset, uint32_t bit, uint32_t *old);
+int libkkv_getbit(kkv_handler *kh, char *key, uint32_t key_len, uint64_t offset, uint32_t *bit);
+int libkkv_bitcount(kkv_handler *kh, char *key, uint32_t key_len, uint32_t offset, uint32_t length, uint64_t *nr);
+int libkkv_bitop(kkv_handler *kh, uint32_t op, char *dkey, uint32_t dkey_len, uint32_t nr, char **keys, uint32_t *key_lens, uint64_t *result_len);
+int libkkv_pfadd(kkv_handler *kh, char *key, uint32_t key_len, uint32_t nr, char **elems, uint32_t *elem_lens, uint64_t *changed);
+int libkkv_pfcount(kkv_handler *kh, uint32_t nr, char **keys, uint32_t *key_lens, uint64_t *count);
+int libkkv_pfmerge(kkv_handler *kh, char *dkey, uint32_t dkey_len, uint32_t nr, char **keys, uint32_t *key_lens, uint64_t *count);
+int libkkv_hotkeys(kkv_handler *kh, uint32_t *nr, char **keys, uint32_t *key_lens, uint32_t *rates);
+int libkkv_keyspace_stats(kkv_handler *kh, uint64_t *nr_items, uint64_t *mem);
+int libkkv_dedup_stats(kkv_handler *kh, uint64_t *nr_values, uint64_t *nr_refs, uint64_t *saved);
+int libkkv_flush(kkv_handler *kh);
+int libkkv_incr(kkv_handler *kh, char *key, uint32_t key_len, uint64_t delta, uint64_t *value);
+int libkkv_decr(kkv_handler *kh, char *key, uint32_t key_len, uint64_t delta, uint64_t *value);
 int libkkv_delete(kkv_handler *kh, char *key, uint32_t key_len);
+int libkkv_delete_prefix(kkv_handler *kh, char *prefix, uint32_t prefix_len, uint64_t *nr);
+uint32_t libkkv_key_hash(char *key, uint32_t key_len);
 int libkkv_shrink(kkv_handler *kh);
 int libkkv_free(kkv_handler *kh);
 int libkkv_config(kkv_handler *kh, char *ip, char *port);
+int libkkv_config_frontend(kkv_handler *kh, char *ip, char *port, int frontend);
 int libkkv_deconfig(kkv_handler *kh);
 
@@ -0,0 +1,157 @@
+/*
+ * In-Kernel Key/Value Store.
+ *
+ * Copyright (C) 2013-2014 jilinxpd.
+ *
+ * This file is released under the GPL.
+ */
+
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include "kkv.h"
+#include "hash.h"
+#include "dedup.h"
+
+/*
+ * a value of at least KKV_DEDUP_MIN bytes is stored once for all the keys holding it:
+ * the chain of each key is then a head region holding only the key,
+ * linked to a shared tail chain holding the value.
+ * the refcount of the tail counts the heads linked to it, while the regions
+ * after the head of an ordinary chain have a refcount of 0, which is how
+ * unlink_item() tells a shared tail apart.
+ * a chain with a shared tail is never writable, so it is copied before any
+ * modification in place, see item_writable().
+ * the tails are found by the hash of their value, which is kept as their key.
+ * the table is protected by the engine lock like the keys.
+ */
+
+//# of buckets, a power of 2.
+#define DEDUP_NR 1024
+#define DEDUP_SEED 0x2545f491
+
+struct dedup_entry {
+    struct dedup_entry *next;
+    uint32_t value_md;
+    ssize_t nvalue;
+    struct item *tail;
+};
+
+static struct dedup_entry *dedup_table[DEDUP_NR];
+static ssize_t nr_values = 0;
+static ssize_t nr_refs = 0;
+static ssize_t saved = 0;
+
+/*
+ * whether the value of the tail is the nvalue bytes of value.
+ */
+static int dedup_match(struct item *tail, char *value, ssize_t nvalue)
+{
+    ssize_t len;
+
+    for (; tail; tail = tail->next) {
+        len = VALUE_SIZE_OF_ITEM(tail);
+        if (len > nvalue || memcmp(VALUE_OF_ITEM(tail), value, len))
+            return 0;
+        value += len;
+        nvalue -= len;
+    }
+    return nvalue == 0;
+}
+
+static struct dedup_entry *dedup_find(uint32_t value_md, char *value, ssize_t nvalue)
+{
+    struct dedup_entry *e;
+
+    for (e = dedup_table[value_md & (DEDUP_NR - 1)]; e; e = e->next) {
+        if (e->value_md == value_md && e->nvalue == nvalue && dedup_match(e->tail, value, nvalue))
+            return e;
+    }
+    return NULL;
+}
+
+/*
+ * create the chain of the key holding value, sharing the value with the other keys
+ * holding the same bytes if it is large enough.
+ * @return: the new chain, or NULL if no memory.
+ */
+struct item *dedup_create_item(char *key, ssize_t nkey, char *value, ssize_t nvalue)
+{
+    struct dedup_entry *e;
+    struct item *head;
+    uint32_t value_md;
+
+    if (nvalue < KKV_DEDUP_MIN || nkey <= 0)
+        return create_item(key, nkey, value, nvalue);
+
+    head = create_item(key, nkey, NULL, 0);
+    if (!head)
+        return NULL;
+
+    value_md = hash(value, nvalue, DEDUP_SEED);
+    e = dedup_find(value_md, value, nvalue);
+    if (e) {
+        saved += item_mem_size(e->tail);
+    } else {
+        e = kmalloc(sizeof(struct dedup_entry), GFP_KERNEL);
+        if (e)
+            e->tail = create_item((char*) &value_md, sizeof(value_md), value, nvalue);
+        if (!e || !e->tail) {
+            kfree(e);
+            unlink_item(head);
+            return NULL;
+        }
+        e->value_md = value_md;
+        e->nvalue = nvalue;
+        e->next = dedup_table[value_md & (DEDUP_NR - 1)];
+        dedup_table[value_md & (DEDUP_NR - 1)] = e;
+        nr_values++;
+    }
+
+    head->next = e->tail;
+    e->tail->refcount++;
+    nr_refs++;
+    return head;
+}
+
+/*
+ * drop the reference of an unlinked head to the shared tail.
+ * @return: 1 if the tail isn't referenced any more and has been removed from the table,
+ * so the caller has to free it, or 0.
+ */
+int dedup_put(struct item *tail)
+{
+    struct dedup_entry **pe, *e;
+    uint32_t value_md;
+
+    nr_refs--;
+    if (--tail->refcount) {
+        saved -= item_mem_size(tail);
+        return 0;
+    }
+
+    memcpy(&value_md, KEY_OF_ITEM(tail), sizeof(value_md));
+    for (pe = &dedup_table[value_md & (DEDUP_NR - 1)]; (e = *pe); pe = &e->next) {
+        if (e->tail == tail) {
+            *pe = e->next;
+            kfree(e);
+            nr_values--;
+            break;
+        }
+    }
+    return 1;
+}
+
+ssize_t dedup_stats(char *buf, ssize_t max)
+{
+    kkv_dedup_stats *ds = (kkv_dedup_stats*) buf;
+
+    if (max < sizeof(kkv_dedup_stats))
+        return -ENOSPC;
+    ds->nr_values = nr_values;
+    ds->nr_refs = nr_refs;
+    ds->saved = saved;
+    return sizeof(kkv_dedup_stats);
+}
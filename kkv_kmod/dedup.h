@@ -0,0 +1,27 @@
+/*
+ * In-Kernel Key/Value Store.
+ *
+ * Copyright (C) 2013-2014 jilinxpd.
+ *
+ * This file is released under the GPL.
+ */
+
+#ifndef _KKV_DEDUP_H
+#define _KKV_DEDUP_H
+
+
+/*
+ * the value part of a stats response for the shared values.
+ */
+typedef struct {
+    __u64 nr_values; //# of distinct values shared.
+    __u64 nr_refs; //# of keys holding them.
+    __u64 saved; //bytes not taken thanks to the sharing.
+} kkv_dedup_stats;
+
+struct item *dedup_create_item(char *key, ssize_t nkey, char *value, ssize_t nvalue);
+int dedup_put(struct item *tail);
+ssize_t dedup_stats(char *buf, ssize_t max);
+
+
+#endif
@@ -8,56 +8,196 @@
 
 #include <linux/kernel.h>
 #include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/slab.h>
 #include "kkv.h"
 #include "hash.h"
+#include "hmap.h"
+#include "hll.h"
+#include "lease.h"
+#include "dedup.h"
+#include "mvcc.h"
 
-ssize_t engine_set(char *key, ssize_t nkey, char *value, ssize_t nvalue)
+/*
+ * the hash of the key of the current request as supplied by the client,
+ * only touched under engine_lock, see engine_hint().
+ */
+static char *hint_key;
+static uint32_t hint_md;
+static uint32_t hint_flags;
+
+/*
+ * let the engine take key_md as the hash of the key at key instead of hashing it,
+ * until the hint is cleared with a NULL key.
+ */
+void engine_hint(char *key, uint32_t key_md)
+{
+    hint_key = key;
+    hint_md = key_md;
+}
+
+/*
+ * let the engine keep flags as the client flags of the values stored as a whole,
+ * e.g. by a set or a replace but not an append, until the hint is cleared with 0.
+ * the flags are opaque to the engine, they're kept for the memcached frontend.
+ */
+void engine_hint_flags(uint32_t flags)
+{
+    hint_flags = flags;
+}
+
+static inline uint32_t engine_hash(char *key, ssize_t nkey)
+{
+    if (key && key == hint_key)
+        return hint_md;
+    return key_hash(key, nkey);
+}
+
+/*
+ * store the new value of an existing itemx, in place if the chain allows, along with its client flags.
+ */
+static ssize_t engine_update(struct kkv_keyspace *ks, struct itemx *itx, char *key, ssize_t nkey, char *value, ssize_t nvalue, uint32_t flags)
+{
+    struct item *it;
+
+    //a chain with a shared tail is never writable, so only a plain chain is overwritten in place,
+    //and a large value written there isn't shared with the keys holding the same bytes:
+    //saving the new chain is preferred over deduplicating the value.
+    if (itx->type == KKV_TYPE_STRING && itemx_writable(ks, itx) && !overwrite_item(itx->it, value, nvalue)) {
+        touch_itemx(ks, itx, 0);
+        itx->flags = flags;
+        return 0;
+    }
+
+    it = dedup_create_item(key, nkey, value, nvalue);
+    if (!it) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("create_item() failed in engine_update()\n");
+#endif
+        return -ENOSPC;
+    }
+
+    //the type is changed after the old value is kept for the snapshots.
+    update_itemx(ks, itx, it);
+    itx->type = KKV_TYPE_STRING;
+    itx->flags = flags;
+    return 0;
+}
+
+/*
+ * make the fresh chain it the value of the key, which is created if missing.
+ * the chain is released on failure.
+ */
+static ssize_t engine_store(struct kkv_keyspace *ks, char *key, ssize_t nkey, struct item *it, int type)
+{
+    struct itemx *itx;
+    uint32_t key_md;
+    struct itemx **cur_header = NULL;
+
+    key_md = engine_hash(key, nkey);
+    itx = locate_itemx(ks, key_md, key, nkey, &cur_header, 1);
+    if (itx) {
+        update_itemx(ks, itx, it);
+        itx->type = type;
+        itx->flags = hint_flags;
+        return 0;
+    } else if (!cur_header) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("locate_itemx() failed in engine_store()\n");
+#endif
+        unlink_item(it);
+        return -ENOSPC;
+    }
+
+    itx = create_itemx(key_md, key, nkey, it);
+    if (!itx) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("create_itemx() failed in engine_store()\n");
+#endif
+        unlink_item(it);
+        return -ENOSPC;
+    }
+    itx->type = type;
+    itx->flags = hint_flags;
+    return add_itemx(ks, itx, cur_header);
+}
+
+/*
+ * make the fresh chain it, whose value is already written in place, the value of the key,
+ * op is one of KKV_OP_SET, KKV_OP_ADD and KKV_OP_REPLACE.
+ * the chain is released on failure.
+ */
+ssize_t engine_store_item(struct kkv_keyspace *ks, char *key, ssize_t nkey, struct item *it, int op)
+{
+    struct itemx *itx;
+
+    if (op != KKV_OP_SET) {
+        itx = find_itemx(ks, engine_hash(key, nkey), key, nkey);
+        if (op == KKV_OP_ADD && itx) {
+            unlink_item(it);
+            return -EEXIST;
+        } else if (op == KKV_OP_REPLACE && !itx) {
+            unlink_item(it);
+            return -ENOENT;
+        }
+    }
+    return engine_store(ks, key, nkey, it, KKV_TYPE_STRING);
+}
+
+ssize_t engine_set(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *value, ssize_t nvalue)
 {
     struct item *it;
     struct itemx *itx;
     uint32_t key_md;
-    struct itemx **cur_header;
+    struct itemx **cur_header = NULL;
 
-    key_md = hash(key, nkey, 0);
+    key_md = engine_hash(key, nkey);
 #ifdef DEBUG_KKV_ENGINE
     printk("the key_md is 0x%x\n", key_md);
 #endif
-    it = create_item(key, nkey, value, nvalue);
+
+    itx = locate_itemx(ks, key_md, key, nkey, &cur_header, 1);
+    if (itx) {
+        return engine_update(ks, itx, key, nkey, value, nvalue, hint_flags);
+    } else if (!cur_header) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("locate_itemx() failed in engine_set()\n");
+#endif
+        return -ENOSPC;
+    }
+
+    it = dedup_create_item(key, nkey, value, nvalue);
     if (!it) {
 #ifdef DEBUG_KKV_ENGINE
-        printk("create_item() failed in engine_update()\n");
+        printk("create_item() failed in engine_set()\n");
 #endif
         return -ENOSPC;
     }
 
-    itx = locate_itemx(key_md, key, nkey, &cur_header, 1);
-    if (itx) {
-        return update_itemx(itx, it);
-    } else {
-        itx = create_itemx(key_md, it);
-        if (!itx) {
+    itx = create_itemx(key_md, key, nkey, it);
+    if (!itx) {
 #ifdef DEBUG_KKV_ENGINE
-            printk("create_itemx() failed in engine_create()\n");
+        printk("create_itemx() failed in engine_create()\n");
 #endif
-            return -ENOSPC;
-        }
-        return add_itemx(itx, cur_header);
+        return -ENOSPC;
     }
+    itx->flags = hint_flags;
+    return add_itemx(ks, itx, cur_header);
 }
 
-ssize_t engine_add(char *key, ssize_t nkey, char *value, ssize_t nvalue)
+ssize_t engine_add(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *value, ssize_t nvalue)
 {
     struct item *it;
     struct itemx *itx;
     uint32_t key_md;
     struct itemx **cur_header = NULL;
 
-    key_md = hash(key, nkey, 0);
+    key_md = engine_hash(key, nkey);
 #ifdef DEBUG_KKV_ENGINE
     printk("the key_md is 0x%x\n", key_md);
 #endif
 
-    itx = locate_itemx(key_md, key, nkey, &cur_header, 1);
+    itx = locate_itemx(ks, key_md, key, nkey, &cur_header, 1);
     if (itx) {
 #ifdef DEBUG_KKV_ENGINE
         printk("locate_itemx() failed in engine_create()\n");
@@ -69,67 +209,197 @@ ssize_t engine_add(char *key, ssize_t nkey, char *value, ssize_t nvalue)
 #endif
         return -ENOSPC;
     }
-    it = create_item(key, nkey, value, nvalue);
+    it = dedup_create_item(key, nkey, value, nvalue);
     if (!it) {
 #ifdef DEBUG_KKV_ENGINE
         printk("create_item() failed in engine_update()\n");
 #endif
         return -ENOSPC;
     }
-    itx = create_itemx(key_md, it);
+    itx = create_itemx(key_md, key, nkey, it);
     if (!itx) {
 #ifdef DEBUG_KKV_ENGINE
         printk("create_itemx() failed in engine_create()\n");
 #endif
         return -ENOSPC;
     }
+    itx->flags = hint_flags;
 #ifdef DEBUG_KKV_ENGINE
     printk("itx=0x%lx, cur_header=0x%lx\n", (ulong) itx, (ulong) cur_header);
 #endif
-    return add_itemx(itx, cur_header);
+    return add_itemx(ks, itx, cur_header);
 }
 
-ssize_t engine_replace(char *key, ssize_t nkey, char *value, ssize_t nvalue)
+ssize_t engine_replace(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *value, ssize_t nvalue)
 {
-    struct item *it;
     struct itemx *itx;
     uint32_t key_md;
 
-    key_md = hash(key, nkey, 0);
+    key_md = engine_hash(key, nkey);
 #ifdef DEBUG_KKV_ENGINE
     printk("the key_md is 0x%x\n", key_md);
 #endif
 
-    itx = find_itemx(key_md, key, nkey);
+    itx = find_itemx(ks, key_md, key, nkey);
     if (!itx) {
 #ifdef DEBUG_KKV_ENGINE
         printk("find_itemx() failed in engine_create()\n");
 #endif
         return -ENOENT;
     }
-    it = create_item(key, nkey, value, nvalue);
-    if (!it) {
+
+    return engine_update(ks, itx, key, nkey, value, nvalue, hint_flags);
+}
+
+/*
+ * replace the value of the key only if its version is still *cas.
+ * @return: 0 with the new version in *cas, -EEXIST with the current version in *cas,
+ * or another negative error.
+ */
+ssize_t engine_cas(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *value, ssize_t nvalue, uint64_t *cas)
+{
+    struct itemx *itx;
+    uint32_t key_md;
+    ssize_t ret;
+
+    key_md = engine_hash(key, nkey);
 #ifdef DEBUG_KKV_ENGINE
-        printk("create_item() failed in engine_update()\n");
+    printk("the key_md is 0x%x\n", key_md);
+#endif
+
+    itx = find_itemx(ks, key_md, key, nkey);
+    if (!itx) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("find_itemx() failed in engine_cas()\n");
+#endif
+        return -ENOENT;
+    }
+
+    if (itx->cas != *cas) {
+        *cas = itx->cas;
+        return -EEXIST;
+    }
+
+    ret = engine_update(ks, itx, key, nkey, value, nvalue, hint_flags);
+    *cas = itx->cas;
+    return ret;
+}
+
+/*
+ * prepare the chain of itx for modification in place.
+ * a chain that others hold, or that has been fragmented by earlier appends,
+ * is consolidated into a fresh one first.
+ */
+static ssize_t engine_own_item(struct kkv_keyspace *ks, struct itemx *itx)
+{
+    struct item *it;
+
+    if (!itemx_writable(ks, itx) || item_fragmented(itx->it)) {
+        it = compact_item(itx->it);
+        if (it)
+            update_itemx(ks, itx, it);
+        else if (!itemx_writable(ks, itx))
+            return -ENOSPC;
+    }
+    return 0;
+}
+
+/*
+ * append or prepend value to the value of the key, without copying the existing bytes.
+ */
+ssize_t engine_append(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *value, ssize_t nvalue, int append)
+{
+    struct item *it;
+    struct itemx *itx;
+    uint32_t key_md;
+    ssize_t grown;
+
+    key_md = engine_hash(key, nkey);
+#ifdef DEBUG_KKV_ENGINE
+    printk("the key_md is 0x%x\n", key_md);
+#endif
+
+    itx = find_itemx(ks, key_md, key, nkey);
+    if (!itx) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("find_itemx() failed in engine_append()\n");
 #endif
+        return -ENOENT;
+    }
+    if (itx->type != KKV_TYPE_STRING)
+        return -EINVAL;
+
+    if (engine_own_item(ks, itx))
         return -ENOSPC;
+
+    if (append) {
+        grown = append_item(itx->it, value, nvalue);
+        if (grown < 0)
+            return -ENOSPC;
+    } else {
+        it = prepend_item(itx->it, value, nvalue, &grown);
+        if (!it)
+            return -ENOSPC;
+        itx->it = it;
+    }
+    touch_itemx(ks, itx, grown);
+    return 0;
+}
+
+/*
+ * overwrite the value of the key from offset, growing it with zeros if needed.
+ * only the regions covering the range are touched,
+ * and the value can't grow beyond KKV_LARGE_MAX.
+ */
+ssize_t engine_setrange(struct kkv_keyspace *ks, char *key, ssize_t nkey, ssize_t offset, char *value, ssize_t nvalue)
+{
+    struct itemx *itx;
+    uint32_t key_md;
+    ssize_t grown;
+
+    if (offset < 0 || nvalue < 0 || offset + nvalue > KKV_LARGE_MAX)
+        return -E2BIG;
+
+    key_md = engine_hash(key, nkey);
+#ifdef DEBUG_KKV_ENGINE
+    printk("the key_md is 0x%x\n", key_md);
+#endif
+
+    itx = find_itemx(ks, key_md, key, nkey);
+    if (!itx) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("find_itemx() failed in engine_setrange()\n");
+#endif
+        return -ENOENT;
     }
+    if (itx->type != KKV_TYPE_STRING)
+        return -EINVAL;
 
-    return update_itemx(itx, it);
+    if (engine_own_item(ks, itx))
+        return -ENOSPC;
+
+    grown = write_item_range(itx->it, offset, value, nvalue);
+    if (grown < 0)
+        return -ENOSPC;
+    touch_itemx(ks, itx, grown);
+    return 0;
 }
 
-ssize_t engine_delete(char *key, ssize_t nkey)
+ssize_t engine_delete(struct kkv_keyspace *ks, char *key, ssize_t nkey)
 {
     struct itemx *itx;
     uint32_t key_md;
     struct itemx **cur_header;
 
-    key_md = hash(key, nkey, 0);
+    key_md = engine_hash(key, nkey);
 #ifdef DEBUG_KKV_ENGINE
     printk("the key_md is 0x%x\n", key_md);
 #endif
 
-    itx = locate_itemx(key_md, key, nkey, &cur_header, 0);
+    //a key under lease is missing, so the lease is revoked whether the key is found or not,
+    //lest the value read from the backing store before the delete be set by engine_lset().
+    lease_revoke(ks, key_md);
+    itx = locate_itemx(ks, key_md, key, nkey, &cur_header, 0);
     if (!itx) {
 #ifdef DEBUG_KKV_ENGINE
         printk("locate_itemx() failed in engine_create()\n");
@@ -137,7 +407,21 @@ ssize_t engine_delete(char *key, ssize_t nkey)
         return -ENOENT;
     }
 
-    return delete_itemx(itx, cur_header);
+    return delete_itemx(ks, itx, cur_header);
+}
+
+/*
+ * delete a batch of the keys starting with prefix, resuming the walk of the index at *cursor.
+ * the caller repeats it, releasing the lock in between, until *cursor comes back as 0.
+ * @return: 0 with the # of keys deleted added to *nr, or -EINVAL for an empty prefix.
+ */
+ssize_t engine_delete_prefix(struct kkv_keyspace *ks, char *prefix, ssize_t nprefix, uint64_t *cursor, uint64_t *nr)
+{
+    if (nprefix <= 0)
+        return -EINVAL;
+
+    *nr += delete_itemx_prefix(ks, prefix, nprefix, cursor, KKV_PREFIX_BATCH);
+    return 0;
 }
 
 ssize_t engine_shrink()
@@ -146,24 +430,806 @@ ssize_t engine_shrink()
     return 0;
 }
 
+ssize_t engine_flush(struct kkv_keyspace *ks)
+{
+    flush_keyspace(ks);
+    return 0;
+}
+
+/*
+ * take a snapshot, reading the keys as they are now until it is released, see mvcc.c.
+ */
+ssize_t engine_snapshot(struct kkv_keyspace *ks, uint64_t *snap)
+{
+    return mvcc_open(ks, snap);
+}
+
+ssize_t engine_release(struct kkv_keyspace *ks, uint64_t snap)
+{
+    return mvcc_release(ks, snap);
+}
 
-ssize_t engine_get(char *key, ssize_t nkey, char *value, ssize_t nvalue)
+/*
+ * read the value of the key at the snapshot snap, or the latest one if snap is 0.
+ * @return: the # of bytes read with the version in *cas and the client flags in *flags,
+ * or -ESTALE if the snapshot isn't held.
+ */
+ssize_t engine_get(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *value, ssize_t nvalue, uint64_t snap, uint64_t *cas, uint32_t *flags)
 {
     struct itemx *itx;
     uint32_t key_md;
 
-    key_md = hash(key, nkey, 0);
+    if (snap && mvcc_check(ks, snap))
+        return -ESTALE;
+
+    key_md = engine_hash(key, nkey);
 #ifdef DEBUG_KKV_ENGINE
     printk("the key_md is 0x%x\n", key_md);
 #endif
 
-    itx = find_itemx(key_md, key, nkey);
+    itx = find_itemx(ks, key_md, key, nkey);
+    itx = mvcc_find(ks, itx, key_md, key, nkey, snap);
     if (!itx) {
 #ifdef DEBUG_KKV_ENGINE
         printk("find_itemx() failed in engine_create()\n");
 #endif
         return -ENOENT;
     }
+    if (itx->type != KKV_TYPE_STRING)
+        return -EINVAL;
 
+    *cas = itx->cas;
+    *flags = itx->flags;
     return read_item(itx->it, value, nvalue);
 }
+
+/*
+ * get the latest version of the key, pinning its item chain so that the value can be read
+ * without engine_lock, e.g. sent from the regions in place; a pinned chain isn't modified, see item_writable().
+ * @return: the chain with the size of its value in *nvalue, or NULL if missing or not a string.
+ */
+struct item *engine_get_item(struct kkv_keyspace *ks, char *key, ssize_t nkey, ssize_t *nvalue, uint64_t *cas, uint32_t *flags)
+{
+    struct itemx *itx;
+
+    itx = find_itemx(ks, engine_hash(key, nkey), key, nkey);
+    if (!itx || itx->type != KKV_TYPE_STRING)
+        return NULL;
+
+    itx->it->refcount++;
+    *nvalue = item_value_size(itx->it);
+    *cas = itx->cas;
+    *flags = itx->flags;
+    return itx->it;
+}
+
+/*
+ * unpin the chain got by engine_get_item(), which is freed if the key has let go of it meanwhile.
+ */
+void engine_put_item(struct item *it)
+{
+    if (--it->refcount == 0)
+        unlink_item(it);
+}
+
+/*
+ * get the key, handing out a lease on it if it is missing.
+ * @return: the # of bytes read; on a miss, -ENOENT with the lease token in *cas,
+ * which is 0 if no lease could be handed out, or -EAGAIN if another client holds the lease.
+ */
+ssize_t engine_lget(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *value, ssize_t nvalue, uint64_t *cas)
+{
+    ssize_t ret;
+    uint32_t flags;
+
+    ret = engine_get(ks, key, nkey, value, nvalue, 0, cas, &flags);
+    if (ret != -ENOENT)
+        return ret;
+
+    ret = lease_acquire(ks, engine_hash(key, nkey), cas);
+    if (ret == -EAGAIN)
+        return ret;
+    if (ret)
+        *cas = 0;
+    return -ENOENT;
+}
+
+/*
+ * fill the key with the token of the lease handed out by engine_lget().
+ * @return: 0 on success, or -ESTALE if the lease has been revoked or has expired.
+ */
+ssize_t engine_lset(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *value, ssize_t nvalue, uint64_t token)
+{
+    if (lease_check(ks, engine_hash(key, nkey), token))
+        return -ESTALE;
+    return engine_set(ks, key, nkey, value, nvalue);
+}
+
+/*
+ * read at most nvalue bytes of the value of the key from offset.
+ * @return: the # of bytes read.
+ */
+ssize_t engine_getrange(struct kkv_keyspace *ks, char *key, ssize_t nkey, ssize_t offset, char *value, ssize_t nvalue, uint64_t *cas)
+{
+    struct itemx *itx;
+    uint32_t key_md;
+
+    key_md = engine_hash(key, nkey);
+#ifdef DEBUG_KKV_ENGINE
+    printk("the key_md is 0x%x\n", key_md);
+#endif
+
+    itx = find_itemx(ks, key_md, key, nkey);
+    if (!itx) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("find_itemx() failed in engine_getrange()\n");
+#endif
+        return -ENOENT;
+    }
+    if (itx->type != KKV_TYPE_STRING)
+        return -EINVAL;
+
+    *cas = itx->cas;
+    return read_item_range(itx->it, offset, value, nvalue);
+}
+
+/*
+ * look up nr keys, at most KKV_MGET_BATCH, at the snapshot snap, or the latest if snap is 0,
+ * and pack their values into value.
+ * nvalue[i] is set to the length of the i-th value, or a negative error.
+ * @return: the total length of the packed values, or -ESTALE if the snapshot isn't held.
+ */
+ssize_t engine_mget(struct kkv_keyspace *ks, char **key, ssize_t *nkey, ssize_t *nvalue, int nr, char *value, ssize_t max, uint64_t snap)
+{
+    struct itemx *itx[KKV_MGET_BATCH];
+    uint32_t key_md[KKV_MGET_BATCH];
+    ssize_t len = 0;
+    int i;
+
+    if (snap && mvcc_check(ks, snap))
+        return -ESTALE;
+
+    for (i = 0; i < nr; i++)
+        key_md[i] = key_hash(key[i], nkey[i]);
+
+    find_itemx_batch(ks, key_md, key, nkey, itx, nr);
+
+    for (i = 0; i < nr; i++) {
+        if (snap)
+            itx[i] = mvcc_find(ks, itx[i], key_md[i], key[i], nkey[i], snap);
+        if (!itx[i]) {
+#ifdef DEBUG_KKV_ENGINE
+            printk("find_itemx_batch() missed key %d in engine_mget()\n", i);
+#endif
+            nvalue[i] = -ENOENT;
+        } else if (itx[i]->type != KKV_TYPE_STRING) {
+            nvalue[i] = -EINVAL;
+        } else if (item_value_size(itx[i]->it) > max - len) {
+            nvalue[i] = -ENOSPC;
+        } else {
+            nvalue[i] = read_item(itx[i]->it, value + len, max - len);
+            len += nvalue[i];
+        }
+    }
+    return len;
+}
+
+/*
+ * add delta to, or subtract it from, the decimal value of the key.
+ * a trailing '\0' of the value is kept, and decrementing below 0 yields 0.
+ * @return: 0 with the new value in *result, or a negative error.
+ */
+ssize_t engine_incr(struct kkv_keyspace *ks, char *key, ssize_t nkey, uint64_t delta, int incr, uint64_t *result)
+{
+    struct itemx *itx;
+    uint32_t key_md;
+    char num[KKV_NUM_LEN + 1];
+    unsigned long long val;
+    ssize_t len;
+    int term;
+
+    key_md = engine_hash(key, nkey);
+#ifdef DEBUG_KKV_ENGINE
+    printk("the key_md is 0x%x\n", key_md);
+#endif
+
+    itx = find_itemx(ks, key_md, key, nkey);
+    if (!itx) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("find_itemx() failed in engine_incr()\n");
+#endif
+        return -ENOENT;
+    }
+    if (itx->type != KKV_TYPE_STRING)
+        return -EINVAL;
+
+    len = item_value_size(itx->it);
+    if (len > KKV_NUM_LEN)
+        return -EINVAL;
+    read_item(itx->it, num, len);
+    term = len > 0 && num[len - 1] == '\0';
+    num[len - term] = '\0';
+    if (kstrtoull(num, 10, &val))
+        return -EINVAL;
+
+    if (incr)
+        val += delta;
+    else
+        val = val > delta ? val - delta : 0;
+    len = snprintf(num, sizeof(num), "%llu", val) + term;
+
+    *result = val;
+    return engine_update(ks, itx, key, nkey, num, len, itx->flags);
+}
+
+/*
+ * set or clear the bit at offset of the value of the key, bit 0 being the highest bit
+ * of the first byte. the value is grown with zeros, or created, to cover the bit.
+ * @return: 0 with the previous bit in *old, or a negative error.
+ */
+ssize_t engine_setbit(struct kkv_keyspace *ks, char *key, ssize_t nkey, uint64_t offset, int bit, uint64_t *old)
+{
+    struct item *it;
+    struct itemx *itx;
+    uint32_t key_md;
+    struct itemx **cur_header = NULL;
+    ssize_t pos = offset >> 3;
+    unsigned char mask = 0x80 >> (offset & 7);
+    unsigned char c = 0;
+    ssize_t grown;
+
+    if (offset >= (uint64_t) KKV_BITMAP_MAX * 8)
+        return -EINVAL;
+
+    key_md = engine_hash(key, nkey);
+#ifdef DEBUG_KKV_ENGINE
+    printk("the key_md is 0x%x\n", key_md);
+#endif
+
+    itx = locate_itemx(ks, key_md, key, nkey, &cur_header, 1);
+    if (itx) {
+        if (itx->type != KKV_TYPE_STRING)
+            return -EINVAL;
+        if (engine_own_item(ks, itx))
+            return -ENOSPC;
+        read_item_range(itx->it, pos, (char*) &c, 1);
+        *old = !!(c & mask);
+        c = bit ? c | mask : c & ~mask;
+        grown = write_item_range(itx->it, pos, (char*) &c, 1);
+        if (grown < 0)
+            return -ENOSPC;
+        touch_itemx(ks, itx, grown);
+        return 0;
+    } else if (!cur_header) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("locate_itemx() failed in engine_setbit()\n");
+#endif
+        return -ENOSPC;
+    }
+
+    it = create_item(key, nkey, NULL, pos + 1);
+    if (!it) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("create_item() failed in engine_setbit()\n");
+#endif
+        return -ENOSPC;
+    }
+    c = bit ? mask : 0;
+    write_item_range(it, pos, (char*) &c, 1);
+
+    itx = create_itemx(key_md, key, nkey, it);
+    if (!itx) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("create_itemx() failed in engine_setbit()\n");
+#endif
+        unlink_item(it);
+        return -ENOSPC;
+    }
+    *old = 0;
+    return add_itemx(ks, itx, cur_header);
+}
+
+/*
+ * fetch the bit at offset of the value of the key into *bit,
+ * a missing key or a bit past the end reads as 0.
+ */
+ssize_t engine_getbit(struct kkv_keyspace *ks, char *key, ssize_t nkey, uint64_t offset, uint64_t *bit)
+{
+    struct itemx *itx;
+    uint32_t key_md;
+    unsigned char c = 0;
+
+    key_md = engine_hash(key, nkey);
+#ifdef DEBUG_KKV_ENGINE
+    printk("the key_md is 0x%x\n", key_md);
+#endif
+
+    *bit = 0;
+    itx = find_itemx(ks, key_md, key, nkey);
+    if (!itx)
+        return 0;
+    if (itx->type != KKV_TYPE_STRING)
+        return -EINVAL;
+
+    if (offset < (uint64_t) KKV_BITMAP_MAX * 8 && read_item_range(itx->it, offset >> 3, (char*) &c, 1) == 1)
+        *bit = !!(c & (0x80 >> (offset & 7)));
+    return 0;
+}
+
+/*
+ * count the set bits in nbytes bytes of the value of the key from offset,
+ * or up to the end if nbytes is 0. a missing key counts as empty.
+ */
+ssize_t engine_bitcount(struct kkv_keyspace *ks, char *key, ssize_t nkey, ssize_t offset, ssize_t nbytes, uint64_t *nr)
+{
+    struct itemx *itx;
+    uint32_t key_md;
+
+    key_md = engine_hash(key, nkey);
+#ifdef DEBUG_KKV_ENGINE
+    printk("the key_md is 0x%x\n", key_md);
+#endif
+
+    *nr = 0;
+    itx = find_itemx(ks, key_md, key, nkey);
+    if (!itx)
+        return 0;
+    if (itx->type != KKV_TYPE_STRING)
+        return -EINVAL;
+
+    *nr = count_item_bits(itx->it, offset, nbytes ? nbytes : item_value_size(itx->it));
+    return 0;
+}
+
+/*
+ * combine the values of nr source keys with op into the value of dkey,
+ * as long as the longest source, shorter sources are padded with zeros.
+ * dkey is removed if every source is missing or empty.
+ * @return: 0 with the length of the result in *len, or a negative error.
+ */
+ssize_t engine_bitop(struct kkv_keyspace *ks, int op, char *dkey, ssize_t ndkey, char **key, ssize_t *nkey, int nr, uint64_t *len)
+{
+    struct item *src[KKV_BITOP_MAX];
+    struct item *it;
+    struct itemx *itx;
+    ssize_t max = 0;
+    int i;
+
+    if (op < KKV_BITOP_AND || op > KKV_BITOP_NOT || nr < 1 || nr > KKV_BITOP_MAX || (op == KKV_BITOP_NOT && nr != 1))
+        return -EINVAL;
+
+    for (i = 0; i < nr; i++) {
+        itx = find_itemx(ks, key_hash(key[i], nkey[i]), key[i], nkey[i]);
+        if (itx && itx->type != KKV_TYPE_STRING)
+            return -EINVAL;
+        src[i] = itx ? itx->it : NULL;
+        if (src[i] && item_value_size(src[i]) > max)
+            max = item_value_size(src[i]);
+    }
+
+    *len = max;
+    if (!max) {
+        engine_delete(ks, dkey, ndkey);
+        return 0;
+    }
+
+    it = create_item(dkey, ndkey, NULL, max);
+    if (!it) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("create_item() failed in engine_bitop()\n");
+#endif
+        return -ENOSPC;
+    }
+    bitop_item(it, src[0], op == KKV_BITOP_NOT ? KKV_BITOP_NOT : KKV_BITOP_COPY);
+    for (i = 1; i < nr; i++)
+        bitop_item(it, src[i], op);
+
+    return engine_store(ks, dkey, ndkey, it, KKV_TYPE_STRING);
+}
+
+/*
+ * add nr elements, at most KKV_HLL_BATCH, to the HyperLogLog of the key, which is created if missing.
+ * @return: 0 with *changed set to whether the registers changed, or a negative error.
+ */
+ssize_t engine_pfadd(struct kkv_keyspace *ks, char *key, ssize_t nkey, char **elem, ssize_t *nelem, int nr, uint64_t *changed)
+{
+    struct item *it;
+    struct itemx *itx;
+    uint32_t key_md;
+    uint8_t *regs;
+    ssize_t ret = 0;
+
+    key_md = engine_hash(key, nkey);
+#ifdef DEBUG_KKV_ENGINE
+    printk("the key_md is 0x%x\n", key_md);
+#endif
+
+    itx = find_itemx(ks, key_md, key, nkey);
+    if (itx && itx->type != KKV_TYPE_HLL)
+        return -EINVAL;
+
+    if (itx && hll_dense(itx->it)) {
+        if (engine_own_item(ks, itx))
+            return -ENOSPC;
+        *changed = hll_add_dense(itx->it, elem, nelem, nr) > 0;
+        if (*changed)
+            touch_itemx(ks, itx, 0);
+        return 0;
+    }
+
+    //a sparse HyperLogLog is updated in place as long as no register is added to it.
+    if (itx) {
+        if (engine_own_item(ks, itx))
+            return -ENOSPC;
+        ret = hll_add_sparse(itx->it, elem, nelem, nr);
+        if (ret >= 0) {
+            *changed = ret > 0;
+            if (*changed)
+                touch_itemx(ks, itx, 0);
+            return 0;
+        }
+        if (ret != -ENOENT)
+            return ret;
+        ret = 0;
+    }
+
+    //otherwise it is small, so it is simply rebuilt.
+    regs = kzalloc(HLL_REGISTERS, GFP_KERNEL);
+    if (!regs)
+        return -ENOMEM;
+    if (itx)
+        ret = hll_load(itx->it, regs);
+    if (!ret) {
+        *changed = hll_add(regs, elem, nelem, nr) > 0 || !itx;
+        if (*changed) {
+            it = hll_build(key, nkey, regs);
+            ret = it ? engine_store(ks, key, nkey, it, KKV_TYPE_HLL) : -ENOSPC;
+        }
+    }
+    kfree(regs);
+    return ret;
+}
+
+/*
+ * merge the HyperLogLogs of nr keys into unpacked registers, missing keys are skipped.
+ */
+static ssize_t engine_hll_load(struct kkv_keyspace *ks, char **key, ssize_t *nkey, int nr, uint8_t *regs)
+{
+    struct itemx *itx;
+    ssize_t ret;
+    int i;
+
+    for (i = 0; i < nr; i++) {
+        itx = find_itemx(ks, key_hash(key[i], nkey[i]), key[i], nkey[i]);
+        if (!itx)
+            continue;
+        if (itx->type != KKV_TYPE_HLL)
+            return -EINVAL;
+        ret = hll_load(itx->it, regs);
+        if (ret)
+            return ret;
+    }
+    return 0;
+}
+
+/*
+ * estimate the cardinality of the union of the HyperLogLogs of nr keys.
+ */
+ssize_t engine_pfcount(struct kkv_keyspace *ks, char **key, ssize_t *nkey, int nr, uint64_t *count)
+{
+    uint8_t *regs;
+    ssize_t ret;
+
+    regs = kzalloc(HLL_REGISTERS, GFP_KERNEL);
+    if (!regs)
+        return -ENOMEM;
+    ret = engine_hll_load(ks, key, nkey, nr, regs);
+    if (!ret)
+        *count = hll_count(regs);
+    kfree(regs);
+    return ret;
+}
+
+/*
+ * merge the HyperLogLogs of nr source keys into that of dkey, which is created if missing.
+ * *count is set to the estimated cardinality of the result.
+ */
+ssize_t engine_pfmerge(struct kkv_keyspace *ks, char *dkey, ssize_t ndkey, char **key, ssize_t *nkey, int nr, uint64_t *count)
+{
+    struct item *it;
+    uint8_t *regs;
+    ssize_t ret;
+
+    regs = kzalloc(HLL_REGISTERS, GFP_KERNEL);
+    if (!regs)
+        return -ENOMEM;
+    ret = engine_hll_load(ks, &dkey, &ndkey, 1, regs);
+    if (!ret)
+        ret = engine_hll_load(ks, key, nkey, nr, regs);
+    if (!ret) {
+        *count = hll_count(regs);
+        it = hll_build(dkey, ndkey, regs);
+        ret = it ? engine_store(ks, dkey, ndkey, it, KKV_TYPE_HLL) : -ENOSPC;
+    }
+    kfree(regs);
+    return ret;
+}
+
+/*
+ * find the latest op on the same key before ops[i] in the batch.
+ */
+static struct kkv_op *engine_prev_op(struct kkv_op *ops, int i)
+{
+    struct kkv_op *op = &ops[i];
+
+    while (--i >= 0) {
+        if (ops[i].key_md == op->key_md && ops[i].nkey == op->nkey && !memcmp(ops[i].key, op->key, op->nkey))
+            return &ops[i];
+    }
+    return NULL;
+}
+
+/*
+ * apply a batch of writes all or nothing.
+ * every op is first checked against the state left by the ops before it,
+ * and all the memory it needs is allocated; only if every op passes,
+ * the batch is applied, which can't fail any more.
+ * deleting a missing key is not an error here.
+ * @return: 0 if applied, or the error of the failed op, whose ret tells which one;
+ * the ret of every other op is then -ECANCELED.
+ */
+ssize_t engine_multi(struct kkv_keyspace *ks, struct kkv_op *ops, int nr)
+{
+    struct kkv_op *op, *prev;
+    struct itemx *itx;
+    struct itemx **cur_header = NULL;
+    ssize_t ret = 0;
+    int i, j;
+
+    for (i = 0; i < nr; i++) {
+        op = &ops[i];
+        op->it = NULL;
+        op->itx = NULL;
+        op->ret = 0;
+        op->key_md = key_hash(op->key, op->nkey);
+
+        itx = locate_itemx(ks, op->key_md, op->key, op->nkey, &cur_header, 1);
+        if (!itx && !cur_header) {
+            ret = -ENOSPC;
+            break;
+        }
+        prev = engine_prev_op(ops, i);
+        op->exists = prev ? prev->op != KKV_OP_DELETE : itx != NULL;
+
+        if (op->op == KKV_OP_ADD && op->exists) {
+            ret = -EEXIST;
+            break;
+        }
+        if (op->op == KKV_OP_REPLACE && !op->exists) {
+            ret = -ENOENT;
+            break;
+        }
+        if (op->op == KKV_OP_DELETE)
+            continue;
+
+        op->it = dedup_create_item(op->key, op->nkey, op->value, op->nvalue);
+        if (!op->it) {
+            ret = -ENOSPC;
+            break;
+        }
+        if (!op->exists) {
+            op->itx = create_itemx(op->key_md, op->key, op->nkey, op->it);
+            if (!op->itx) {
+                ret = -ENOSPC;
+                break;
+            }
+        }
+    }
+
+    if (ret) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("op %d failed in engine_multi(): %ld\n", i, ret);
+#endif
+        for (j = 0; j < nr; j++) {
+            if (j <= i) {
+                if (ops[j].itx)
+                    free_itemx(ops[j].itx);
+                else if (ops[j].it)
+                    unlink_item(ops[j].it);
+            }
+            ops[j].ret = j == i ? ret : -ECANCELED;
+        }
+        return ret;
+    }
+
+    for (i = 0; i < nr; i++) {
+        op = &ops[i];
+        itx = locate_itemx(ks, op->key_md, op->key, op->nkey, &cur_header, 0);
+        if (op->op == KKV_OP_DELETE) {
+            if (itx)
+                delete_itemx(ks, itx, cur_header);
+            else
+                lease_revoke(ks, op->key_md);
+        } else if (itx) {
+            update_itemx(ks, itx, op->it);
+            itx->type = KKV_TYPE_STRING;
+            itx->flags = 0;
+        } else {
+            add_itemx(ks, op->itx, cur_header);
+        }
+    }
+    return 0;
+}
+
+/*
+ * prepare the hash-map of itx for modification in place.
+ * a chain that others hold, that has been fragmented, or whose dead records
+ * take most of it, is rebuilt with the live fields only.
+ */
+static ssize_t engine_own_hmap(struct kkv_keyspace *ks, struct itemx *itx)
+{
+    struct item *it;
+
+    if (!itemx_writable(ks, itx) || item_fragmented(itx->it) || hmap_fragmented(itx->it)) {
+        it = hmap_compact(itx->it);
+        if (it)
+            update_itemx(ks, itx, it);
+        else if (!itemx_writable(ks, itx))
+            return -ENOSPC;
+    }
+    return 0;
+}
+
+/*
+ * read at most nvalue bytes of the value of a field of the hash-map key.
+ * @return: the # of bytes read, or a negative error.
+ */
+ssize_t engine_hget(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *field, ssize_t nfield, char *value, ssize_t nvalue, uint64_t *cas)
+{
+    struct itemx *itx;
+    uint32_t key_md;
+
+    key_md = engine_hash(key, nkey);
+#ifdef DEBUG_KKV_ENGINE
+    printk("the key_md is 0x%x\n", key_md);
+#endif
+
+    itx = find_itemx(ks, key_md, key, nkey);
+    if (!itx) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("find_itemx() failed in engine_hget()\n");
+#endif
+        return -ENOENT;
+    }
+    if (itx->type != KKV_TYPE_HMAP)
+        return -EINVAL;
+
+    *cas = itx->cas;
+    return hmap_get(itx->it, field, nfield, value, nvalue);
+}
+
+/*
+ * store value into a field of the hash-map key, which is created if missing.
+ * only the record of the field is written, the other fields are not copied.
+ */
+ssize_t engine_hset(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *field, ssize_t nfield, char *value, ssize_t nvalue)
+{
+    struct item *it;
+    struct itemx *itx;
+    uint32_t key_md;
+    struct itemx **cur_header = NULL;
+    ssize_t ret;
+
+    key_md = engine_hash(key, nkey);
+#ifdef DEBUG_KKV_ENGINE
+    printk("the key_md is 0x%x\n", key_md);
+#endif
+
+    itx = locate_itemx(ks, key_md, key, nkey, &cur_header, 1);
+    if (itx) {
+        if (itx->type != KKV_TYPE_HMAP)
+            return -EINVAL;
+        if (engine_own_hmap(ks, itx))
+            return -ENOSPC;
+        ret = hmap_set(itx->it, field, nfield, value, nvalue);
+        if (ret < 0)
+            return ret;
+        touch_itemx(ks, itx, ret);
+        return 0;
+    } else if (!cur_header) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("locate_itemx() failed in engine_hset()\n");
+#endif
+        return -ENOSPC;
+    }
+
+    it = hmap_create(key, nkey);
+    if (!it) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("hmap_create() failed in engine_hset()\n");
+#endif
+        return -ENOSPC;
+    }
+    ret = hmap_set(it, field, nfield, value, nvalue);
+    if (ret < 0) {
+        unlink_item(it);
+        return ret;
+    }
+
+    itx = create_itemx(key_md, key, nkey, it);
+    if (!itx) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("create_itemx() failed in engine_hset()\n");
+#endif
+        unlink_item(it);
+        return -ENOSPC;
+    }
+    itx->type = KKV_TYPE_HMAP;
+    return add_itemx(ks, itx, cur_header);
+}
+
+/*
+ * remove a field of the hash-map key, the key is gone with its last field.
+ */
+ssize_t engine_hdel(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *field, ssize_t nfield)
+{
+    struct itemx *itx;
+    uint32_t key_md;
+    struct itemx **cur_header;
+    ssize_t ret;
+
+    key_md = engine_hash(key, nkey);
+#ifdef DEBUG_KKV_ENGINE
+    printk("the key_md is 0x%x\n", key_md);
+#endif
+
+    itx = locate_itemx(ks, key_md, key, nkey, &cur_header, 0);
+    if (!itx) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("locate_itemx() failed in engine_hdel()\n");
+#endif
+        return -ENOENT;
+    }
+    if (itx->type != KKV_TYPE_HMAP)
+        return -EINVAL;
+
+    if (engine_own_hmap(ks, itx))
+        return -ENOSPC;
+    ret = hmap_del(itx->it, field, nfield);
+    if (ret)
+        return ret;
+
+    if (!hmap_len(itx->it))
+        return delete_itemx(ks, itx, cur_header);
+    touch_itemx(ks, itx, 0);
+    return 0;
+}
+
+/*
+ * pack all the fields of the hash-map key into value, see hmap_getall().
+ * value may overlap key, it is written only once the key is found.
+ * @return: the length packed, or a negative error.
+ */
+ssize_t engine_hgetall(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *value, ssize_t nvalue, uint64_t *cas)
+{
+    struct itemx *itx;
+    uint32_t key_md;
+
+    key_md = engine_hash(key, nkey);
+#ifdef DEBUG_KKV_ENGINE
+    printk("the key_md is 0x%x\n", key_md);
+#endif
+
+    itx = find_itemx(ks, key_md, key, nkey);
+    if (!itx) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("find_itemx() failed in engine_hgetall()\n");
+#endif
+        return -ENOENT;
+    }
+    if (itx->type != KKV_TYPE_HMAP)
+        return -EINVAL;
+
+    *cas = itx->cas;
+    return hmap_getall(itx->it, value, nvalue);
+}
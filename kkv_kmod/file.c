@@ -26,6 +26,36 @@
 #define COMMAND_REPLACE 13
 #define COMMAND_DELETE 14
 #define COMMAND_SHRINK 15
+#define COMMAND_MGET 30
+#define COMMAND_MSET 31
+#define COMMAND_MDELETE 32
+#define COMMAND_INCR 33
+#define COMMAND_DECR 34
+#define COMMAND_APPEND 35
+#define COMMAND_PREPEND 36
+#define COMMAND_CAS 37
+#define COMMAND_GETRANGE 38
+#define COMMAND_SETRANGE 39
+#define COMMAND_MULTI 40
+#define COMMAND_STATS 41
+#define COMMAND_FLUSH 42
+#define COMMAND_HGET 43
+#define COMMAND_HSET 44
+#define COMMAND_HDEL 45
+#define COMMAND_HGETALL 46
+#define COMMAND_SETBIT 47
+#define COMMAND_GETBIT 48
+#define COMMAND_BITCOUNT 49
+#define COMMAND_BITOP 50
+#define COMMAND_PFADD 51
+#define COMMAND_PFCOUNT 52
+#define COMMAND_PFMERGE 53
+#define COMMAND_LGET 54
+#define COMMAND_LSET 55
+#define COMMAND_DELETE_PREFIX 56
+#define COMMAND_SNAPSHOT 57
+#define COMMAND_RELEASE 58
+#define COMMAND_NOOP 59
 
 #ifdef DEBUG_KKV_STAT
 static ssize_t used_mem = 0;
@@ -184,7 +214,7 @@ static ssize_t kkv_DIO(int rw, struct kiocb *iocb, const struct iovec *iov,
     //TODO: handle the scatter-gatter buffer
     __copy_from_user(kkv_req_buf, iov[0].iov_base, iov[0].iov_len);
 
-    ret=kkv_process_req(kkv_req_buf,KKV_REQ_BUF_SIZE,&rsp_len);
+    ret=kkv_process_req(file->f_mapping->host->i_private,kkv_req_buf,KKV_REQ_BUF_SIZE,&rsp_len);
     //We have a hack here:
     //won't copy the response packet back to user if it contains no payload.
     if(ret>0) {
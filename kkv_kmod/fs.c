@@ -22,6 +22,7 @@
 static const struct super_operations kkv_ops = {
 	.statfs = simple_statfs,
 	.drop_inode = generic_delete_inode,
+	.evict_inode = kkv_evict_inode,
 	.show_options = generic_show_options,
 };
 
@@ -1,4 +1,5 @@
 #include <linux/types.h>
+#include <linux/string.h>
 
 #define rot(x,k) (((x)<<(k)) ^ ((x)>>(32-(k))))
 
@@ -191,4 +192,30 @@ uint32_t hash(
 
 	final(a, b, c);
 	return c; /* zero length strings require no mixing */
+}
+
+/*
+ * the hash of a key in the index.
+ * a key of 8 or 16 bytes, typically an integer id, is hashed as 64-bit integers
+ * with the finalizer of MurmurHash3, which takes a few multiplications instead of hash().
+ */
+uint32_t key_hash(const void *key, size_t length)
+{
+	uint64_t k, k2;
+
+	if (length != 8 && length != 16)
+		return hash(key, length, 0);
+
+	memcpy(&k, key, 8);
+	if (length == 16) {
+		memcpy(&k2, (const char *) key + 8, 8);
+		k += k2 * 0x9e3779b97f4a7c15ULL;
+	}
+
+	k ^= k >> 33;
+	k *= 0xff51afd7ed558ccdULL;
+	k ^= k >> 33;
+	k *= 0xc4ceb9fe1a85ec53ULL;
+	k ^= k >> 33;
+	return (uint32_t) k;
 }
\ No newline at end of file
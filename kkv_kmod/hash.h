@@ -11,6 +11,7 @@
 
 
 uint32_t hash(const void *key, size_t length, const uint32_t initval);
+uint32_t key_hash(const void *key, size_t length);
 
 
 #endif
\ No newline at end of file
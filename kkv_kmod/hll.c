@@ -0,0 +1,337 @@
+/*
+ * In-Kernel Key/Value Store.
+ *
+ * Copyright (C) 2013-2014 jilinxpd.
+ *
+ * This file is released under the GPL.
+ */
+
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/bitops.h>
+#include <linux/math64.h>
+#include "kkv.h"
+#include "hash.h"
+#include "hll.h"
+
+/*
+ * a HyperLogLog is stored in the item chain as a struct hll_head followed by
+ * its registers in one of two encodings:
+ * - sparse, the non-zero registers as __u32 (index << 8 | value) sorted by index,
+ *   used while they take no more than HLL_SPARSE_MAX bytes;
+ * - dense, all the registers packed in 6 bits each, 12 KB.
+ * a dense HyperLogLog is updated in place, so is a sparse one while only registers
+ * already having an entry grow; setting a new register rebuilds it,
+ * which is cheap since it is small.
+ */
+
+#define HLL_INDEX_BITS 14
+#define HLL_REGISTER_BITS 6
+#define HLL_REGISTER_MAX ((1 << HLL_REGISTER_BITS) - 1)
+//one more byte so that the last register can be read as 2 bytes as well.
+#define HLL_DENSE_SIZE (HLL_REGISTERS * HLL_REGISTER_BITS / 8 + 1)
+#define HLL_SPARSE_MAX 3000
+
+#define HLL_SPARSE 0
+#define HLL_DENSE 1
+
+//the seeds of the two 32-bit hashes making up the 64-bit hash of an element.
+#define HLL_SEED_HI 0x9747b28c
+#define HLL_SEED_LO 0x5bd1e995
+
+//alpha * 2^63, with alpha = 0.7213 / (1 + 1.079 / HLL_REGISTERS).
+#define HLL_ALPHA 6652380144825911296ULL
+//the registers are summed as 2^(HLL_SUM_SHIFT - register).
+#define HLL_SUM_SHIFT 40
+//ln(2) in 16.16 fixed point.
+#define HLL_LN2 45426
+
+struct hll_head {
+    char magic[4];
+    uint32_t encoding;
+};
+
+static const char hll_magic[4] = {'H', 'L', 'L', '1'};
+
+#define HLL_DATA_OFFSET ((ssize_t)sizeof(struct hll_head))
+
+static int hll_encoding(struct item *it)
+{
+    struct hll_head head;
+
+    if (read_item(it, (char*) &head, sizeof(struct hll_head)) != sizeof(struct hll_head) ||
+            memcmp(head.magic, hll_magic, sizeof(hll_magic)))
+        return -EINVAL;
+    return head.encoding;
+}
+
+int hll_dense(struct item *it)
+{
+    return hll_encoding(it) == HLL_DENSE;
+}
+
+/*
+ * hash the element into the index of its register and the value it proposes,
+ * which is the position of the lowest set bit in the rest of the hash.
+ */
+static void hll_hash(char *elem, ssize_t nelem, uint32_t *index, uint8_t *value)
+{
+    uint64_t h;
+
+    h = (uint64_t) hash(elem, nelem, HLL_SEED_HI) << 32 | hash(elem, nelem, HLL_SEED_LO);
+    *index = h & (HLL_REGISTERS - 1);
+    h >>= HLL_INDEX_BITS;
+    h |= 1ULL << (64 - HLL_INDEX_BITS);
+    *value = __ffs64(h) + 1;
+}
+
+/*
+ * a packed register lies in the 2 bytes at b, starting from bit shift of the first one.
+ */
+static inline uint8_t hll_get_register(uint8_t *b, int shift)
+{
+    return ((b[0] >> shift) | (b[1] << (8 - shift))) & HLL_REGISTER_MAX;
+}
+
+static inline void hll_set_register(uint8_t *b, int shift, uint8_t value)
+{
+    b[0] &= ~(HLL_REGISTER_MAX << shift);
+    b[0] |= value << shift;
+    b[1] &= ~(HLL_REGISTER_MAX >> (8 - shift));
+    b[1] |= value >> (8 - shift);
+}
+
+#define HLL_BYTE(index) ((index) * HLL_REGISTER_BITS / 8)
+#define HLL_SHIFT(index) ((index) * HLL_REGISTER_BITS & 7)
+
+/*
+ * add the elements to a dense HyperLogLog in place, the chain must be writable.
+ * only the 2 bytes holding the register of each element are touched.
+ * @return: the # of registers changed.
+ */
+int hll_add_dense(struct item *it, char **elem, ssize_t *nelem, int nr)
+{
+    uint8_t b[2];
+    uint32_t index;
+    uint8_t value;
+    ssize_t pos;
+    int i, changed = 0;
+
+    for (i = 0; i < nr; i++) {
+        hll_hash(elem[i], nelem[i], &index, &value);
+        pos = HLL_DATA_OFFSET + HLL_BYTE(index);
+        read_item_range(it, pos, (char*) b, 2);
+        if (hll_get_register(b, HLL_SHIFT(index)) < value) {
+            hll_set_register(b, HLL_SHIFT(index), value);
+            write_item_range(it, pos, (char*) b, 2);
+            changed++;
+        }
+    }
+    return changed;
+}
+
+/*
+ * add the elements to a sparse HyperLogLog in place, the chain must be writable.
+ * the entries are only rewritten if some of them grew, and their # never changes.
+ * @return: the # of registers changed, -ENOENT if an element sets a register
+ * without an entry, which needs the HyperLogLog rebuilt, nothing is written then,
+ * or -ENOMEM.
+ */
+int hll_add_sparse(struct item *it, char **elem, ssize_t *nelem, int nr)
+{
+    uint32_t *entry;
+    ssize_t len;
+    uint32_t index;
+    uint8_t value;
+    int i, lo, hi, mid, changed = 0;
+
+    entry = kmalloc(HLL_SPARSE_MAX + sizeof(uint32_t), GFP_KERNEL);
+    if (!entry)
+        return -ENOMEM;
+    len = read_item_range(it, HLL_DATA_OFFSET, (char*) entry, HLL_SPARSE_MAX + sizeof(uint32_t));
+    if (len > HLL_SPARSE_MAX) {
+        kfree(entry);
+        return -ENOENT;
+    }
+    len /= sizeof(uint32_t);
+
+    for (i = 0; i < nr; i++) {
+        hll_hash(elem[i], nelem[i], &index, &value);
+        //the entries are sorted by index.
+        for (lo = 0, hi = len; lo < hi; ) {
+            mid = (lo + hi) / 2;
+            if (((entry[mid] >> 8) & (HLL_REGISTERS - 1)) < index)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        if (lo == len || ((entry[lo] >> 8) & (HLL_REGISTERS - 1)) != index) {
+            kfree(entry);
+            return -ENOENT;
+        }
+        if ((entry[lo] & 0xff) < value) {
+            entry[lo] = index << 8 | value;
+            changed++;
+        }
+    }
+
+    if (changed)
+        write_item_range(it, HLL_DATA_OFFSET, (char*) entry, len * sizeof(uint32_t));
+    kfree(entry);
+    return changed;
+}
+
+/*
+ * add the elements to the unpacked registers.
+ * @return: the # of registers changed.
+ */
+int hll_add(uint8_t *regs, char **elem, ssize_t *nelem, int nr)
+{
+    uint32_t index;
+    uint8_t value;
+    int i, changed = 0;
+
+    for (i = 0; i < nr; i++) {
+        hll_hash(elem[i], nelem[i], &index, &value);
+        if (regs[index] < value) {
+            regs[index] = value;
+            changed++;
+        }
+    }
+    return changed;
+}
+
+/*
+ * merge the registers of the HyperLogLog into the unpacked registers,
+ * each one keeping the larger value.
+ * @return: 0 on success, or a negative error.
+ */
+int hll_load(struct item *it, uint8_t *regs)
+{
+    uint8_t *buf;
+    uint32_t *entry;
+    ssize_t len;
+    uint32_t i;
+    uint8_t value;
+    int encoding;
+
+    encoding = hll_encoding(it);
+    if (encoding < 0)
+        return encoding;
+
+    buf = kmalloc(HLL_DENSE_SIZE, GFP_KERNEL);
+    if (!buf)
+        return -ENOMEM;
+    len = read_item_range(it, HLL_DATA_OFFSET, (char*) buf, HLL_DENSE_SIZE);
+
+    if (encoding == HLL_DENSE) {
+        for (i = 0; len == HLL_DENSE_SIZE && i < HLL_REGISTERS; i++) {
+            value = hll_get_register(buf + HLL_BYTE(i), HLL_SHIFT(i));
+            if (regs[i] < value)
+                regs[i] = value;
+        }
+    } else {
+        for (entry = (uint32_t*) buf; (uint8_t*) (entry + 1) <= buf + len; entry++) {
+            i = (*entry >> 8) & (HLL_REGISTERS - 1);
+            value = *entry & 0xff;
+            if (regs[i] < value)
+                regs[i] = value;
+        }
+    }
+    kfree(buf);
+    return 0;
+}
+
+/*
+ * create an item chain holding the unpacked registers, sparse if they fit.
+ * @return: the new chain, or NULL if no memory.
+ */
+struct item *hll_build(char *key, ssize_t nkey, uint8_t *regs)
+{
+    struct hll_head *head;
+    struct item *it;
+    uint8_t *buf, *data;
+    uint32_t *entry;
+    uint32_t i, nr = 0;
+
+    for (i = 0; i < HLL_REGISTERS; i++) {
+        if (regs[i])
+            nr++;
+    }
+
+    buf = kzalloc(HLL_DATA_OFFSET + HLL_DENSE_SIZE, GFP_KERNEL);
+    if (!buf)
+        return NULL;
+    head = (struct hll_head*) buf;
+    data = buf + HLL_DATA_OFFSET;
+    memcpy(head->magic, hll_magic, sizeof(hll_magic));
+
+    if (nr * sizeof(uint32_t) <= HLL_SPARSE_MAX) {
+        head->encoding = HLL_SPARSE;
+        entry = (uint32_t*) data;
+        for (i = 0; i < HLL_REGISTERS; i++) {
+            if (regs[i])
+                *entry++ = i << 8 | regs[i];
+        }
+        it = create_item(key, nkey, (char*) buf, HLL_DATA_OFFSET + nr * sizeof(uint32_t));
+    } else {
+        head->encoding = HLL_DENSE;
+        for (i = 0; i < HLL_REGISTERS; i++)
+            hll_set_register(data + HLL_BYTE(i), HLL_SHIFT(i), regs[i]);
+        it = create_item(key, nkey, (char*) buf, HLL_DATA_OFFSET + HLL_DENSE_SIZE);
+    }
+    kfree(buf);
+    return it;
+}
+
+/*
+ * log2(x) in 16.16 fixed point, x > 0.
+ */
+static uint64_t hll_log2(uint32_t x)
+{
+    uint64_t r, y;
+    int n, i;
+
+    n = fls(x) - 1;
+    r = (uint64_t) n << 16;
+    y = ((uint64_t) x << 16) >> n;
+    for (i = 15; i >= 0; i--) {
+        y = (y * y) >> 16;
+        if (y >= 2 << 16) {
+            y >>= 1;
+            r |= 1 << i;
+        }
+    }
+    return r;
+}
+
+/*
+ * estimate the cardinality from the unpacked registers, in integer arithmetic only:
+ * the raw HyperLogLog estimate, or linear counting for small cardinalities.
+ */
+uint64_t hll_count(uint8_t *regs)
+{
+    uint64_t sum = 0, est;
+    uint32_t zeros = 0;
+    uint32_t i;
+
+    for (i = 0; i < HLL_REGISTERS; i++) {
+        if (!regs[i])
+            zeros++;
+        if (regs[i] <= HLL_SUM_SHIFT)
+            sum += 1ULL << (HLL_SUM_SHIFT - regs[i]);
+    }
+    if (!sum)
+        sum = 1;
+
+    //alpha * m^2 / sum(2^-register), with sum scaled by 2^HLL_SUM_SHIFT and m = 2^14.
+    est = div64_u64(HLL_ALPHA, sum) << (2 * HLL_INDEX_BITS + HLL_SUM_SHIFT - 63);
+
+    //m * ln(m / zeros).
+    if (zeros && est <= (uint64_t) HLL_REGISTERS * 5 / 2)
+        est = ((uint64_t) HLL_REGISTERS * (hll_log2(HLL_REGISTERS) - hll_log2(zeros)) * HLL_LN2) >> 32;
+    return est;
+}
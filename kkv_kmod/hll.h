@@ -0,0 +1,25 @@
+/*
+ * In-Kernel Key/Value Store.
+ *
+ * Copyright (C) 2013-2014 jilinxpd.
+ *
+ * This file is released under the GPL.
+ */
+
+#ifndef _KKV_HLL_H
+#define _KKV_HLL_H
+
+
+//# of registers of a HyperLogLog, each one is a byte in the unpacked form.
+#define HLL_REGISTERS (1 << 14)
+
+int hll_dense(struct item *it);
+int hll_add_dense(struct item *it, char **elem, ssize_t *nelem, int nr);
+int hll_add_sparse(struct item *it, char **elem, ssize_t *nelem, int nr);
+int hll_add(uint8_t *regs, char **elem, ssize_t *nelem, int nr);
+int hll_load(struct item *it, uint8_t *regs);
+struct item *hll_build(char *key, ssize_t nkey, uint8_t *regs);
+uint64_t hll_count(uint8_t *regs);
+
+
+#endif
@@ -0,0 +1,461 @@
+/*
+ * In-Kernel Key/Value Store.
+ *
+ * Copyright (C) 2013-2014 jilinxpd.
+ *
+ * This file is released under the GPL.
+ */
+
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include "kkv.h"
+#include "hmap.h"
+
+/*
+ * a hash-map value is stored in the item chain as a struct hmap_head,
+ * the index of the fields, which is an array of nbucket __u32 buckets,
+ * and then the records of the fields back to back, each one being
+ * a struct hmap_rec, the field and then its value, unpadded.
+ * a bucket holds the offset of the first record of the fields hashed to it,
+ * and each record the offset of the next one, 0 ending the list,
+ * so a field is found by walking the records of its bucket only.
+ * a field whose value keeps its length is overwritten in place;
+ * otherwise a new record is appended and the old one is unlinked and marked dead,
+ * so updating a field touches the bytes of that field and a few links.
+ * the dead records are dropped, and the index is grown once the fields outnumber
+ * twice the buckets, by hmap_compact().
+ */
+
+//set in hmap_rec.nfield of a dead record.
+#define HMAP_DEAD 0x80000000U
+//the value isn't worth compacting before its dead records take this # of bytes.
+#define HMAP_MIN_DEAD 256
+//the # of buckets of a new hash-map, the # is always a power of 2.
+#define HMAP_MIN_BUCKETS 8
+
+struct hmap_head {
+    uint32_t nr; //# of live fields.
+    uint32_t dead; //# of bytes taken by the dead records.
+    uint32_t nbucket; //# of buckets of the index.
+};
+
+struct hmap_rec {
+    uint32_t nfield;
+    uint32_t nvalue;
+    uint32_t next; //offset of the next record in the bucket, not kept by a dead one.
+};
+
+//the offset of the first record.
+#define HMAP_RECORDS(head) ((ssize_t)sizeof(struct hmap_head) + (ssize_t)(head)->nbucket * sizeof(uint32_t))
+
+#define HMAP_REC_SIZE(rec) ((ssize_t)sizeof(struct hmap_rec) + ((rec)->nfield & ~HMAP_DEAD) + (rec)->nvalue)
+
+/*
+ * a position within the value of an item chain.
+ */
+struct hmap_cursor {
+    struct item *it; //the current region, NULL past the end.
+    ssize_t off; //offset within the value part of the region.
+    ssize_t pos; //offset within the whole value.
+};
+
+#define HMAP_SKIP 0
+#define HMAP_READ 1
+#define HMAP_WRITE 2
+#define HMAP_CMP 3
+
+static void hmap_seek(struct hmap_cursor *cur, struct item *it, ssize_t pos)
+{
+    cur->pos = pos;
+    while (it && pos >= VALUE_SIZE_OF_ITEM(it)) {
+        pos -= VALUE_SIZE_OF_ITEM(it);
+        it = it->next;
+    }
+    cur->it = it;
+    cur->off = pos;
+}
+
+/*
+ * skip, read, write or compare n bytes at the cursor, and move it past them.
+ * @return: 0 on success, -1 if the value ends first or the bytes differ,
+ * in which case the cursor is left at the first chunk not done.
+ */
+static int hmap_walk(struct hmap_cursor *cur, char *buf, ssize_t n, int op)
+{
+    ssize_t len;
+    char *data;
+
+    while (n > 0) {
+        if (!cur->it)
+            return -1;
+        len = VALUE_SIZE_OF_ITEM(cur->it) - cur->off;
+        if (len > n)
+            len = n;
+        data = VALUE_OF_ITEM(cur->it) + cur->off;
+
+        if (op == HMAP_READ)
+            memcpy(buf, data, len);
+        else if (op == HMAP_WRITE)
+            memcpy(data, buf, len);
+        else if (op == HMAP_CMP && memcmp(data, buf, len))
+            return -1;
+
+        if (buf)
+            buf += len;
+        n -= len;
+        cur->off += len;
+        cur->pos += len;
+        if (cur->off == VALUE_SIZE_OF_ITEM(cur->it)) {
+            cur->it = cur->it->next;
+            cur->off = 0;
+        }
+    }
+    return 0;
+}
+
+static void hmap_head(struct item *it, struct hmap_head *head, int write)
+{
+    struct hmap_cursor cur;
+
+    hmap_seek(&cur, it, 0);
+    hmap_walk(&cur, (char*) head, sizeof(struct hmap_head), write ? HMAP_WRITE : HMAP_READ);
+}
+
+/*
+ * read or write the __u32 at pos, a bucket or the link of a record.
+ */
+static uint32_t hmap_link(struct item *it, ssize_t pos, uint32_t val, int write)
+{
+    struct hmap_cursor cur;
+
+    hmap_seek(&cur, it, pos);
+    hmap_walk(&cur, (char*) &val, sizeof(uint32_t), write ? HMAP_WRITE : HMAP_READ);
+    return val;
+}
+
+//FNV-1a, which can be fed a field in pieces as it's read out of the regions.
+#define HMAP_HASH_INIT 2166136261U
+
+static uint32_t hmap_hash(uint32_t h, char *data, ssize_t n)
+{
+    while (n-- > 0)
+        h = (h ^ (uint8_t) *data++) * 16777619U;
+    return h;
+}
+
+/*
+ * the offset of the bucket of field.
+ */
+static ssize_t hmap_bucket(struct hmap_head *head, char *field, ssize_t nfield)
+{
+    uint32_t h = hmap_hash(HMAP_HASH_INIT, field, nfield);
+
+    return sizeof(struct hmap_head) + (h & (head->nbucket - 1)) * sizeof(uint32_t);
+}
+
+/*
+ * find the live record of field in its bucket, the records are walked without copying their data.
+ * @return: the offset of the record within the value with the record in rec
+ * and the offset of the link to it, i.e. the bucket or the link of the record before it, in *link,
+ * or -1 if the field is missing, with the offset of its bucket in *link.
+ */
+static ssize_t hmap_find(struct item *it, char *field, ssize_t nfield, struct hmap_rec *rec, ssize_t *link)
+{
+    struct hmap_cursor cur;
+    struct hmap_head head;
+    ssize_t pos, bucket;
+
+    hmap_head(it, &head, 0);
+    bucket = hmap_bucket(&head, field, nfield);
+    *link = bucket;
+    pos = hmap_link(it, bucket, 0, 0);
+    while (pos) {
+        hmap_seek(&cur, it, pos);
+        if (hmap_walk(&cur, (char*) rec, sizeof(struct hmap_rec), HMAP_READ))
+            break;
+        if (rec->nfield == nfield && !hmap_walk(&cur, field, nfield, HMAP_CMP))
+            return pos;
+        *link = pos + offsetof(struct hmap_rec, next);
+        pos = rec->next;
+    }
+    *link = bucket;
+    return -1;
+}
+
+/*
+ * create an item chain holding an empty hash-map.
+ */
+struct item *hmap_create(char *key, ssize_t nkey)
+{
+    char buf[sizeof(struct hmap_head) + HMAP_MIN_BUCKETS * sizeof(uint32_t)];
+    struct hmap_head head = {0, 0, HMAP_MIN_BUCKETS};
+
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, &head, sizeof(struct hmap_head));
+    return create_item(key, nkey, buf, sizeof(buf));
+}
+
+/*
+ * read at most nvalue bytes of the value of field, value may overlap field.
+ * @return: the # of bytes read, or -ENOENT.
+ */
+ssize_t hmap_get(struct item *it, char *field, ssize_t nfield, char *value, ssize_t nvalue)
+{
+    struct hmap_cursor cur;
+    struct hmap_rec rec;
+    ssize_t pos, link;
+
+    pos = hmap_find(it, field, nfield, &rec, &link);
+    if (pos < 0)
+        return -ENOENT;
+
+    if (nvalue > rec.nvalue)
+        nvalue = rec.nvalue;
+    hmap_seek(&cur, it, pos + sizeof(struct hmap_rec) + nfield);
+    hmap_walk(&cur, value, nvalue, HMAP_READ);
+    return nvalue;
+}
+
+/*
+ * store value into field, the chain must be writable.
+ * the new record is appended before the old one is unlinked and marked dead,
+ * so a failure leaves the hash-map untouched.
+ * @return: the slab space the chain grew by, or a negative error.
+ */
+ssize_t hmap_set(struct item *it, char *field, ssize_t nfield, char *value, ssize_t nvalue)
+{
+    struct hmap_cursor cur;
+    struct hmap_head head;
+    struct hmap_rec rec, nrec;
+    ssize_t pos, size, link, grown;
+
+    if (nfield <= 0 || nfield & HMAP_DEAD)
+        return -EINVAL;
+
+    pos = hmap_find(it, field, nfield, &rec, &link);
+    if (pos >= 0 && rec.nvalue == nvalue) {
+        hmap_seek(&cur, it, pos + sizeof(struct hmap_rec) + nfield);
+        hmap_walk(&cur, value, nvalue, HMAP_WRITE);
+        return 0;
+    }
+
+    nrec.nfield = nfield;
+    nrec.nvalue = nvalue;
+    size = item_value_size(it);
+    grown = append_item(it, NULL, HMAP_REC_SIZE(&nrec));
+    if (grown < 0)
+        return -ENOSPC;
+
+    hmap_head(it, &head, 0);
+    if (pos >= 0) {
+        hmap_link(it, link, rec.next, 1);
+        rec.nfield |= HMAP_DEAD;
+        hmap_seek(&cur, it, pos);
+        hmap_walk(&cur, (char*) &rec, sizeof(struct hmap_rec), HMAP_WRITE);
+        head.dead += HMAP_REC_SIZE(&rec);
+    } else {
+        head.nr++;
+    }
+    hmap_head(it, &head, 1);
+
+    //the new record goes first in the bucket.
+    link = hmap_bucket(&head, field, nfield);
+    nrec.next = hmap_link(it, link, 0, 0);
+    hmap_seek(&cur, it, size);
+    hmap_walk(&cur, (char*) &nrec, sizeof(struct hmap_rec), HMAP_WRITE);
+    hmap_walk(&cur, field, nfield, HMAP_WRITE);
+    hmap_walk(&cur, value, nvalue, HMAP_WRITE);
+    hmap_link(it, link, size, 1);
+    return grown;
+}
+
+/*
+ * remove field, the chain must be writable.
+ * @return: 0 on success, or -ENOENT.
+ */
+int hmap_del(struct item *it, char *field, ssize_t nfield)
+{
+    struct hmap_cursor cur;
+    struct hmap_head head;
+    struct hmap_rec rec;
+    ssize_t pos, link;
+
+    pos = hmap_find(it, field, nfield, &rec, &link);
+    if (pos < 0)
+        return -ENOENT;
+
+    hmap_link(it, link, rec.next, 1);
+    rec.nfield |= HMAP_DEAD;
+    hmap_seek(&cur, it, pos);
+    hmap_walk(&cur, (char*) &rec, sizeof(struct hmap_rec), HMAP_WRITE);
+
+    hmap_head(it, &head, 0);
+    head.nr--;
+    head.dead += HMAP_REC_SIZE(&rec);
+    hmap_head(it, &head, 1);
+    return 0;
+}
+
+/*
+ * pack the live fields into buf, each one as a pair of __u32 lengths
+ * followed by the field and the value, both padded to 4 bytes.
+ * @return: the length packed, or -ENOSPC if buf is too small.
+ */
+ssize_t hmap_getall(struct item *it, char *buf, ssize_t nbuf)
+{
+    struct hmap_cursor cur;
+    struct hmap_head head;
+    struct hmap_rec rec;
+    ssize_t len = 0, size, n;
+
+    hmap_head(it, &head, 0);
+    size = item_value_size(it);
+    hmap_seek(&cur, it, HMAP_RECORDS(&head));
+    while (cur.pos + (ssize_t)sizeof(struct hmap_rec) <= size) {
+        if (hmap_walk(&cur, (char*) &rec, sizeof(struct hmap_rec), HMAP_READ))
+            break;
+        if (rec.nfield & HMAP_DEAD) {
+            hmap_walk(&cur, NULL, HMAP_REC_SIZE(&rec) - sizeof(struct hmap_rec), HMAP_SKIP);
+            continue;
+        }
+
+        //the pair of lengths, without the link.
+        n = offsetof(struct hmap_rec, next) + PADDED_KEY_SIZE(rec.nfield) + PADDED_KEY_SIZE(rec.nvalue);
+        if (n > nbuf - len)
+            return -ENOSPC;
+        memset(buf + len, 0, n);
+        memcpy(buf + len, &rec, offsetof(struct hmap_rec, next));
+        len += offsetof(struct hmap_rec, next);
+        hmap_walk(&cur, buf + len, rec.nfield, HMAP_READ);
+        len += PADDED_KEY_SIZE(rec.nfield);
+        hmap_walk(&cur, buf + len, rec.nvalue, HMAP_READ);
+        len += PADDED_KEY_SIZE(rec.nvalue);
+    }
+    return len;
+}
+
+/*
+ * the # of live fields.
+ */
+uint32_t hmap_len(struct item *it)
+{
+    struct hmap_head head;
+
+    hmap_head(it, &head, 0);
+    return head.nr;
+}
+
+/*
+ * whether the value is worth compacting:
+ * the dead records take most of it, or the fields outnumber twice the buckets.
+ */
+int hmap_fragmented(struct item *it)
+{
+    struct hmap_head head;
+
+    hmap_head(it, &head, 0);
+    if (head.nr > 2 * head.nbucket)
+        return 1;
+    return head.dead >= HMAP_MIN_DEAD && head.dead * 2 > item_value_size(it);
+}
+
+/*
+ * the # of buckets to index nr fields, so that each bucket holds one of them on average.
+ */
+static uint32_t hmap_nbucket(uint32_t nr)
+{
+    uint32_t n = HMAP_MIN_BUCKETS;
+
+    while (n < nr)
+        n *= 2;
+    return n;
+}
+
+static uint32_t *hmap_alloc_buckets(uint32_t nbucket)
+{
+    if (nbucket * sizeof(uint32_t) <= PAGE_SIZE)
+        return kzalloc(nbucket * sizeof(uint32_t), GFP_KERNEL);
+    return vzalloc(nbucket * sizeof(uint32_t));
+}
+
+static void hmap_free_buckets(uint32_t *bucket, uint32_t nbucket)
+{
+    if (nbucket * sizeof(uint32_t) <= PAGE_SIZE)
+        kfree(bucket);
+    else
+        vfree(bucket);
+}
+
+/*
+ * copy the key and the live records of the item into a fresh chain,
+ * whose index is sized for the live fields.
+ * @return: the new chain, or NULL if no memory.
+ */
+struct item *hmap_compact(struct item *it)
+{
+    struct hmap_cursor src, dst, peek;
+    struct hmap_head head;
+    struct hmap_rec rec;
+    struct item *nit;
+    uint32_t *bucket, nbucket, h;
+    char buf[64];
+    ssize_t size, len, n;
+
+    hmap_head(it, &head, 0);
+    size = item_value_size(it);
+    nbucket = hmap_nbucket(head.nr);
+    bucket = hmap_alloc_buckets(nbucket);
+    if (!bucket)
+        return NULL;
+    hmap_seek(&src, it, HMAP_RECORDS(&head));
+    len = size - HMAP_RECORDS(&head) - head.dead;
+
+    head.dead = 0;
+    head.nbucket = nbucket;
+    nit = create_item(KEY_OF_ITEM(it), KEY_SIZE_OF_ITEM(it), NULL, HMAP_RECORDS(&head) + len);
+    if (!nit) {
+        hmap_free_buckets(bucket, nbucket);
+        return NULL;
+    }
+
+    hmap_seek(&dst, nit, HMAP_RECORDS(&head));
+    while (src.pos + (ssize_t)sizeof(struct hmap_rec) <= size) {
+        if (hmap_walk(&src, (char*) &rec, sizeof(struct hmap_rec), HMAP_READ))
+            break;
+        len = HMAP_REC_SIZE(&rec) - sizeof(struct hmap_rec);
+        if (rec.nfield & HMAP_DEAD) {
+            hmap_walk(&src, NULL, len, HMAP_SKIP);
+            continue;
+        }
+
+        //the field is hashed ahead of the copy, to link the record before it's written.
+        peek = src;
+        h = HMAP_HASH_INIT;
+        for (len = rec.nfield; len > 0; len -= n) {
+            n = len < sizeof(buf) ? len : sizeof(buf);
+            hmap_walk(&peek, buf, n, HMAP_READ);
+            h = hmap_hash(h, buf, n);
+        }
+        len = HMAP_REC_SIZE(&rec) - sizeof(struct hmap_rec);
+        rec.next = bucket[h & (nbucket - 1)];
+        bucket[h & (nbucket - 1)] = dst.pos;
+
+        hmap_walk(&dst, (char*) &rec, sizeof(struct hmap_rec), HMAP_WRITE);
+        while (len > 0) {
+            n = len < sizeof(buf) ? len : sizeof(buf);
+            hmap_walk(&src, buf, n, HMAP_READ);
+            hmap_walk(&dst, buf, n, HMAP_WRITE);
+            len -= n;
+        }
+    }
+
+    hmap_seek(&dst, nit, 0);
+    hmap_walk(&dst, (char*) &head, sizeof(struct hmap_head), HMAP_WRITE);
+    hmap_walk(&dst, (char*) bucket, nbucket * sizeof(uint32_t), HMAP_WRITE);
+    hmap_free_buckets(bucket, nbucket);
+    return nit;
+}
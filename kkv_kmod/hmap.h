@@ -0,0 +1,23 @@
+/*
+ * In-Kernel Key/Value Store.
+ *
+ * Copyright (C) 2013-2014 jilinxpd.
+ *
+ * This file is released under the GPL.
+ */
+
+#ifndef _KKV_HMAP_H
+#define _KKV_HMAP_H
+
+
+struct item *hmap_create(char *key, ssize_t nkey);
+ssize_t hmap_get(struct item *it, char *field, ssize_t nfield, char *value, ssize_t nvalue);
+ssize_t hmap_set(struct item *it, char *field, ssize_t nfield, char *value, ssize_t nvalue);
+int hmap_del(struct item *it, char *field, ssize_t nfield);
+ssize_t hmap_getall(struct item *it, char *buf, ssize_t nbuf);
+uint32_t hmap_len(struct item *it);
+int hmap_fragmented(struct item *it);
+struct item *hmap_compact(struct item *it);
+
+
+#endif
@@ -0,0 +1,164 @@
+/*
+ * In-Kernel Key/Value Store.
+ *
+ * Copyright (C) 2013-2014 jilinxpd.
+ *
+ * This file is released under the GPL.
+ */
+
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/spinlock.h>
+#include <linux/percpu.h>
+#include <linux/jiffies.h>
+#include "kkv.h"
+#include "hash.h"
+#include "hotkey.h"
+
+/*
+ * the hot keys are tracked by the space-saving algorithm:
+ * HOTKEY_NR counters are kept, a sampled key missing from them takes over
+ * the counter with the least count, and inherits that count as its error.
+ * the counts are halved every HOTKEY_DECAY_INTERVAL, so they follow the current
+ * access rate rather than the history.
+ */
+
+//1 of this # of accesses on each cpu is sampled.
+#define HOTKEY_SAMPLE_RATE 64
+//# of counters.
+#define HOTKEY_NR 32
+//only the prefix of a longer key is kept, the key is still told apart by its hash.
+#define HOTKEY_KEY_LEN 64
+#define HOTKEY_DECAY_INTERVAL HZ
+
+struct hotkey {
+    uint32_t key_md;
+    ssize_t nkey; //0 if the counter is free.
+    uint32_t count;
+    uint32_t error;
+    char key[HOTKEY_KEY_LEN];
+};
+
+static DEFINE_PER_CPU(unsigned int, hotkey_tick);
+
+static spinlock_t hotkey_lock;
+static struct hotkey hotkeys[HOTKEY_NR];
+static unsigned long hotkey_decayed;
+
+/*
+ * halve the counts once per interval elapsed since the last decay.
+ * must be called with hotkey_lock held.
+ */
+static void hotkey_decay(void)
+{
+    unsigned long n;
+    int i;
+
+    if (time_before(jiffies, hotkey_decayed + HOTKEY_DECAY_INTERVAL))
+        return;
+
+    n = (jiffies - hotkey_decayed) / HOTKEY_DECAY_INTERVAL;
+    hotkey_decayed += n * HOTKEY_DECAY_INTERVAL;
+    if (n > 31)
+        n = 31;
+
+    for (i = 0; i < HOTKEY_NR; i++) {
+        hotkeys[i].count >>= n;
+        hotkeys[i].error >>= n;
+        if (!hotkeys[i].count)
+            hotkeys[i].nkey = 0;
+    }
+}
+
+static void hotkey_sample(char *key, ssize_t nkey)
+{
+    struct hotkey *hk, *min;
+    uint32_t key_md;
+    ssize_t len;
+    int i;
+
+    key_md = hash(key, nkey, 0);
+    len = nkey < HOTKEY_KEY_LEN ? nkey : HOTKEY_KEY_LEN;
+
+    spin_lock(&hotkey_lock);
+    hotkey_decay();
+
+    min = &hotkeys[0];
+    for (i = 0; i < HOTKEY_NR; i++) {
+        hk = &hotkeys[i];
+        if (hk->nkey == nkey && hk->key_md == key_md && !memcmp(hk->key, key, len)) {
+            hk->count++;
+            goto out;
+        }
+        if (hk->count < min->count)
+            min = hk;
+    }
+
+    min->key_md = key_md;
+    min->nkey = nkey;
+    min->error = min->count;
+    min->count++;
+    memcpy(min->key, key, len);
+out:
+    spin_unlock(&hotkey_lock);
+}
+
+/*
+ * account an access to the key, only a sample of them are actually counted.
+ */
+void hotkey_access(char *key, ssize_t nkey)
+{
+    if (this_cpu_inc_return(hotkey_tick) % HOTKEY_SAMPLE_RATE)
+        return;
+    hotkey_sample(key, nkey);
+}
+
+/*
+ * put the tracked keys into buf as a list of kkv_hotkey, the hottest first.
+ * a count right after a decay stands for about 2 intervals of samples,
+ * which gives the rate.
+ * @return: the length of the list.
+ */
+ssize_t hotkey_stats(char *buf, ssize_t max)
+{
+    int order[HOTKEY_NR];
+    struct hotkey *hk;
+    kkv_hotkey *rec;
+    ssize_t len = 0;
+    ssize_t nkey;
+    int i, j, nr = 0;
+
+    spin_lock(&hotkey_lock);
+    hotkey_decay();
+
+    for (i = 0; i < HOTKEY_NR; i++) {
+        if (!hotkeys[i].nkey)
+            continue;
+        for (j = nr++; j > 0 && hotkeys[order[j - 1]].count < hotkeys[i].count; j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+    }
+
+    for (i = 0; i < nr; i++) {
+        hk = &hotkeys[order[i]];
+        nkey = hk->nkey < HOTKEY_KEY_LEN ? hk->nkey : HOTKEY_KEY_LEN;
+        if (len + sizeof(kkv_hotkey) + PADDED_KEY_SIZE(nkey) > max)
+            break;
+        rec = (kkv_hotkey*) (buf + len);
+        rec->key_len = nkey;
+        rec->rate = (hk->count - hk->error) * HOTKEY_SAMPLE_RATE * HZ / (2 * HOTKEY_DECAY_INTERVAL);
+        memcpy(rec->key, hk->key, nkey);
+        len += sizeof(kkv_hotkey) + PADDED_KEY_SIZE(nkey);
+    }
+    spin_unlock(&hotkey_lock);
+
+    return len;
+}
+
+void init_hotkey(void)
+{
+    spin_lock_init(&hotkey_lock);
+    memset(hotkeys, 0, sizeof(hotkeys));
+    hotkey_decayed = jiffies;
+}
@@ -0,0 +1,28 @@
+/*
+ * In-Kernel Key/Value Store.
+ *
+ * Copyright (C) 2013-2014 jilinxpd.
+ *
+ * This file is released under the GPL.
+ */
+
+#ifndef _KKV_HOTKEY_H
+#define _KKV_HOTKEY_H
+
+
+/*
+ * one hot key in the value part of a stats response,
+ * the key is padded to 4 bytes so the next kkv_hotkey stays aligned.
+ */
+typedef struct {
+    __u32 key_len;
+    __u32 rate; //estimated accesses per second.
+    char key[0];
+} kkv_hotkey;
+
+void hotkey_access(char *key, ssize_t nkey);
+ssize_t hotkey_stats(char *buf, ssize_t max);
+void init_hotkey(void);
+
+
+#endif
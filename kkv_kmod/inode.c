@@ -14,6 +14,19 @@
 #include <linux/backing-dev.h>
 #include "kkv.h"
 #include "file.h"
+#include "protocol.h"
+
+/*
+ * drop the keyspace of the file along with the inode,
+ * sessions still serving it keep it alive until they are gone.
+ */
+void kkv_evict_inode(struct inode *inode)
+{
+	truncate_inode_pages(&inode->i_data, 0);
+	clear_inode(inode);
+	if (inode->i_private)
+		kkv_put_keyspace(inode->i_private);
+}
 
 static const struct inode_operations kkv_file_inode_operations = {
 	.setattr = simple_setattr,
@@ -51,6 +64,12 @@ struct inode *kkv_get_inode(struct super_block *sb,
 		case S_IFREG:
 			inode->i_op = &kkv_file_inode_operations;
 			inode->i_fop = &kkv_file_operations;
+			//every file has its own keyspace.
+			inode->i_private = create_keyspace();
+			if (!inode->i_private) {
+				iput(inode);
+				return NULL;
+			}
 			break;
 		case S_IFDIR:
 			inode->i_op = &kkv_dir_inode_operations;
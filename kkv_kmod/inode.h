@@ -12,6 +12,7 @@
 
 struct inode *kkv_get_inode(struct super_block *sb,
         const struct inode *dir, umode_t mode, dev_t dev);
+void kkv_evict_inode(struct inode *inode);
 
 
 #endif
\ No newline at end of file
@@ -9,8 +9,10 @@
 
 #include <linux/string.h>
 #include <linux/slab.h>
+#include <linux/bitops.h>
 #include "kkv.h"
 #include "slab.h"
+#include "dedup.h"
 
 /*
  * The power ranges from 4,5,6,...,19.
@@ -24,6 +26,12 @@
 //TODO: we'd better use a link list, instead of an array.
 //because the array is limited.
 #define MAX_SHRINK_ITEMS 256
+
+/*
+ * the # of regions a chain may have beyond what a fresh item of the same size needs,
+ * before it gets consolidated.
+ */
+#define MAX_EXTRA_REGIONS 8
 static struct item *free_items[MAX_SHRINK_ITEMS];
 static int nr_free_items = 0;
 
@@ -66,24 +74,235 @@ static inline int getPower(ssize_t size)
 }
 
 ssize_t read_item(struct item *it, char *buf, ssize_t nbuf)
+{
+    return read_item_range(it, 0, buf, nbuf);
+}
+
+/*
+ * read at most nbuf bytes of the value starting from offset.
+ * the regions before offset are skipped without touching their data.
+ * @return: the # of bytes read, 0 if offset is beyond the end.
+ */
+ssize_t read_item_range(struct item *it, ssize_t offset, char *buf, ssize_t nbuf)
 {
     ssize_t len;
     ssize_t nleft;
 
+    while (it && offset >= VALUE_SIZE_OF_ITEM(it)) {
+        offset -= VALUE_SIZE_OF_ITEM(it);
+        it = it->next;
+    }
+
     nleft = nbuf;
 
     while (it && nleft > 0) {
-        len = VALUE_SIZE_OF_ITEM(it);
+        len = VALUE_SIZE_OF_ITEM(it) - offset;
         if (len > nleft)
             len = nleft;
-        memcpy(buf, VALUE_OF_ITEM(it), len);
+        memcpy(buf, VALUE_OF_ITEM(it) + offset, len);
         buf += len;
         nleft -= len;
+        offset = 0;
         it = it->next;
     }
     return nbuf - nleft;
 }
 
+/*
+ * the # of set bits in n bytes, a word at a time so that hweight64()
+ * turns into the popcount instruction where the cpu has one.
+ */
+static inline uint64_t count_bits(char *p, ssize_t n)
+{
+    uint64_t w, nr = 0;
+
+    for (; n >= sizeof(uint64_t); p += sizeof(uint64_t), n -= sizeof(uint64_t)) {
+        memcpy(&w, p, sizeof(uint64_t));
+        nr += hweight64(w);
+    }
+    while (n-- > 0)
+        nr += hweight8(*p++);
+    return nr;
+}
+
+/*
+ * count the set bits in at most nbytes bytes of the value from offset,
+ * region by region without copying.
+ */
+uint64_t count_item_bits(struct item *it, ssize_t offset, ssize_t nbytes)
+{
+    uint64_t nr = 0;
+    ssize_t len;
+
+    while (it && offset >= VALUE_SIZE_OF_ITEM(it)) {
+        offset -= VALUE_SIZE_OF_ITEM(it);
+        it = it->next;
+    }
+
+    while (it && nbytes > 0) {
+        len = VALUE_SIZE_OF_ITEM(it) - offset;
+        if (len > nbytes)
+            len = nbytes;
+        nr += count_bits(VALUE_OF_ITEM(it) + offset, len);
+        nbytes -= len;
+        offset = 0;
+        it = it->next;
+    }
+    return nr;
+}
+
+static inline void combine_bits(char *d, char *s, ssize_t n, int op)
+{
+    ssize_t i;
+
+    switch (op) {
+    case KKV_BITOP_AND:
+        for (i = 0; i < n; i++)
+            d[i] &= s ? s[i] : 0;
+        break;
+    case KKV_BITOP_OR:
+        for (i = 0; s && i < n; i++)
+            d[i] |= s[i];
+        break;
+    case KKV_BITOP_XOR:
+        for (i = 0; s && i < n; i++)
+            d[i] ^= s[i];
+        break;
+    case KKV_BITOP_NOT:
+        for (i = 0; i < n; i++)
+            d[i] = s ? ~s[i] : ~0;
+        break;
+    case KKV_BITOP_COPY:
+        for (i = 0; i < n; i++)
+            d[i] = s ? s[i] : 0;
+        break;
+    }
+}
+
+/*
+ * combine the value of src into the value of dst in place, op is one of KKV_BITOP_*.
+ * src may be NULL or shorter than dst, the missing bytes are taken as zeros.
+ */
+void bitop_item(struct item *dst, struct item *src, int op)
+{
+    ssize_t doff = 0, soff = 0, len;
+
+    while (dst) {
+        if (doff == VALUE_SIZE_OF_ITEM(dst)) {
+            dst = dst->next;
+            doff = 0;
+            continue;
+        }
+        while (src && soff == VALUE_SIZE_OF_ITEM(src)) {
+            src = src->next;
+            soff = 0;
+        }
+
+        len = VALUE_SIZE_OF_ITEM(dst) - doff;
+        if (src && len > VALUE_SIZE_OF_ITEM(src) - soff)
+            len = VALUE_SIZE_OF_ITEM(src) - soff;
+        combine_bits(VALUE_OF_ITEM(dst) + doff, src ? VALUE_OF_ITEM(src) + soff : NULL, len, op);
+        doff += len;
+        if (src)
+            soff += len;
+    }
+}
+
+/*
+ * the size of the slab space backing this region.
+ */
+static inline ssize_t region_space(struct item *it)
+{
+    return (ssize_t) 1 << getPower(it->size);
+}
+
+/*
+ * the region after the head holding the key is the tail shared with other keys,
+ * if it is referenced on its own, see dedup.c.
+ */
+static inline struct item *item_shared_tail(struct item *it)
+{
+    struct item *next = it->next;
+
+    return next && next->refcount ? next : NULL;
+}
+
+/*
+ * only the chain referenced by nobody but its itemx may be modified in place.
+ * all engine operations run under engine_lock, so a reader never sees
+ * a chain while it is being rewritten; whoever else holds a reference
+ * (e.g. a pending send) keeps the chain read-only, and so does a value shared
+ * with other keys (see dedup.c).
+ */
+int item_writable(struct item *it)
+{
+    return it->refcount == 1 && !item_shared_tail(it);
+}
+
+/*
+ * overwrite the value of the item in place.
+ * the new value has to end in the last region and keep its size class,
+ * so that the chain layout is unchanged and free_item() finds the right bucket.
+ * @return: 0 on success, -1 if the value doesn't fit in the chain.
+ */
+int overwrite_item(struct item *it, char *value, ssize_t nvalue)
+{
+    struct item *last;
+    ssize_t len;
+    ssize_t prefix = 0;
+    ssize_t size;
+
+    for (last = it; last->next; last = last->next)
+        prefix += VALUE_SIZE_OF_ITEM(last);
+
+    if (nvalue < prefix)
+        return -1;
+
+    size = last->value_offset + nvalue - prefix;
+    if (getPower(size) != getPower(last->size))
+        return -1;
+    last->size = size;
+
+    while (it && nvalue > 0) {
+        len = VALUE_SIZE_OF_ITEM(it);
+        if (len > nvalue)
+            len = nvalue;
+        memcpy(VALUE_OF_ITEM(it), value, len);
+        value += len;
+        nvalue -= len;
+        it = it->next;
+    }
+    return 0;
+}
+
+/*
+ * the memory taken by the regions of the item chain.
+ */
+ssize_t item_mem_size(struct item *it)
+{
+    ssize_t len = 0;
+
+    while (it) {
+        len += region_space(it);
+        it = it->next;
+    }
+    return len;
+}
+
+/*
+ * the total length of the value stored in the item chain.
+ */
+ssize_t item_value_size(struct item *it)
+{
+    ssize_t len = 0;
+
+    while (it) {
+        len += VALUE_SIZE_OF_ITEM(it);
+        it = it->next;
+    }
+    return len;
+}
+
 static struct item *__fill_item_list(char *data, ssize_t *ndata, struct item *it, ssize_t *nbuf)
 {
     void *dst_addr;
@@ -93,7 +312,12 @@ static struct item *__fill_item_list(char *data, ssize_t *ndata, struct item *it
 
     while (*ndata > 0) {
         cp_len = *nbuf < *ndata ? *nbuf : *ndata;
-        memcpy(dst_addr, data, cp_len);
+        if (data) {
+            memcpy(dst_addr, data, cp_len);
+            data += cp_len;
+        } else {
+            memset(dst_addr, 0, cp_len);
+        }
         dst_addr += cp_len;
         (*ndata) -= cp_len;
         (*nbuf) -= cp_len;
@@ -131,7 +355,8 @@ static ssize_t fill_item_list(char *key, ssize_t nkey, char *value, ssize_t nval
 #ifdef DEBUG_KKV_STAT
     item_mem += (padded_nkey - src_len);
 #endif
-    if (src_len > 0)
+    //a key filling the chain up leaves no region for an empty value.
+    if (src_len > 0 || nvalue == 0)
         return src_len + nvalue;
 
     src_len = nvalue;
@@ -144,6 +369,149 @@ static ssize_t fill_item_list(char *key, ssize_t nkey, char *value, ssize_t nval
     return src_len;
 }
 
+static struct item *alloc_item_list(ssize_t size);
+
+/*
+ * append value to the item in place, or nvalue zeros if value is NULL.
+ * the slack of the last region is filled first, then new regions are linked after it,
+ * the existing bytes are never copied.
+ * @return: the slab space of the new regions, or -1 if no memory.
+ */
+ssize_t append_item(struct item *it, char *value, ssize_t nvalue)
+{
+    struct item *tail = NULL;
+    ssize_t len;
+
+    while (it->next)
+        it = it->next;
+
+    len = region_space(it) - it->size;
+    if (len > nvalue)
+        len = nvalue;
+
+    if (nvalue > len) {
+        tail = alloc_item_list(nvalue - len);
+        if (!tail)
+            return -1;
+    }
+
+    if (value) {
+        memcpy((void*) it + it->size, value, len);
+        value += len;
+    } else {
+        memset((void*) it + it->size, 0, len);
+    }
+    it->size += len;
+    nvalue -= len;
+
+    if (tail) {
+        len = VALUE_SIZE_OF_ITEM(tail);
+        __fill_item_list(value, &nvalue, tail, &len);
+        it->next = tail;
+        return item_mem_size(tail);
+    }
+    return 0;
+}
+
+/*
+ * overwrite nvalue bytes of the value from offset in place.
+ * the value is first grown with zeros if the range goes past its end,
+ * so a failure leaves the value untouched.
+ * @return: the slab space the value grew by, or -1 if no memory.
+ */
+ssize_t write_item_range(struct item *it, ssize_t offset, char *value, ssize_t nvalue)
+{
+    ssize_t len;
+    ssize_t grown = 0;
+
+    len = item_value_size(it);
+    if (offset + nvalue > len && (grown = append_item(it, NULL, offset + nvalue - len)) < 0)
+        return -1;
+
+    while (it && offset >= VALUE_SIZE_OF_ITEM(it)) {
+        offset -= VALUE_SIZE_OF_ITEM(it);
+        it = it->next;
+    }
+
+    while (it && nvalue > 0) {
+        len = VALUE_SIZE_OF_ITEM(it) - offset;
+        if (len > nvalue)
+            len = nvalue;
+        memcpy(VALUE_OF_ITEM(it) + offset, value, len);
+        value += len;
+        nvalue -= len;
+        offset = 0;
+        it = it->next;
+    }
+    return grown;
+}
+
+/*
+ * prepend value to the item.
+ * a new head holding the key and the value is linked before the old head,
+ * whose key bytes are simply skipped from then on.
+ * the old head must be writable, its reference is handed over to the new head.
+ * @grown: set to the slab space of the new regions.
+ * @return: the new head, or NULL if no memory.
+ */
+struct item *prepend_item(struct item *it, char *value, ssize_t nvalue, ssize_t *grown)
+{
+    struct item *nit, *last;
+
+    nit = create_item(KEY_OF_ITEM(it), KEY_SIZE_OF_ITEM(it), value, nvalue);
+    if (!nit)
+        return NULL;
+
+    *grown = region_space(nit);
+    for (last = nit; last->next; last = last->next)
+        *grown += region_space(last->next);
+    last->next = it;
+    nit->refcount = it->refcount;
+    it->refcount = 0;
+    return nit;
+}
+
+/*
+ * copy the key and the value of the item into a fresh chain with the fewest regions.
+ * @return: the new chain, or NULL if no memory.
+ */
+struct item *compact_item(struct item *it)
+{
+    struct item *nit, *dst;
+    ssize_t nkey, len, nbuf;
+
+    nkey = KEY_SIZE_OF_ITEM(it);
+    nit = alloc_item_list(nkey + item_value_size(it));
+    if (!nit)
+        return NULL;
+
+    nbuf = VALUE_SIZE_OF_ITEM(nit);
+    nit->value_offset += nkey;
+    len = nkey;
+    dst = __fill_item_list(KEY_OF_ITEM(it), &len, nit, &nbuf);
+
+    for (; it && dst; it = it->next) {
+        len = VALUE_SIZE_OF_ITEM(it);
+        dst = __fill_item_list(VALUE_OF_ITEM(it), &len, dst, &nbuf);
+    }
+    return nit;
+}
+
+/*
+ * whether the chain has grown too many regions, e.g. after lots of small appends.
+ */
+int item_fragmented(struct item *it)
+{
+    ssize_t len = 0;
+    int nr = 0;
+
+    for (; it; it = it->next) {
+        len += it->size - sizeof(struct item);
+        nr++;
+    }
+    return nr > len / ((1 << MAX_BUCKET_POWER) - sizeof(struct item)) + 1 + MAX_EXTRA_REGIONS;
+}
+
 static inline void *alloc_item(ssize_t size, ssize_t *alloc_size)
 {
     int idx, power;
@@ -231,8 +599,37 @@ struct item *create_item(char *key, ssize_t nkey, char *value, ssize_t nvalue)
     return it;
 }
 
+/*
+ * create the chain of the key with room for a value of nvalue bytes,
+ * which is left uninitialized for the caller to write in place.
+ */
+struct item *create_item_raw(char *key, ssize_t nkey, ssize_t nvalue)
+{
+    struct item *it;
+
+    it = alloc_item_list(PADDED_KEY_SIZE(nkey) + nvalue);
+    if (!it)
+        return NULL;
+
+    fill_item_list(key, nkey, NULL, 0, it);
+#ifdef DEBUG_KKV_STAT
+    item_mem += nvalue;
+#endif
+    return it;
+}
+
 int unlink_item(struct item *it)
 {
+    struct item *tail;
+
+    //a shared tail is detached from the head, and goes with its last head, see dedup.c.
+    tail = item_shared_tail(it);
+    if (tail) {
+        it->next = NULL;
+        if (dedup_put(tail))
+            unlink_item(tail);
+    }
+
     free_items[nr_free_items++] = it;
     //TODO: we need a lock here.
     if (nr_free_items == MAX_SHRINK_ITEMS) {
@@ -287,7 +684,7 @@ void shrink_item_system(void)
     //TODO: we need a lock here.
     for (i = nr_free_items - 1; i >= 0; i--) {
         if (free_items[i]) {
-            free_item(free_items[i]);
+            free_item_list(free_items[i]);
             free_items[i] = NULL;
         }
     }
@@ -8,17 +8,26 @@
 
 #include <linux/string.h>
 #include <linux/slab.h>
+#include <linux/prefetch.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
 #include "kkv.h"
+#include "hash.h"
+#include "lease.h"
+#include "mvcc.h"
 
 #define HT_SIZE_1st_LEVEL 1024
 #define HT_SIZE_2nd_LEVEL 1024
 #define HT_SIZE_3rd_LEVEL 128
+#define HT_NR_LISTS ((uint64_t) HT_SIZE_1st_LEVEL * HT_SIZE_2nd_LEVEL * HT_SIZE_3rd_LEVEL)
 
 typedef void *ht_entry;
 
-static ht_entry *ht_root;
 static struct kmem_cache *itemx_store;
 
+//the latest version handed out to an itemx, protected by engine_lock.
+static uint64_t cas_id = 0;
+
 #ifdef DEBUG_KKV_STAT
 static ssize_t used_mem = 0;
 static ssize_t freed_mem = 0;
@@ -34,17 +43,54 @@ ssize_t freed_memory_in_itemx_system(void)
 }
 #endif
 
+/* copy an inline key into ikey, zero padded.
+ */
+static inline void load_ikey(char *key, ssize_t nkey, uint64_t *ikey)
+{
+	memcpy(&ikey[0], key, 8);
+	ikey[1] = 0;
+	if (nkey == 16)
+		memcpy(&ikey[1], key + 8, 8);
+}
+
+/* whether the itemx holds the key, ikey being the key loaded by load_ikey() if it is inline.
+ * an inline key is compared as 2 integers, without touching the item chain.
+ */
+static inline int itemx_match(struct itemx *cur, uint32_t key_md, char *key, ssize_t nkey, uint64_t *ikey)
+{
+	if (cur->key_md != key_md)
+		return 0;
+	if (KEY_INLINE(nkey))
+		return cur->nkey == nkey && cur->ikey[0] == ikey[0] && cur->ikey[1] == ikey[1];
+	return cur->nkey == nkey && !strncmp(KEY_OF_ITEM(cur->it), key, nkey);
+}
+
+/* whether the itemx holds the key, for the callers looking at a single itemx.
+ */
+int itemx_has_key(struct itemx *itx, char *key, ssize_t nkey)
+{
+	uint64_t ikey[2];
+
+	if (KEY_INLINE(nkey))
+		load_ikey(key, nkey, ikey);
+	return itemx_match(itx, itx->key_md, key, nkey, ikey);
+}
+
 /* find the target itemx.
  * used by get, replace.
  */
-struct itemx *find_itemx(uint32_t key_md, char *key, ssize_t nkey)
+struct itemx *find_itemx(struct kkv_keyspace *ks, uint32_t key_md, char *key, ssize_t nkey)
 {
 	struct itemx *cur;
 	ht_entry cur_ent;
 	ht_entry *cur_ht;
+	uint64_t ikey[2];
+
+	if (KEY_INLINE(nkey))
+		load_ikey(key, nkey, ikey);
 
 	//lookup in the 1st hash table.
-	cur_ht = ht_root;
+	cur_ht = ks->ht_root;
 	cur_ent = cur_ht[(key_md >> 22)&0x3FF];
 	if (!cur_ent)
 		return NULL;
@@ -62,7 +108,7 @@ struct itemx *find_itemx(uint32_t key_md, char *key, ssize_t nkey)
 	//lookup in the list.
 	cur = (struct itemx*) cur_ent;
 	while (cur) {
-		if (cur->key_md == key_md && KEY_SIZE_OF_ITEM(cur->it) == PADDED_KEY_SIZE(nkey) && !strncmp(KEY_OF_ITEM(cur->it), key, nkey)) {
+		if (itemx_match(cur, key_md, key, nkey, ikey)) {
 			return cur;
 		}
 		cur = cur->next;
@@ -71,18 +117,85 @@ struct itemx *find_itemx(uint32_t key_md, char *key, ssize_t nkey)
 	return NULL;
 }
 
+/* find the target itemxs of a batch of keys, at most KKV_MGET_BATCH.
+ * the hash tables are walked level by level for all the keys at once,
+ * and each level is prefetched before it is touched,
+ * so the cache misses of different keys overlap instead of adding up.
+ * used by mget.
+ */
+void find_itemx_batch(struct kkv_keyspace *ks, uint32_t *key_md, char **key, ssize_t *nkey, struct itemx **itx, int nr)
+{
+	struct itemx *cur;
+	ht_entry cur_ent[KKV_MGET_BATCH];
+	ht_entry *ht_root = ks->ht_root;
+	uint64_t ikey[KKV_MGET_BATCH][2];
+	int i;
+
+	for (i = 0; i < nr; i++)
+		prefetch(ht_root + ((key_md[i] >> 22)&0x3FF));
+
+	//lookup in the 1st hash table.
+	for (i = 0; i < nr; i++) {
+		cur_ent[i] = ht_root[(key_md[i] >> 22)&0x3FF];
+		if (cur_ent[i])
+			prefetch((ht_entry*) cur_ent[i] + ((key_md[i] >> 12)&0x3FF));
+	}
+
+	//lookup in the 2nd hash table.
+	for (i = 0; i < nr; i++) {
+		if (!cur_ent[i])
+			continue;
+		cur_ent[i] = ((ht_entry*) cur_ent[i])[(key_md[i] >> 12)&0x3FF];
+		if (cur_ent[i])
+			prefetch((ht_entry*) cur_ent[i] + (key_md[i] & 0xFFF) % HT_SIZE_3rd_LEVEL);
+	}
+
+	//lookup in the 3rd hash table.
+	for (i = 0; i < nr; i++) {
+		if (!cur_ent[i])
+			continue;
+		cur_ent[i] = ((ht_entry*) cur_ent[i])[(key_md[i] & 0xFFF) % HT_SIZE_3rd_LEVEL];
+		if (cur_ent[i])
+			prefetch(cur_ent[i]);
+	}
+
+	//prefetch the key of the list header, unless it is inline.
+	for (i = 0; i < nr; i++) {
+		if (KEY_INLINE(nkey[i]))
+			load_ikey(key[i], nkey[i], ikey[i]);
+		else if (cur_ent[i])
+			prefetch(((struct itemx*) cur_ent[i])->it);
+	}
+
+	//lookup in the lists.
+	for (i = 0; i < nr; i++) {
+		cur = (struct itemx*) cur_ent[i];
+		while (cur) {
+			if (itemx_match(cur, key_md[i], key[i], nkey[i], ikey[i])) {
+				break;
+			}
+			cur = cur->next;
+		}
+		itx[i] = cur;
+	}
+}
+
 /* find the target itemx, besides, find the list where the itemx exists.
  * used by add, delete.
  */
-struct itemx *locate_itemx(uint32_t key_md, char *key, ssize_t nkey, struct itemx ***cur_header, int force)
+struct itemx *locate_itemx(struct kkv_keyspace *ks, uint32_t key_md, char *key, ssize_t nkey, struct itemx ***cur_header, int force)
 {
 	struct itemx *cur;
 	ht_entry cur_ent;
 	ht_entry *cur_ht;
 	uint32_t idx;
+	uint64_t ikey[2];
+
+	if (KEY_INLINE(nkey))
+		load_ikey(key, nkey, ikey);
 
 	//lookup in the 1st hash table.
-	cur_ht = ht_root;
+	cur_ht = ks->ht_root;
 	cur_ent = cur_ht[idx = (key_md >> 22)&0x3FF];
 	if (!cur_ent) {
 		if (force) {
@@ -123,7 +236,7 @@ struct itemx *locate_itemx(uint32_t key_md, char *key, ssize_t nkey, struct item
 	//lookup in the list.
 	cur = (struct itemx*) cur_ent;
 	while (cur) {
-		if (cur->key_md == key_md && KEY_SIZE_OF_ITEM(cur->it) == PADDED_KEY_SIZE(nkey) && !strncmp(KEY_OF_ITEM(cur->it), key, nkey)) {
+		if (itemx_match(cur, key_md, key, nkey, ikey)) {
 			return cur;
 		}
 		cur = cur->next;
@@ -132,13 +245,20 @@ struct itemx *locate_itemx(uint32_t key_md, char *key, ssize_t nkey, struct item
 	return NULL;
 }
 
-struct itemx *create_itemx(uint32_t key_md, struct item *it)
+struct itemx *create_itemx(uint32_t key_md, char *key, ssize_t nkey, struct item *it)
 {
 	struct itemx *itx;
 	itx = kmem_cache_alloc(itemx_store, GFP_KERNEL);
 	if (itx) {
 		itx->it = it;
 		itx->key_md = key_md;
+		itx->nkey = nkey;
+		if (KEY_INLINE(nkey))
+			load_ikey(key, nkey, itx->ikey);
+		itx->cas = ++cas_id;
+		itx->mem = item_mem_size(it);
+		itx->flags = 0;
+		itx->type = KKV_TYPE_STRING;
 		it->refcount++;
 #ifdef DEBUG_KKV_STAT
 		used_mem += sizeof(struct itemx);
@@ -147,11 +267,32 @@ struct itemx *create_itemx(uint32_t key_md, struct item *it)
 	return itx;
 }
 
-int update_itemx(struct itemx *itx, struct item *it)
+/* hand out a version newer than every value stored so far, which is the version a new snapshot reads at.
+ */
+uint64_t next_cas(void)
+{
+	return ++cas_id;
+}
+
+/* whether the chain of the itemx may be modified in place,
+ * which also requires that no snapshot reads its current value.
+ */
+int itemx_writable(struct kkv_keyspace *ks, struct itemx *itx)
+{
+	return item_writable(itx->it) && !mvcc_pinned(ks, itx->cas);
+}
+
+int update_itemx(struct kkv_keyspace *ks, struct itemx *itx, struct item *it)
 {
 	struct item *oit;
+	mvcc_keep(ks, itx, cas_id + 1);
 	oit = itx->it;
 	itx->it = it;
+	itx->cas = ++cas_id;
+	lease_revoke(ks, itx->key_md);
+	ks->mem -= itx->mem;
+	itx->mem = item_mem_size(it);
+	ks->mem += itx->mem;
 	it->refcount++;
 	if (--oit->refcount == 0) {
 		unlink_item(oit);
@@ -159,8 +300,23 @@ int update_itemx(struct itemx *itx, struct item *it)
 	return 0;
 }
 
-int add_itemx(struct itemx *itx, struct itemx **cur_header)
+/* renew the version and the memory accounting of the itemx after its item is modified in place,
+ * grown is the slab space the write added to the chain, 0 if it only overwrote existing bytes.
+ */
+void touch_itemx(struct kkv_keyspace *ks, struct itemx *itx, ssize_t grown)
+{
+	itx->cas = ++cas_id;
+	lease_revoke(ks, itx->key_md);
+	itx->mem += grown;
+	ks->mem += grown;
+}
+
+int add_itemx(struct kkv_keyspace *ks, struct itemx *itx, struct itemx **cur_header)
 {
+	lease_revoke(ks, itx->key_md);
+	ks->nr_items++;
+	ks->mem += itx->mem;
+
 	itx->next = *cur_header;
 	itx->pre = NULL;
 	if (*cur_header)
@@ -170,10 +326,15 @@ int add_itemx(struct itemx *itx, struct itemx **cur_header)
 	return 0;
 }
 
-int delete_itemx(struct itemx *itx, struct itemx **cur_header)
+int delete_itemx(struct kkv_keyspace *ks, struct itemx *itx, struct itemx **cur_header)
 {
 	struct item *it;
 
+	mvcc_keep(ks, itx, cas_id + 1);
+	lease_revoke(ks, itx->key_md);
+	ks->nr_items--;
+	ks->mem -= itx->mem;
+
 	if (itx->pre) {
 		itx->pre->next = itx->next;
 	} else {
@@ -196,23 +357,110 @@ int delete_itemx(struct itemx *itx, struct itemx **cur_header)
 	return 0;
 }
 
+/* delete the keys starting with prefix, walking the index from the list at *cursor
+ * until about batch lists and keys have been examined.
+ * *cursor is advanced past the lists walked, and set to 0 once the whole index has been walked.
+ * return the # of keys deleted.
+ */
+ssize_t delete_itemx_prefix(struct kkv_keyspace *ks, char *prefix, ssize_t nprefix, uint64_t *cursor, ssize_t batch)
+{
+	struct itemx **cur_header, *itx, *next;
+	ht_entry *ht_root = ks->ht_root;
+	ht_entry *cur_2nd_ht, *cur_3rd_ht;
+	uint64_t pos = *cursor;
+	uint32_t i, j;
+	ssize_t work = 0, nr = 0;
+
+	while (pos < HT_NR_LISTS && work < batch) {
+		work++;
+		i = pos / (HT_SIZE_2nd_LEVEL * HT_SIZE_3rd_LEVEL);
+		j = pos / HT_SIZE_3rd_LEVEL % HT_SIZE_2nd_LEVEL;
+
+		//skip the lists under a missing table at once.
+		cur_2nd_ht = (ht_entry *) ht_root[i];
+		if (!cur_2nd_ht) {
+			pos = (uint64_t) (i + 1) * HT_SIZE_2nd_LEVEL * HT_SIZE_3rd_LEVEL;
+			continue;
+		}
+		cur_3rd_ht = (ht_entry *) cur_2nd_ht[j];
+		if (!cur_3rd_ht) {
+			pos = ((uint64_t) i * HT_SIZE_2nd_LEVEL + j + 1) * HT_SIZE_3rd_LEVEL;
+			continue;
+		}
+
+		cur_header = (struct itemx **) (cur_3rd_ht + pos % HT_SIZE_3rd_LEVEL);
+		for (itx = *cur_header; itx; itx = next) {
+			work++;
+			next = itx->next;
+			//the key in the chain is padded with zeros, so its real length is taken.
+			if (itx->nkey >= nprefix && !memcmp(KEY_OF_ITEM(itx->it), prefix, nprefix)) {
+				delete_itemx(ks, itx, cur_header);
+				nr++;
+			}
+		}
+		pos++;
+	}
+
+	*cursor = pos < HT_NR_LISTS ? pos : 0;
+	return nr;
+}
+
+/* free an itemx which has never been added, e.g. when a batch is aborted.
+ */
+void free_itemx(struct itemx *itx)
+{
+	struct item *it;
+
+	it = itx->it;
+	kmem_cache_free(itemx_store, itx);
+#ifdef DEBUG_KKV_STAT
+	freed_mem += sizeof(struct itemx);
+#endif
+	if (--it->refcount == 0) {
+		unlink_item(it);
+	}
+}
+
 int init_itemx_system(void)
 {
-	ht_root = NULL;
+	itemx_store = kmem_cache_create("kkv_itemx_store", sizeof(struct itemx), 0, SLAB_HWCACHE_ALIGN, NULL);
+	return itemx_store ? 0 : -1;
+}
+
+void destroy_itemx_system(void)
+{
+	kmem_cache_destroy(itemx_store);
 	itemx_store = NULL;
+}
 
-	ht_root = kzalloc(HT_SIZE_1st_LEVEL * sizeof(ht_entry), GFP_KERNEL);
-	itemx_store = kmem_cache_create("kkv_itemx_store", sizeof(struct itemx), 0, SLAB_HWCACHE_ALIGN, NULL);
+struct kkv_keyspace *create_keyspace(void)
+{
+	struct kkv_keyspace *ks;
+
+	ks = kzalloc(sizeof(struct kkv_keyspace), GFP_KERNEL);
+	if (!ks)
+		return NULL;
+
+	ks->ht_root = kzalloc(HT_SIZE_1st_LEVEL * sizeof(ht_entry), GFP_KERNEL);
+	if (!ks->ht_root) {
+		kfree(ks);
+		return NULL;
+	}
 #ifdef DEBUG_KKV_STAT
 	used_mem += HT_SIZE_1st_LEVEL * sizeof(ht_entry);
 #endif
-	return ht_root && itemx_store ? 0 : -1;
+	atomic_set(&ks->refcount, 1);
+	return ks;
 }
 
-void destroy_itemx_system(void)
+/* drop all the keys of the keyspace.
+ * the index is torn down table by table, instead of being searched key by key.
+ */
+void flush_keyspace(struct kkv_keyspace *ks)
 {
 	int i, j, k;
 	struct itemx *cur_header, *itx;
+	ht_entry *ht_root = ks->ht_root;
 	ht_entry *cur_2nd_ht, *cur_3rd_ht;
 	ht_entry cur_ent;
 
@@ -234,10 +482,8 @@ void destroy_itemx_system(void)
 				while (cur_header) {
 					itx = cur_header;
 					cur_header = cur_header->next;
-					kmem_cache_free(itemx_store, itx);
-#ifdef DEBUG_KKV_STAT
-					freed_mem += sizeof(struct itemx);
-#endif
+					mvcc_keep(ks, itx, cas_id + 1);
+					free_itemx(itx);
 				}
 			}
 			kfree(cur_3rd_ht);
@@ -249,13 +495,92 @@ void destroy_itemx_system(void)
 #ifdef DEBUG_KKV_STAT
 		freed_mem += HT_SIZE_2nd_LEVEL * sizeof(ht_entry);
 #endif
+		ht_root[i] = NULL;
 	}
-	kfree(ht_root);
+
+	ks->nr_items = 0;
+	ks->mem = 0;
+	lease_flush(ks);
+}
+
+void destroy_keyspace(struct kkv_keyspace *ks)
+{
+	mvcc_destroy(ks);
+	flush_keyspace(ks);
+	lease_destroy(ks);
+	kfree(ks->ht_root);
 #ifdef DEBUG_KKV_STAT
 	freed_mem += HT_SIZE_1st_LEVEL * sizeof(ht_entry);
 #endif
-	ht_root = NULL;
+	kfree(ks);
+}
 
-	kmem_cache_destroy(itemx_store);
-	itemx_store = NULL;
+#ifdef DEBUG_KKV_BENCH
+//# of keys looked up by the benchmark, and # of times each one is looked up.
+#define BENCH_NR_KEYS 65536
+#define BENCH_NR_ROUNDS 16
+
+/* time the lookups of BENCH_NR_KEYS distinct keys of nkey bytes.
+ * return the average ns taken by hashing and finding a key, or -1 on failure.
+ */
+static ssize_t bench_lookup(ssize_t nkey)
+{
+	struct kkv_keyspace *ks;
+	struct itemx *itx;
+	struct itemx **cur_header = NULL;
+	struct item *it;
+	char key[16];
+	uint64_t id, found = 0;
+	uint32_t key_md;
+	ktime_t start;
+	ssize_t ns = -1;
+	int r;
+
+	ks = create_keyspace();
+	if (!ks)
+		return -1;
+
+	memset(key, 'k', sizeof(key));
+	for (id = 0; id < BENCH_NR_KEYS; id++) {
+		memcpy(key, &id, sizeof(id));
+		key_md = key_hash(key, nkey);
+		if (locate_itemx(ks, key_md, key, nkey, &cur_header, 1) || !cur_header)
+			goto out;
+		it = create_item(key, nkey, NULL, 0);
+		if (!it)
+			goto out;
+		itx = create_itemx(key_md, key, nkey, it);
+		if (!itx) {
+			unlink_item(it);
+			goto out;
+		}
+		add_itemx(ks, itx, cur_header);
+	}
+
+	start = ktime_get();
+	for (r = 0; r < BENCH_NR_ROUNDS; r++) {
+		for (id = 0; id < BENCH_NR_KEYS; id++) {
+			memcpy(key, &id, sizeof(id));
+			if (find_itemx(ks, key_hash(key, nkey), key, nkey))
+				found++;
+		}
+	}
+	ns = div_u64(ktime_to_ns(ktime_sub(ktime_get(), start)), BENCH_NR_KEYS * BENCH_NR_ROUNDS);
+	if (found != BENCH_NR_KEYS * BENCH_NR_ROUNDS)
+		ns = -1;
+
+out:
+	destroy_keyspace(ks);
+	shrink_item_system();
+	return ns;
 }
+
+/* compare the lookups of inline keys with the ones of keys going through hash().
+ */
+void bench_itemx(void)
+{
+	printk("kkv bench: lookup of 8-byte keys: %ld ns\n", bench_lookup(8));
+	printk("kkv bench: lookup of 16-byte keys: %ld ns\n", bench_lookup(16));
+	printk("kkv bench: lookup of 12-byte keys: %ld ns\n", bench_lookup(12));
+}
+#endif
@@ -9,11 +9,24 @@
 #ifndef _KKV_KKV_H
 #define _KKV_KKV_H
 
+#include <asm/atomic.h>
 
 #define KKV_ON_KMALLOC
 
 #define KKV_REQ_BUF_SIZE (2 * PAGE_SIZE)
 
+//a value of a SET, ADD or REPLACE taking at least this # of bytes isn't copied through the request buffer,
+//but received over the network straight into its item chain.
+#define KKV_LARGE_VALUE PAGE_SIZE
+//max length of such a value.
+#define KKV_LARGE_MAX (32 << 20)
+
+//# of keys looked up together by mget.
+#define KKV_MGET_BATCH 16
+
+//max length of a numeric value for incr/decr: 20 digits and a '\0'.
+#define KKV_NUM_LEN 21
+
 /*
  * the struct item that support multi-region.
  */
@@ -31,35 +44,168 @@ struct item {
 #define KEY_SIZE_OF_ITEM(it) (it->value_offset - sizeof(struct item))
 #define PADDED_KEY_SIZE(size) ((ssize_t)((size + 3) / 4) * 4)
 
+//a key of 8 or 16 bytes, typically an integer id, is hashed as integers, see key_hash(),
+//and is copied into its itemx, so that looking it up never touches the item chain.
+#define KEY_INLINE(nkey) ((nkey) == 8 || (nkey) == 16)
+
+/*
+ * the fields are laid out to keep the itemx within a cache line.
+ */
 struct itemx {
     struct itemx *pre;
     struct itemx *next;
     uint32_t key_md;
+    uint16_t type; //how the value is encoded, one of KKV_TYPE_*.
+    uint16_t nkey; //length of the key, which is also kept inline in ikey if KEY_INLINE().
+    struct item *it;
+    uint64_t cas; //version of the value, renewed by every update.
+    uint32_t mem; //memory taken by the item chain, as accounted to the keyspace.
+    uint32_t flags; //the client flags of the value, see engine_hint_flags().
+    uint64_t ikey[2]; //the inline key, zero padded.
+};
+
+//the types of values.
+#define KKV_TYPE_STRING 0
+#define KKV_TYPE_HMAP 1 //a hash-map of fields, see hmap.c.
+#define KKV_TYPE_HLL 2 //a HyperLogLog, see hll.c.
+
+/*
+ * an independent set of keys with its own index and memory accounting,
+ * every file in the kkv filesystem has one.
+ */
+struct kkv_keyspace {
+    void *ht_root; //the 1st level hash table of the index.
+    atomic_t refcount;
+    ssize_t nr_items; //# of keys.
+    ssize_t mem; //memory taken by the item chains of the keys.
+    struct kkv_lease *leases; //the leases on missing keys, see lease.c.
+    struct kkv_mvcc *mvcc; //the snapshots and the old versions they read, see mvcc.c.
+};
+
+//the ops of an atomic batch.
+#define KKV_OP_SET 0
+#define KKV_OP_ADD 1
+#define KKV_OP_REPLACE 2
+#define KKV_OP_DELETE 3
+
+//max # of ops in an atomic batch.
+#define KKV_MULTI_MAX 128
+
+//the ops of bitop, combining the values of the source keys.
+#define KKV_BITOP_AND 0
+#define KKV_BITOP_OR 1
+#define KKV_BITOP_XOR 2
+#define KKV_BITOP_NOT 3
+#define KKV_BITOP_COPY 4 //used internally to take the first source.
+
+//max # of source keys of bitop.
+#define KKV_BITOP_MAX 16
+
+//max length of a value addressed by bit offsets.
+#define KKV_BITMAP_MAX (16 << 20)
+
+//# of elements added to a HyperLogLog together.
+#define KKV_HLL_BATCH 64
+//max # of HyperLogLogs counted or merged together.
+#define KKV_HLL_MAX 16
+
+//# of lists and keys of the index examined by a prefix delete before the engine lock is released.
+#define KKV_PREFIX_BATCH 4096
+
+//min length of a value shared by the keys holding the same bytes.
+#define KKV_DEDUP_MIN 1024
+
+/*
+ * one write of an atomic batch, see engine_multi().
+ */
+struct kkv_op {
+    int op;
+    char *key;
+    ssize_t nkey;
+    char *value;
+    ssize_t nvalue;
+    ssize_t ret; //result of this op.
+    //the following are used by engine_multi() internally.
+    uint32_t key_md;
+    int exists; //whether the key exists once the ops before this one are applied.
     struct item *it;
+    struct itemx *itx;
 };
 
 struct item *create_item(char *key, ssize_t nkey, char *value, ssize_t nvalue);
+struct item *create_item_raw(char *key, ssize_t nkey, ssize_t nvalue);
 int unlink_item(struct item *it);
+int item_writable(struct item *it);
+int overwrite_item(struct item *it, char *value, ssize_t nvalue);
+ssize_t append_item(struct item *it, char *value, ssize_t nvalue);
+ssize_t write_item_range(struct item *it, ssize_t offset, char *value, ssize_t nvalue);
+struct item *prepend_item(struct item *it, char *value, ssize_t nvalue, ssize_t *grown);
+struct item *compact_item(struct item *it);
+int item_fragmented(struct item *it);
 ssize_t read_item(struct item *it, char *buf, ssize_t nbuf);
+ssize_t read_item_range(struct item *it, ssize_t offset, char *buf, ssize_t nbuf);
+uint64_t count_item_bits(struct item *it, ssize_t offset, ssize_t nbytes);
+void bitop_item(struct item *dst, struct item *src, int op);
+ssize_t item_value_size(struct item *it);
+ssize_t item_mem_size(struct item *it);
 int init_item_system(void);
 void destroy_item_system(void);
 void shrink_item_system(void);
 
-struct itemx *find_itemx(uint32_t key_md, char *key, ssize_t nkey);
-struct itemx *locate_itemx(uint32_t key_md, char *key, ssize_t nkey, struct itemx ***cur_header, int force);
-struct itemx *create_itemx(uint32_t key_md, struct item *it);
-int update_itemx(struct itemx *itx, struct item *it);
-int add_itemx(struct itemx *itx, struct itemx **cur_header);
-int delete_itemx(struct itemx *itx, struct itemx **cur_header);
+int itemx_has_key(struct itemx *itx, char *key, ssize_t nkey);
+struct itemx *find_itemx(struct kkv_keyspace *ks, uint32_t key_md, char *key, ssize_t nkey);
+void find_itemx_batch(struct kkv_keyspace *ks, uint32_t *key_md, char **key, ssize_t *nkey, struct itemx **itx, int nr);
+struct itemx *locate_itemx(struct kkv_keyspace *ks, uint32_t key_md, char *key, ssize_t nkey, struct itemx ***cur_header, int force);
+struct itemx *create_itemx(uint32_t key_md, char *key, ssize_t nkey, struct item *it);
+uint64_t next_cas(void);
+int itemx_writable(struct kkv_keyspace *ks, struct itemx *itx);
+int update_itemx(struct kkv_keyspace *ks, struct itemx *itx, struct item *it);
+void touch_itemx(struct kkv_keyspace *ks, struct itemx *itx, ssize_t grown);
+int add_itemx(struct kkv_keyspace *ks, struct itemx *itx, struct itemx **cur_header);
+int delete_itemx(struct kkv_keyspace *ks, struct itemx *itx, struct itemx **cur_header);
+ssize_t delete_itemx_prefix(struct kkv_keyspace *ks, char *prefix, ssize_t nprefix, uint64_t *cursor, ssize_t batch);
+void free_itemx(struct itemx *itx);
 int init_itemx_system(void);
 void destroy_itemx_system(void);
+struct kkv_keyspace *create_keyspace(void);
+void flush_keyspace(struct kkv_keyspace *ks);
+void destroy_keyspace(struct kkv_keyspace *ks);
 
-ssize_t engine_set(char *key, ssize_t nkey, char *value, ssize_t nvalue);
-ssize_t engine_add(char *key, ssize_t nkey, char *value, ssize_t nvalue);
-ssize_t engine_replace(char *key, ssize_t nkey, char *value, ssize_t nvalue);
-ssize_t engine_delete(char *key, ssize_t nkey);
+void engine_hint(char *key, uint32_t key_md);
+void engine_hint_flags(uint32_t flags);
+ssize_t engine_set(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *value, ssize_t nvalue);
+ssize_t engine_store_item(struct kkv_keyspace *ks, char *key, ssize_t nkey, struct item *it, int op);
+ssize_t engine_add(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *value, ssize_t nvalue);
+ssize_t engine_replace(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *value, ssize_t nvalue);
+ssize_t engine_cas(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *value, ssize_t nvalue, uint64_t *cas);
+ssize_t engine_append(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *value, ssize_t nvalue, int append);
+ssize_t engine_delete(struct kkv_keyspace *ks, char *key, ssize_t nkey);
+ssize_t engine_delete_prefix(struct kkv_keyspace *ks, char *prefix, ssize_t nprefix, uint64_t *cursor, uint64_t *nr);
 ssize_t engine_shrink(void);
-ssize_t engine_get(char *key, ssize_t nkey, char *value, ssize_t nvalue);
+ssize_t engine_flush(struct kkv_keyspace *ks);
+ssize_t engine_snapshot(struct kkv_keyspace *ks, uint64_t *snap);
+ssize_t engine_release(struct kkv_keyspace *ks, uint64_t snap);
+ssize_t engine_get(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *value, ssize_t nvalue, uint64_t snap, uint64_t *cas, uint32_t *flags);
+struct item *engine_get_item(struct kkv_keyspace *ks, char *key, ssize_t nkey, ssize_t *nvalue, uint64_t *cas, uint32_t *flags);
+void engine_put_item(struct item *it);
+ssize_t engine_lget(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *value, ssize_t nvalue, uint64_t *cas);
+ssize_t engine_lset(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *value, ssize_t nvalue, uint64_t token);
+ssize_t engine_getrange(struct kkv_keyspace *ks, char *key, ssize_t nkey, ssize_t offset, char *value, ssize_t nvalue, uint64_t *cas);
+ssize_t engine_setrange(struct kkv_keyspace *ks, char *key, ssize_t nkey, ssize_t offset, char *value, ssize_t nvalue);
+ssize_t engine_incr(struct kkv_keyspace *ks, char *key, ssize_t nkey, uint64_t delta, int incr, uint64_t *result);
+ssize_t engine_mget(struct kkv_keyspace *ks, char **key, ssize_t *nkey, ssize_t *nvalue, int nr, char *value, ssize_t max, uint64_t snap);
+ssize_t engine_multi(struct kkv_keyspace *ks, struct kkv_op *ops, int nr);
+ssize_t engine_hget(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *field, ssize_t nfield, char *value, ssize_t nvalue, uint64_t *cas);
+ssize_t engine_hset(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *field, ssize_t nfield, char *value, ssize_t nvalue);
+ssize_t engine_hdel(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *field, ssize_t nfield);
+ssize_t engine_hgetall(struct kkv_keyspace *ks, char *key, ssize_t nkey, char *value, ssize_t nvalue, uint64_t *cas);
+ssize_t engine_setbit(struct kkv_keyspace *ks, char *key, ssize_t nkey, uint64_t offset, int bit, uint64_t *old);
+ssize_t engine_getbit(struct kkv_keyspace *ks, char *key, ssize_t nkey, uint64_t offset, uint64_t *bit);
+ssize_t engine_bitcount(struct kkv_keyspace *ks, char *key, ssize_t nkey, ssize_t offset, ssize_t nbytes, uint64_t *nr);
+ssize_t engine_bitop(struct kkv_keyspace *ks, int op, char *dkey, ssize_t ndkey, char **key, ssize_t *nkey, int nr, uint64_t *len);
+ssize_t engine_pfadd(struct kkv_keyspace *ks, char *key, ssize_t nkey, char **elem, ssize_t *nelem, int nr, uint64_t *changed);
+ssize_t engine_pfcount(struct kkv_keyspace *ks, char **key, ssize_t *nkey, int nr, uint64_t *count);
+ssize_t engine_pfmerge(struct kkv_keyspace *ks, char *dkey, ssize_t ndkey, char **key, ssize_t *nkey, int nr, uint64_t *count);
 
 void init_protocol(void);
 
@@ -0,0 +1,117 @@
+/*
+ * In-Kernel Key/Value Store.
+ *
+ * Copyright (C) 2013-2014 jilinxpd.
+ *
+ * This file is released under the GPL.
+ */
+
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/jiffies.h>
+#include "kkv.h"
+#include "lease.h"
+
+/*
+ * a lease is handed to the first client missing a key, the others missing it
+ * meanwhile are told to retry, so only one of them goes to the backing store.
+ * the holder fills the key with its token, which fails if the key was written
+ * or deleted since the lease was handed out, since every such write revokes it.
+ * the leases of a keyspace live in a small table indexed by the hash of the key,
+ * allocated on the first lease; a lease is dropped when another key takes its slot,
+ * and a colliding hash only makes a client retry or miss the fill, never store a stale value.
+ * the leases are protected by the engine lock like the keys.
+ */
+
+//# of slots, a power of 2.
+#define LEASE_NR 1024
+//a lease whose holder doesn't fill the key in time is given to the next client missing it.
+#define LEASE_TIMEOUT (3 * HZ)
+
+struct kkv_lease {
+    uint32_t key_md;
+    uint64_t token; //0 if the slot is free.
+    unsigned long expires;
+};
+
+static uint64_t lease_id = 0;
+
+static struct kkv_lease *lease_slot(struct kkv_keyspace *ks, uint32_t key_md)
+{
+    return &ks->leases[key_md & (LEASE_NR - 1)];
+}
+
+static int lease_live(struct kkv_lease *l, uint32_t key_md)
+{
+    return l->token && l->key_md == key_md && time_before(jiffies, l->expires);
+}
+
+/*
+ * hand out a lease on the missing key.
+ * @return: 0 with the token in *token, -EAGAIN if another client holds the lease,
+ * or -ENOMEM.
+ */
+int lease_acquire(struct kkv_keyspace *ks, uint32_t key_md, uint64_t *token)
+{
+    struct kkv_lease *l;
+
+    if (!ks->leases) {
+        ks->leases = kzalloc(LEASE_NR * sizeof(struct kkv_lease), GFP_KERNEL);
+        if (!ks->leases)
+            return -ENOMEM;
+    }
+
+    l = lease_slot(ks, key_md);
+    if (lease_live(l, key_md))
+        return -EAGAIN;
+
+    l->key_md = key_md;
+    l->token = ++lease_id;
+    l->expires = jiffies + LEASE_TIMEOUT;
+    *token = l->token;
+    return 0;
+}
+
+/*
+ * @return: 0 if the lease on the key is still held by token, or -ESTALE.
+ */
+int lease_check(struct kkv_keyspace *ks, uint32_t key_md, uint64_t token)
+{
+    struct kkv_lease *l;
+
+    if (!ks->leases || !token)
+        return -ESTALE;
+    l = lease_slot(ks, key_md);
+    if (!lease_live(l, key_md) || l->token != token)
+        return -ESTALE;
+    return 0;
+}
+
+/*
+ * drop the lease on the key, called on every write to it.
+ */
+void lease_revoke(struct kkv_keyspace *ks, uint32_t key_md)
+{
+    struct kkv_lease *l;
+
+    if (!ks->leases)
+        return;
+    l = lease_slot(ks, key_md);
+    if (l->key_md == key_md)
+        l->token = 0;
+}
+
+void lease_flush(struct kkv_keyspace *ks)
+{
+    if (ks->leases)
+        memset(ks->leases, 0, LEASE_NR * sizeof(struct kkv_lease));
+}
+
+void lease_destroy(struct kkv_keyspace *ks)
+{
+    kfree(ks->leases);
+    ks->leases = NULL;
+}
@@ -0,0 +1,20 @@
+/*
+ * In-Kernel Key/Value Store.
+ *
+ * Copyright (C) 2013-2014 jilinxpd.
+ *
+ * This file is released under the GPL.
+ */
+
+#ifndef _KKV_LEASE_H
+#define _KKV_LEASE_H
+
+
+int lease_acquire(struct kkv_keyspace *ks, uint32_t key_md, uint64_t *token);
+int lease_check(struct kkv_keyspace *ks, uint32_t key_md, uint64_t token);
+void lease_revoke(struct kkv_keyspace *ks, uint32_t key_md);
+void lease_flush(struct kkv_keyspace *ks);
+void lease_destroy(struct kkv_keyspace *ks);
+
+
+#endif
@@ -0,0 +1,928 @@
+/*
+ * In-Kernel Key/Value Store.
+ *
+ * Copyright (C) 2013-2014 jilinxpd.
+ *
+ * This file is released under the GPL.
+ */
+
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <asm/byteorder.h>
+#include "kkv.h"
+#include "protocol.h"
+#include "memcached.h"
+
+/*
+ * the memcached frontend speaks the text and the binary protocols of memcached,
+ * told apart by the first byte of each request.
+ * a memcached request is translated into kkv_packet requests built in the scratch buffer pkt
+ * of the session, which are processed as those of kkv clients, see protocol.c.
+ * the client flags of a value are kept with it, see KKV_FLAG_CLIENT, but its expiration time isn't.
+ */
+
+#define COMMAND_GET 10
+#define COMMAND_SET 11
+#define COMMAND_ADD 12
+#define COMMAND_REPLACE 13
+#define COMMAND_DELETE 14
+#define COMMAND_ACK 20
+#define COMMAND_NACK 21
+#define COMMAND_INCR 33
+#define COMMAND_DECR 34
+#define COMMAND_APPEND 35
+#define COMMAND_PREPEND 36
+#define COMMAND_CAS 37
+#define COMMAND_FLUSH 42
+
+#define KKV_FLAG_CLIENT 0x10 //the hash field holds the client flags stored with the value, and read back by a get, not with KKV_FLAG_HASH.
+
+typedef struct {
+    __u32 id;
+    __u32 command;
+    __u32 key_len;
+    __u32 value_len;
+    __u64 cas;
+    __u32 hash;
+    __u32 flags;
+    char data[0];
+} kkv_packet;
+
+//the header of a packet of the binary protocol, in network byte order.
+typedef struct {
+    __u8 magic;
+    __u8 opcode;
+    __u16 key_len;
+    __u8 extras_len;
+    __u8 data_type;
+    __u16 status;//the vbucket id in a request
+    __u32 body_len;
+    __u32 opaque;
+    __u64 cas;
+} mc_header;
+
+#define MC_MAGIC_REQ 0x80
+#define MC_MAGIC_RSP 0x81
+
+#define MC_STATUS_OK 0x00
+#define MC_STATUS_KEY_ENOENT 0x01
+#define MC_STATUS_KEY_EEXISTS 0x02
+#define MC_STATUS_E2BIG 0x03
+#define MC_STATUS_EINVAL 0x04
+#define MC_STATUS_NOT_STORED 0x05
+#define MC_STATUS_DELTA_BADVAL 0x06
+#define MC_STATUS_UNKNOWN_COMMAND 0x81
+#define MC_STATUS_ENOMEM 0x82
+
+//the operations of both protocols.
+#define MC_UNKNOWN 0
+#define MC_GET 1
+#define MC_GETS 2
+#define MC_SET 3
+#define MC_ADD 4
+#define MC_REPLACE 5
+#define MC_APPEND 6
+#define MC_PREPEND 7
+#define MC_CAS 8
+#define MC_DELETE 9
+#define MC_INCR 10
+#define MC_DECR 11
+#define MC_FLUSH 12
+#define MC_VERSION 13
+#define MC_NOOP 14
+#define MC_QUIT 15
+#define MC_STAT 16
+
+#define MC_KEY_MAX 250
+//max # of arguments of a text command other than get.
+#define MC_TOKENS 7
+#define MC_VERSION_STRING "1.4.0-kkv"
+//the expiration time of a binary incr telling not to create a missing key.
+#define MC_NO_CREATE 0xffffffff
+
+/*
+ * a memcached request, parsed from its header, i.e. the command line of the text protocol.
+ */
+struct mc_request {
+    int binary;
+    int op;//one of MC_*
+    int quiet;//noreply, or a quiet opcode
+    int bad;//malformed
+    char *key;
+    ssize_t nkey;
+    char *value;
+    ssize_t nvalue;
+    ssize_t nbody;//# of bytes after the header, the value and its trailing "\r\n" in the text protocol
+    __u64 cas;
+    __u64 delta;
+    __u32 flags;//the client flags of a value to store
+    char *args;//the keys of a text get
+    char *end;//the end of the command line
+    char *extras;
+    ssize_t nextras;
+    __u8 opcode;
+    int with_key;//the key is echoed, by getk and getkq
+    __u32 opaque;
+};
+
+static const struct {
+    const char *name;
+    int op;
+} mc_text_ops[] = {
+    {"get", MC_GET},
+    {"gets", MC_GETS},
+    {"set", MC_SET},
+    {"add", MC_ADD},
+    {"replace", MC_REPLACE},
+    {"append", MC_APPEND},
+    {"prepend", MC_PREPEND},
+    {"cas", MC_CAS},
+    {"delete", MC_DELETE},
+    {"incr", MC_INCR},
+    {"decr", MC_DECR},
+    {"flush_all", MC_FLUSH},
+    {"version", MC_VERSION},
+    {"quit", MC_QUIT},
+};
+
+//the binary opcodes 0x00-0x1a, the quiet ones are 0x09, 0x0d and 0x11-0x1a.
+static const int mc_binary_ops[] = {
+    MC_GET, MC_SET, MC_ADD, MC_REPLACE, MC_DELETE, MC_INCR, MC_DECR, MC_QUIT,
+    MC_FLUSH, MC_GET, MC_NOOP, MC_VERSION, MC_GET, MC_GET, MC_APPEND, MC_PREPEND,
+    MC_STAT, MC_SET, MC_ADD, MC_REPLACE, MC_DELETE, MC_INCR, MC_DECR, MC_QUIT,
+    MC_FLUSH, MC_APPEND, MC_PREPEND,
+};
+
+static inline int mc_binary_quiet(__u8 opcode)
+{
+    return opcode == 0x09 || opcode == 0x0d || (opcode >= 0x11 && opcode <= 0x1a);
+}
+
+static inline int mc_store_op(int op)
+{
+    return op >= MC_SET && op <= MC_CAS;
+}
+
+/*
+ * fetch the token at pos, tokens are separated by spaces.
+ * @return: the position after the token, or NULL if there's no more.
+ */
+static char *mc_token(char *pos, char *end, char **tok, ssize_t *ntok)
+{
+    while (pos < end && *pos == ' ')
+        pos++;
+    if (pos == end)
+        return NULL;
+    *tok = pos;
+    while (pos < end && *pos != ' ')
+        pos++;
+    *ntok = pos - *tok;
+    return pos;
+}
+
+static inline int mc_token_is(char *tok, ssize_t ntok, const char *s)
+{
+    return ntok == (ssize_t) strlen(s) && !memcmp(tok, s, ntok);
+}
+
+/*
+ * parse the decimal token.
+ * @return: 0, or -EINVAL if it isn't a number that fits in 64 bits.
+ */
+static int mc_number(char *tok, ssize_t ntok, __u64 *num)
+{
+    __u64 n = 0;
+    ssize_t i;
+
+    if (ntok <= 0 || ntok > 20)
+        return -EINVAL;
+    for (i = 0; i < ntok; i++) {
+        if (tok[i] < '0' || tok[i] > '9' || n > (~0ULL - (tok[i] - '0')) / 10)
+            return -EINVAL;
+        n = n * 10 + tok[i] - '0';
+    }
+    *num = n;
+    return 0;
+}
+
+/*
+ * parse the arguments of a text command other than get, the last one may be noreply.
+ */
+static void mc_parse_args(struct mc_request *req, char *pos)
+{
+    char *tok[MC_TOKENS + 1];
+    ssize_t ntok[MC_TOKENS + 1];
+    __u64 num, flags;
+    int nr = 0;
+    int nargs;
+
+    while (nr <= MC_TOKENS && (pos = mc_token(pos, req->end, &tok[nr], &ntok[nr])))
+        nr++;
+    if (nr > 0 && mc_token_is(tok[nr - 1], ntok[nr - 1], "noreply")) {
+        req->quiet = 1;
+        nr--;
+    }
+
+    switch (req->op) {
+    case MC_SET:
+    case MC_ADD:
+    case MC_REPLACE:
+    case MC_APPEND:
+    case MC_PREPEND:
+    case MC_CAS:
+        //key flags exptime bytes [cas]
+        nargs = req->op == MC_CAS ? 5 : 4;
+        if (nr != nargs || mc_number(tok[1], ntok[1], &flags) || flags > 0xffffffffULL ||
+                (tok[2][0] != '-' && mc_number(tok[2], ntok[2], &num)) ||
+                mc_number(tok[3], ntok[3], &num) || num > 0x7fffffffULL ||
+                (req->op == MC_CAS && mc_number(tok[4], ntok[4], &req->cas))) {
+            req->bad = 1;
+            return;
+        }
+        req->flags = flags;
+        req->nvalue = num;
+        req->nbody = num + 2;
+        break;
+    case MC_DELETE:
+        //key [0]
+        if (nr < 1 || nr > 2 || (nr == 2 && !mc_token_is(tok[1], ntok[1], "0")))
+            req->bad = 1;
+        break;
+    case MC_INCR:
+    case MC_DECR:
+        //key delta
+        if (nr != 2 || mc_number(tok[1], ntok[1], &req->delta))
+            req->bad = 1;
+        break;
+    case MC_FLUSH:
+        //[delay], which isn't supported since there's no expiration
+        if (nr > 1 || (nr == 1 && mc_number(tok[0], ntok[0], &num)))
+            req->bad = 1;
+        return;
+    default:
+        if (nr > 0)
+            req->bad = 1;
+        return;
+    }
+
+    if (!req->bad && ntok[0] <= MC_KEY_MAX) {
+        req->key = tok[0];
+        req->nkey = ntok[0];
+    } else {
+        req->bad = 1;
+    }
+}
+
+/*
+ * parse the command line of a text request.
+ * @return: the length of the line, 0 if it hasn't arrived yet,
+ * or -EINVAL if it can't fit in a request buffer.
+ */
+static ssize_t mc_parse_text(char *buf, ssize_t len, struct mc_request *req)
+{
+    char *nl, *tok;
+    ssize_t ntok;
+    int i;
+
+    nl = memchr(buf, '\n', len);
+    if (!nl)
+        return len >= KKV_REQ_BUF_SIZE ? -EINVAL : 0;
+    req->end = nl > buf && nl[-1] == '\r' ? nl - 1 : nl;
+    req->value = nl + 1;
+
+    req->args = mc_token(buf, req->end, &tok, &ntok);
+    if (req->args) {
+        for (i = 0; i < ARRAY_SIZE(mc_text_ops); i++) {
+            if (mc_token_is(tok, ntok, mc_text_ops[i].name)) {
+                req->op = mc_text_ops[i].op;
+                break;
+            }
+        }
+    }
+    if (req->op != MC_UNKNOWN && req->op != MC_GET && req->op != MC_GETS)
+        mc_parse_args(req, req->args);
+    return nl + 1 - buf;
+}
+
+/*
+ * parse the header of a binary request.
+ * @return: the length of the header, along with the body unless it holds a value to store,
+ * or 0 if the header hasn't arrived yet.
+ */
+static ssize_t mc_parse_binary(char *buf, ssize_t len, struct mc_request *req)
+{
+    mc_header hdr, *h = &hdr;
+    ssize_t nbody;
+
+    if (len < (ssize_t) sizeof(mc_header))
+        return 0;
+    //text requests ahead of it leave the header at any offset.
+    memcpy(&hdr, buf, sizeof(mc_header));
+
+    req->binary = 1;
+    req->opcode = h->opcode;
+    req->opaque = h->opaque;
+    req->cas = be64_to_cpu(h->cas);
+    if (h->opcode < ARRAY_SIZE(mc_binary_ops))
+        req->op = mc_binary_ops[h->opcode];
+    req->quiet = mc_binary_quiet(h->opcode);
+    req->with_key = h->opcode == 0x0c || h->opcode == 0x0d;
+    //a set with a cas is a cas.
+    if (req->op == MC_SET && req->cas)
+        req->op = MC_CAS;
+
+    nbody = be32_to_cpu(h->body_len);
+    req->extras = buf + sizeof(mc_header);
+    req->nextras = h->extras_len;
+    req->nkey = be16_to_cpu(h->key_len);
+    req->key = req->extras + req->nextras;
+    req->value = req->key + req->nkey;
+    req->nvalue = nbody - req->nextras - req->nkey;
+    if (req->nvalue < 0 || req->nkey > MC_KEY_MAX) {
+        req->bad = 1;
+        req->nkey = 0;
+        req->nvalue = 0;
+    }
+
+    if (mc_store_op(req->op) && !req->bad) {
+        //the extras of a set, an add or a replace begin with the client flags.
+        if (req->nextras >= 4) {
+            memcpy(&req->flags, req->extras, sizeof(__u32));
+            req->flags = be32_to_cpu(req->flags);
+        }
+        req->nbody = req->nvalue;
+        return sizeof(mc_header) + req->nextras + req->nkey;
+    }
+    return sizeof(mc_header) + nbody;
+}
+
+static ssize_t mc_parse(char *buf, ssize_t len, struct mc_request *req)
+{
+    memset(req, 0, sizeof(struct mc_request));
+    if (len > 0 && (__u8) buf[0] == MC_MAGIC_REQ)
+        return mc_parse_binary(buf, len, req);
+    return mc_parse_text(buf, len, req);
+}
+
+/*
+ * the length of the part of the memcached request at buf held in the request buffer,
+ * of which len bytes have arrived, like kkv_req_len().
+ * a value of at least KKV_LARGE_VALUE bytes to store is left out, and its length is put in *nlarge,
+ * including the trailing "\r\n" of the text protocol, see mc_create_large().
+ * @return: the length, 0 if the header hasn't arrived yet,
+ * or -EINVAL if it can't fit in a request buffer.
+ */
+ssize_t mc_req_len(char *buf, ssize_t len, ssize_t *nlarge)
+{
+    struct mc_request req;
+    ssize_t n;
+
+    *nlarge = 0;
+    n = mc_parse(buf, len, &req);
+    if (n <= 0)
+        return n;
+    if (mc_store_op(req.op) && req.nvalue >= KKV_LARGE_VALUE) {
+        *nlarge = req.nbody;
+        return n;
+    }
+    n += req.nbody;
+    if (n > KKV_REQ_BUF_SIZE)
+        return -EINVAL;
+    return n;
+}
+
+/*
+ * build the kkv_packet request at pkt, its value is left to the caller if value is NULL.
+ * the client flags to store, in the hash field, are left 0 for the caller to fill in.
+ * @return: the length of the request.
+ */
+static ssize_t mc_build(char *pkt, __u32 command, char *key, ssize_t nkey, char *value, ssize_t nvalue, __u64 cas)
+{
+    kkv_packet *pk = (kkv_packet*) pkt;
+
+    pk->id = 0;
+    pk->command = command;
+    pk->key_len = nkey;
+    pk->value_len = nvalue;
+    pk->cas = cas;
+    pk->hash = 0;
+    pk->flags = KKV_FLAG_CLIENT;
+    if (key)
+        memcpy(pk->data, key, nkey);
+    if (value)
+        memcpy(pk->data + nkey, value, nvalue);
+    return sizeof(kkv_packet) + nkey + nvalue;
+}
+
+/*
+ * process the kkv_packet request built at pkt,
+ * which is passed as long as it is, so that an empty value isn't taken for the rest of the buffer.
+ * @return: the same as kkv_process_req(), with the response packet at pkt.
+ */
+static ssize_t mc_execute(char *pkt, struct kkv_keyspace *ks, __u32 command, char *key, ssize_t nkey, char *value, ssize_t nvalue, __u64 cas)
+{
+    ssize_t len;
+
+    len = mc_build(pkt, command, key, nkey, value, nvalue, cas);
+    return kkv_process_req(ks, pkt, len, &len);
+}
+
+/*
+ * get the key, the value is left in the response packet at pkt unless it is pinned in *it.
+ * @return: the # of bytes of the value with its client flags in *flags, or -ENOENT.
+ */
+static ssize_t mc_get(char *pkt, struct kkv_keyspace *ks, char *key, ssize_t nkey, struct item **it, __u64 *cas, __u32 *flags)
+{
+    kkv_packet *pk = (kkv_packet*) pkt;
+    ssize_t ret, len;
+
+    mc_build(pkt, COMMAND_GET, key, nkey, NULL, 0, 0);
+    ret = kkv_process_req_pinned(ks, pkt, KKV_REQ_BUF_SIZE, &len, it);
+    if (pk->command != COMMAND_ACK)
+        return -ENOENT;
+    *cas = pk->cas;
+    *flags = pk->hash;
+    return ret;
+}
+
+static __u32 mc_command(int op)
+{
+    switch (op) {
+    case MC_SET:
+        return COMMAND_SET;
+    case MC_ADD:
+        return COMMAND_ADD;
+    case MC_REPLACE:
+        return COMMAND_REPLACE;
+    case MC_APPEND:
+        return COMMAND_APPEND;
+    case MC_PREPEND:
+        return COMMAND_PREPEND;
+    case MC_CAS:
+        return COMMAND_CAS;
+    case MC_INCR:
+        return COMMAND_INCR;
+    case MC_DECR:
+        return COMMAND_DECR;
+    case MC_DELETE:
+        return COMMAND_DELETE;
+    case MC_FLUSH:
+        return COMMAND_FLUSH;
+    default:
+        //not a request command, so kkv_process_req() refuses it with -EINVAL.
+        return COMMAND_NACK;
+    }
+}
+
+/*
+ * the binary status of the result of the operation, which the text responses are derived from.
+ */
+static __u16 mc_status(int op, ssize_t ret)
+{
+    if (ret >= 0)
+        return MC_STATUS_OK;
+
+    switch (ret) {
+    case -ENOENT:
+        return op == MC_APPEND || op == MC_PREPEND ? MC_STATUS_NOT_STORED : MC_STATUS_KEY_ENOENT;
+    case -EEXIST:
+        return MC_STATUS_KEY_EEXISTS;
+    case -E2BIG:
+        return MC_STATUS_E2BIG;
+    case -EINVAL:
+        //a key of another type, or a value which isn't a number.
+        if (op == MC_INCR || op == MC_DECR)
+            return MC_STATUS_DELTA_BADVAL;
+        return mc_store_op(op) ? MC_STATUS_NOT_STORED : MC_STATUS_EINVAL;
+    default:
+        return MC_STATUS_ENOMEM;
+    }
+}
+
+static inline void mc_put(struct mc_rsp *rsp, const char *data, ssize_t n)
+{
+    memcpy(rsp->buf + rsp->len, data, n);
+    rsp->len += n;
+}
+
+static inline void mc_puts(struct mc_rsp *rsp, const char *s)
+{
+    mc_put(rsp, s, strlen(s));
+}
+
+static void mc_text_status(struct mc_request *req, struct mc_rsp *rsp, __u16 status)
+{
+    const char *s;
+
+    switch (status) {
+    case MC_STATUS_OK:
+        if (req->op == MC_DELETE)
+            s = "DELETED\r\n";
+        else if (req->op == MC_FLUSH)
+            s = "OK\r\n";
+        else
+            s = "STORED\r\n";
+        break;
+    case MC_STATUS_KEY_ENOENT:
+        if (req->op == MC_CAS || req->op == MC_DELETE || req->op == MC_INCR || req->op == MC_DECR)
+            s = "NOT_FOUND\r\n";
+        else
+            s = "NOT_STORED\r\n";
+        break;
+    case MC_STATUS_KEY_EEXISTS:
+        s = req->op == MC_CAS ? "EXISTS\r\n" : "NOT_STORED\r\n";
+        break;
+    case MC_STATUS_NOT_STORED:
+        s = "NOT_STORED\r\n";
+        break;
+    case MC_STATUS_E2BIG:
+        s = "SERVER_ERROR object too large for cache\r\n";
+        break;
+    case MC_STATUS_EINVAL:
+        s = "CLIENT_ERROR bad command line format\r\n";
+        break;
+    case MC_STATUS_DELTA_BADVAL:
+        s = "CLIENT_ERROR cannot increment or decrement non-numeric value\r\n";
+        break;
+    case MC_STATUS_UNKNOWN_COMMAND:
+        s = "ERROR\r\n";
+        break;
+    default:
+        s = "SERVER_ERROR out of memory storing object\r\n";
+        break;
+    }
+    mc_puts(rsp, s);
+}
+
+/*
+ * put the header of a binary response and its body, but the value if it is NULL.
+ */
+static void mc_binary_rsp(struct mc_request *req, struct mc_rsp *rsp, __u16 status, __u64 cas,
+                          char *extras, ssize_t nextras, char *key, ssize_t nkey, char *value, ssize_t nvalue)
+{
+    mc_header h;
+
+    memset(&h, 0, sizeof(mc_header));
+    h.magic = MC_MAGIC_RSP;
+    h.opcode = req->opcode;
+    h.key_len = cpu_to_be16(nkey);
+    h.extras_len = nextras;
+    h.status = cpu_to_be16(status);
+    h.body_len = cpu_to_be32(nextras + nkey + nvalue);
+    h.opaque = req->opaque;
+    h.cas = cpu_to_be64(cas);
+    mc_put(rsp, (char*) &h, sizeof(mc_header));
+    if (extras)
+        mc_put(rsp, extras, nextras);
+    if (key)
+        mc_put(rsp, key, nkey);
+    if (value)
+        mc_put(rsp, value, nvalue);
+}
+
+/*
+ * answer the request with the status of its result, a quiet one only if it failed.
+ */
+static void mc_reply(struct mc_request *req, struct mc_rsp *rsp, __u16 status, __u64 cas)
+{
+    if (req->binary) {
+        if (!req->quiet || status != MC_STATUS_OK)
+            mc_binary_rsp(req, rsp, status, cas, NULL, 0, NULL, 0, NULL, 0);
+    } else if (!req->quiet) {
+        mc_text_status(req, rsp, status);
+    }
+}
+
+/*
+ * answer a text get of one or more keys, each value is copied into the response or sent from its chain.
+ * the response is dropped if it can't fit, and the get waits for an empty batch if it may.
+ * @return: 0, or -EAGAIN to be retried with an empty batch.
+ */
+static ssize_t mc_text_get(char *pkt, struct kkv_keyspace *ks, struct mc_request *req, struct mc_rsp *rsp)
+{
+    kkv_packet *pk = (kkv_packet*) pkt;
+    char line[MC_KEY_MAX + 64];
+    char *pos = req->args;
+    char *key;
+    ssize_t nkey, nvalue;
+    struct item *it;
+    __u64 cas;
+    __u32 flags;
+    int n;
+
+    if (!mc_token(pos, req->end, &key, &nkey)) {
+        mc_puts(rsp, "ERROR\r\n");
+        return 0;
+    }
+
+    while ((pos = mc_token(pos, req->end, &key, &nkey))) {
+        if (nkey > MC_KEY_MAX) {
+            kkv_put_items(rsp->its, rsp->nr);
+            rsp->nr = 0;
+            rsp->len = 0;
+            mc_text_status(req, rsp, MC_STATUS_EINVAL);
+            return 0;
+        }
+        nvalue = mc_get(pkt, ks, key, nkey, &it, &cas, &flags);
+        if (nvalue < 0)
+            continue;
+
+        if (req->op == MC_GETS)
+            n = snprintf(line, sizeof(line), "VALUE %.*s %u %ld %llu\r\n", (int) nkey, key, flags, (long) nvalue, (unsigned long long) cas);
+        else
+            n = snprintf(line, sizeof(line), "VALUE %.*s %u %ld\r\n", (int) nkey, key, flags, (long) nvalue);
+        //the line, the value, "\r\n" and "END\r\n".
+        if (rsp->room - rsp->len < n + (it ? 0 : nvalue) + 7 || (it && rsp->nr == rsp->max)) {
+            if (it)
+                kkv_put_items(&it, 1);
+            goto full;
+        }
+        mc_put(rsp, line, n);
+        if (it) {
+            rsp->its[rsp->nr] = it;
+            rsp->pos[rsp->nr] = rsp->len;
+            rsp->nr++;
+        } else {
+            mc_put(rsp, pk->data + pk->key_len, nvalue);
+        }
+        mc_put(rsp, "\r\n", 2);
+    }
+    mc_puts(rsp, "END\r\n");
+    return 0;
+
+full:
+    kkv_put_items(rsp->its, rsp->nr);
+    rsp->nr = 0;
+    rsp->len = 0;
+    if (rsp->retry)
+        return -EAGAIN;
+    mc_puts(rsp, "SERVER_ERROR out of memory writing get response\r\n");
+    return 0;
+}
+
+static void mc_binary_get(char *pkt, struct kkv_keyspace *ks, struct mc_request *req, struct mc_rsp *rsp)
+{
+    kkv_packet *pk = (kkv_packet*) pkt;
+    __u32 flags;
+    ssize_t nkey = req->with_key ? req->nkey : 0;
+    ssize_t nvalue;
+    struct item *it;
+    __u64 cas;
+
+    nvalue = mc_get(pkt, ks, req->key, req->nkey, &it, &cas, &flags);
+    if (nvalue < 0) {
+        if (!req->quiet)
+            mc_binary_rsp(req, rsp, MC_STATUS_KEY_ENOENT, 0, NULL, 0, req->key, nkey, NULL, 0);
+        return;
+    }
+    flags = cpu_to_be32(flags);
+    //the key is echoed from the request, which the response packet at pkt doesn't overlap.
+    mc_binary_rsp(req, rsp, MC_STATUS_OK, cas, (char*) &flags, sizeof(flags), req->key, nkey,
+                  it ? NULL : pk->data + pk->key_len, nvalue);
+    if (it) {
+        rsp->its[rsp->nr] = it;
+        rsp->pos[rsp->nr] = rsp->len;
+        rsp->nr++;
+    }
+}
+
+/*
+ * store the value of the request, in the buffer, along with its client flags.
+ * @return: the same as kkv_process_req(), with the version stored in *cas for a cas.
+ */
+static ssize_t mc_store(char *pkt, struct kkv_keyspace *ks, struct mc_request *req, __u64 *cas)
+{
+    kkv_packet *pk = (kkv_packet*) pkt;
+    ssize_t ret, len;
+
+    len = mc_build(pkt, mc_command(req->op), req->key, req->nkey, req->value, req->nvalue, req->cas);
+    pk->hash = req->flags;
+    ret = kkv_process_req(ks, pkt, len, &len);
+    //a cas whose version no longer matches is answered with a NACK carrying the current one.
+    if (req->op == MC_CAS && pk->command == COMMAND_NACK && ret >= 0)
+        ret = -EEXIST;
+    *cas = req->op == MC_CAS ? pk->cas : 0;
+    return ret;
+}
+
+/*
+ * add to or subtract from the number of the key,
+ * a binary one creates the key with the initial value in its extras unless told not to.
+ * @return: 0 with the new number in *num, or a negative error.
+ */
+static ssize_t mc_incr(char *pkt, struct kkv_keyspace *ks, struct mc_request *req, __u64 *num)
+{
+    kkv_packet *pk = (kkv_packet*) pkt;
+    char initial[24];
+    __u32 exptime;
+    ssize_t ret, n;
+
+    ret = mc_execute(pkt, ks, mc_command(req->op), req->key, req->nkey, (char*) &req->delta, sizeof(__u64), 0);
+    if (ret >= 0) {
+        memcpy(num, pk->data + pk->key_len, sizeof(__u64));
+        return 0;
+    }
+    if (ret != -ENOENT || !req->binary)
+        return ret;
+
+    memcpy(num, req->extras + 8, sizeof(__u64));
+    *num = be64_to_cpu(*num);
+    memcpy(&exptime, req->extras + 16, sizeof(__u32));
+    if (be32_to_cpu(exptime) == MC_NO_CREATE)
+        return ret;
+    n = snprintf(initial, sizeof(initial), "%llu", (unsigned long long) *num);
+    return mc_execute(pkt, ks, COMMAND_ADD, req->key, req->nkey, initial, n, 0);
+}
+
+static ssize_t mc_process_text(char *pkt, struct kkv_keyspace *ks, struct mc_request *req, struct mc_rsp *rsp)
+{
+    char num[24];
+    __u64 cas, n;
+    ssize_t ret;
+
+    if (req->op == MC_UNKNOWN) {
+        mc_puts(rsp, "ERROR\r\n");
+        return 0;
+    }
+    if (req->bad) {
+        mc_text_status(req, rsp, MC_STATUS_EINVAL);
+        return 0;
+    }
+
+    switch (req->op) {
+    case MC_GET:
+    case MC_GETS:
+        return mc_text_get(pkt, ks, req, rsp);
+
+    case MC_INCR:
+    case MC_DECR:
+        ret = mc_incr(pkt, ks, req, &n);
+        if (ret < 0 || req->quiet)
+            break;
+        ret = snprintf(num, sizeof(num), "%llu\r\n", (unsigned long long) n);
+        mc_put(rsp, num, ret);
+        return 0;
+
+    case MC_VERSION:
+        mc_puts(rsp, "VERSION " MC_VERSION_STRING "\r\n");
+        return 0;
+
+    case MC_QUIT:
+        return -ECONNRESET;
+
+    default:
+        if (mc_store_op(req->op)) {
+            if (memcmp(req->value + req->nvalue, "\r\n", 2)) {
+                mc_puts(rsp, "CLIENT_ERROR bad data chunk\r\n");
+                return 0;
+            }
+            ret = mc_store(pkt, ks, req, &cas);
+        } else {
+            ret = mc_execute(pkt, ks, mc_command(req->op), req->key, req->nkey, NULL, 0, 0);
+        }
+        break;
+    }
+    mc_reply(req, rsp, mc_status(req->op, ret), 0);
+    return 0;
+}
+
+/*
+ * whether the extras of the binary request are as long as its opcode takes.
+ */
+static int mc_binary_extras(struct mc_request *req)
+{
+    switch (req->op) {
+    case MC_SET:
+    case MC_ADD:
+    case MC_REPLACE:
+    case MC_CAS:
+        return req->nextras == 8;
+    case MC_INCR:
+    case MC_DECR:
+        return req->nextras == 20;
+    case MC_FLUSH:
+        return req->nextras == 0 || req->nextras == 4;
+    default:
+        return req->nextras == 0;
+    }
+}
+
+static ssize_t mc_process_binary(char *pkt, struct kkv_keyspace *ks, struct mc_request *req, struct mc_rsp *rsp)
+{
+    __u64 cas, n;
+    ssize_t ret;
+
+    if (req->op == MC_UNKNOWN) {
+        mc_binary_rsp(req, rsp, MC_STATUS_UNKNOWN_COMMAND, 0, NULL, 0, NULL, 0, NULL, 0);
+        return 0;
+    }
+    if (req->bad || !mc_binary_extras(req)) {
+        mc_binary_rsp(req, rsp, MC_STATUS_EINVAL, 0, NULL, 0, NULL, 0, NULL, 0);
+        return 0;
+    }
+
+    switch (req->op) {
+    case MC_GET:
+        mc_binary_get(pkt, ks, req, rsp);
+        return 0;
+
+    case MC_INCR:
+    case MC_DECR:
+        memcpy(&req->delta, req->extras, sizeof(__u64));
+        req->delta = be64_to_cpu(req->delta);
+        ret = mc_incr(pkt, ks, req, &n);
+        if (ret < 0)
+            break;
+        if (!req->quiet) {
+            n = cpu_to_be64(n);
+            mc_binary_rsp(req, rsp, MC_STATUS_OK, 0, NULL, 0, NULL, 0, (char*) &n, sizeof(n));
+        }
+        return 0;
+
+    case MC_VERSION:
+        mc_binary_rsp(req, rsp, MC_STATUS_OK, 0, NULL, 0, NULL, 0, MC_VERSION_STRING, strlen(MC_VERSION_STRING));
+        return 0;
+
+    case MC_NOOP:
+    case MC_STAT:
+        //no stats, just the empty one ending them.
+        mc_binary_rsp(req, rsp, MC_STATUS_OK, 0, NULL, 0, NULL, 0, NULL, 0);
+        return 0;
+
+    case MC_QUIT:
+        return -ECONNRESET;
+
+    default:
+        if (mc_store_op(req->op)) {
+            ret = mc_store(pkt, ks, req, &cas);
+            mc_reply(req, rsp, mc_status(req->op, ret), cas);
+            return 0;
+        }
+        ret = mc_execute(pkt, ks, mc_command(req->op), req->key, req->nkey, NULL, 0, 0);
+        break;
+    }
+    mc_reply(req, rsp, mc_status(req->op, ret), 0);
+    return 0;
+}
+
+/*
+ * create the item chain of the key of the request at buf with room for its large value,
+ * like kkv_create_large(). only set, add and replace store a large value,
+ * the value of another request is dropped.
+ * @return: the chain, or NULL if the value is dropped.
+ */
+struct item *mc_create_large(char *pkt, char *buf, ssize_t len)
+{
+    struct mc_request req;
+
+    mc_parse(buf, len, &req);
+    if (req.bad || (req.op != MC_SET && req.op != MC_ADD && req.op != MC_REPLACE))
+        return NULL;
+    mc_build(pkt, mc_command(req.op), req.key, req.nkey, NULL, req.nvalue, 0);
+    return kkv_create_large(pkt);
+}
+
+/*
+ * store the chain it holding the large value of the request at buf, see mc_create_large(),
+ * and then put the response into rsp.
+ * @return: 0.
+ */
+ssize_t mc_process_large(char *pkt, struct kkv_keyspace *ks, char *buf, ssize_t len, struct item *it, struct mc_rsp *rsp)
+{
+    struct mc_request req;
+    ssize_t ret, n;
+
+    mc_parse(buf, len, &req);
+    if (it) {
+        mc_build(pkt, mc_command(req.op), req.key, req.nkey, NULL, req.nvalue, 0);
+        ((kkv_packet*) pkt)->hash = req.flags;
+        ret = kkv_process_large(ks, pkt, it, &n);
+    } else if (req.bad) {
+        mc_reply(&req, rsp, MC_STATUS_EINVAL, 0);
+        return 0;
+    } else if ((req.op == MC_SET || req.op == MC_ADD || req.op == MC_REPLACE) && req.nvalue <= KKV_LARGE_MAX) {
+        ret = -ENOSPC;
+    } else {
+        ret = -E2BIG;
+    }
+    mc_reply(&req, rsp, mc_status(req.op, ret), 0);
+    return 0;
+}
+
+/*
+ * process the memcached request of len bytes at buf, and then put the responses into rsp,
+ * the kkv_packet requests it's translated into are built at pkt, which takes KKV_REQ_BUF_SIZE bytes.
+ * the values of gets are copied into rsp->buf, or sent from the item chains put in rsp->its.
+ * @return: 0, -EAGAIN if a get has to wait for an empty batch, or -ECONNRESET if the client quits.
+ */
+ssize_t mc_process_req(char *pkt, struct kkv_keyspace *ks, char *buf, ssize_t len, struct mc_rsp *rsp)
+{
+    struct mc_request req;
+
+    mc_parse(buf, len, &req);
+    if (req.binary)
+        return mc_process_binary(pkt, ks, &req, rsp);
+    return mc_process_text(pkt, ks, &req, rsp);
+}
@@ -0,0 +1,37 @@
+/*
+ * In-Kernel Key/Value Store.
+ *
+ * Copyright (C) 2013-2014 jilinxpd.
+ *
+ * This file is released under the GPL.
+ */
+
+#ifndef _KKV_MEMCACHED_H
+#define _KKV_MEMCACHED_H
+
+
+struct kkv_keyspace;
+
+struct item;
+
+/*
+ * where the responses to a memcached request go, in the batch of responses of its session.
+ */
+struct mc_rsp {
+    char *buf;//the responses are put here
+    ssize_t room;//# of bytes free at buf
+    ssize_t len;//# of bytes of the responses
+    struct item **its;//the item chains the values of gets are sent from, see kkv_process_req_pinned()
+    ssize_t *pos;//value i follows the first pos[i] bytes at buf
+    int nr;//# of them
+    int max;//# of them the batch can take
+    int retry;//whether a get that doesn't fit may wait for an empty batch
+};
+
+ssize_t mc_req_len(char *buf, ssize_t len, ssize_t *nlarge);
+struct item *mc_create_large(char *pkt, char *buf, ssize_t len);
+ssize_t mc_process_large(char *pkt, struct kkv_keyspace *ks, char *buf, ssize_t len, struct item *it, struct mc_rsp *rsp);
+ssize_t mc_process_req(char *pkt, struct kkv_keyspace *ks, char *buf, ssize_t len, struct mc_rsp *rsp);
+
+
+#endif
@@ -37,6 +37,10 @@ ssize_t total_freed_mem(void)
 
 #endif
 
+#ifdef DEBUG_KKV_BENCH
+void bench_itemx(void);
+#endif
+
 static int __init kkv_init(void)
 {
     int ret;
@@ -62,6 +66,9 @@ static int __init kkv_init(void)
     }
 #ifdef DEBUG_KKV_STAT
     printk("total used mem=%ld\n", total_used_mem());
+#endif
+#ifdef DEBUG_KKV_BENCH
+    bench_itemx();
 #endif
     ret = register_filesystem(&kkv_fs_type);
     if (ret < 0) {
@@ -0,0 +1,272 @@
+/*
+ * In-Kernel Key/Value Store.
+ *
+ * Copyright (C) 2013-2014 jilinxpd.
+ *
+ * This file is released under the GPL.
+ */
+
+#include <linux/types.h>
+#include <linux/kernel.h>
+#include <linux/errno.h>
+#include <linux/string.h>
+#include <linux/slab.h>
+#include <linux/jiffies.h>
+#include "kkv.h"
+#include "mvcc.h"
+
+/*
+ * a snapshot is a version taken from the sequence of the cas of the values:
+ * it reads every key at the latest version not newer than itself, so a client
+ * reading several keys at the same snapshot sees them as they were at one instant,
+ * while the writers go on updating them.
+ * a value replaced or deleted while a snapshot may still read it is moved into
+ * the old versions of the keyspace, together with the version replacing it,
+ * and a chain read by a snapshot is not modified in place, see itemx_writable().
+ * the old versions are dropped once no snapshot reads them any more,
+ * i.e. when the snapshots are released or expire.
+ * everything here is protected by the engine lock like the keys.
+ */
+
+//max # of snapshots of a keyspace held at once.
+#define MVCC_SNAPSHOT_MAX 64
+//a snapshot which hasn't been read for this long is dropped.
+#define MVCC_TIMEOUT (30 * HZ)
+//# of lists of the old versions, a power of 2.
+#define MVCC_NR 1024
+
+struct mvcc_version {
+    struct itemx itx; //the old value, linked by itx.next.
+    uint64_t end; //the version which replaced it.
+};
+
+struct kkv_mvcc {
+    uint64_t snap[MVCC_SNAPSHOT_MAX]; //0 if the slot is free.
+    unsigned long expires[MVCC_SNAPSHOT_MAX];
+    int nr_snapshots;
+    struct itemx *versions[MVCC_NR];
+};
+
+#define MVCC_VERSION(ptr) container_of(ptr, struct mvcc_version, itx)
+
+static void mvcc_free(struct itemx *itx)
+{
+    if (--itx->it->refcount == 0) {
+        unlink_item(itx->it);
+    }
+    kfree(MVCC_VERSION(itx));
+}
+
+/*
+ * whether a held snapshot reads the old version living from cas to end.
+ */
+static int mvcc_visible(struct kkv_mvcc *m, uint64_t cas, uint64_t end)
+{
+    int i;
+
+    for (i = 0; i < MVCC_SNAPSHOT_MAX; i++) {
+        if (m->snap[i] && m->snap[i] >= cas && m->snap[i] < end)
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * drop the old versions read by no snapshot any more.
+ */
+static void mvcc_prune(struct kkv_mvcc *m)
+{
+    struct itemx **pos, *itx;
+    int i;
+
+    for (i = 0; i < MVCC_NR; i++) {
+        pos = &m->versions[i];
+        while ((itx = *pos)) {
+            if (m->nr_snapshots && mvcc_visible(m, itx->cas, MVCC_VERSION(itx)->end)) {
+                pos = &itx->next;
+                continue;
+            }
+            *pos = itx->next;
+            mvcc_free(itx);
+        }
+    }
+}
+
+/*
+ * drop the snapshots which have expired.
+ */
+static void mvcc_expire(struct kkv_mvcc *m)
+{
+    int i, nr = 0;
+
+    for (i = 0; i < MVCC_SNAPSHOT_MAX; i++) {
+        if (m->snap[i] && time_after_eq(jiffies, m->expires[i])) {
+            m->snap[i] = 0;
+            m->nr_snapshots--;
+            nr++;
+        }
+    }
+    if (nr)
+        mvcc_prune(m);
+}
+
+/*
+ * take a snapshot of the keyspace.
+ * @return: 0 with the snapshot in *snap, -EBUSY if too many are held, or -ENOMEM.
+ */
+int mvcc_open(struct kkv_keyspace *ks, uint64_t *snap)
+{
+    struct kkv_mvcc *m;
+    int i;
+
+    if (!ks->mvcc) {
+        ks->mvcc = kzalloc(sizeof(struct kkv_mvcc), GFP_KERNEL);
+        if (!ks->mvcc)
+            return -ENOMEM;
+    }
+    m = ks->mvcc;
+
+    mvcc_expire(m);
+    for (i = 0; i < MVCC_SNAPSHOT_MAX; i++) {
+        if (!m->snap[i])
+            break;
+    }
+    if (i == MVCC_SNAPSHOT_MAX)
+        return -EBUSY;
+
+    m->snap[i] = next_cas();
+    m->expires[i] = jiffies + MVCC_TIMEOUT;
+    m->nr_snapshots++;
+    *snap = m->snap[i];
+    return 0;
+}
+
+static int mvcc_slot(struct kkv_mvcc *m, uint64_t snap)
+{
+    int i;
+
+    for (i = 0; i < MVCC_SNAPSHOT_MAX; i++) {
+        if (m->snap[i] == snap)
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * release the snapshot, dropping the old versions only it reads.
+ * @return: 0 on success, or -ENOENT if it isn't held.
+ */
+int mvcc_release(struct kkv_keyspace *ks, uint64_t snap)
+{
+    int i;
+
+    if (!ks->mvcc || !snap)
+        return -ENOENT;
+    i = mvcc_slot(ks->mvcc, snap);
+    if (i < 0)
+        return -ENOENT;
+
+    ks->mvcc->snap[i] = 0;
+    ks->mvcc->nr_snapshots--;
+    mvcc_prune(ks->mvcc);
+    return 0;
+}
+
+/*
+ * check that the snapshot is still held before reading at it, which keeps it from expiring.
+ * @return: 0 if it is held, or -ESTALE if it has been released or has expired.
+ */
+int mvcc_check(struct kkv_keyspace *ks, uint64_t snap)
+{
+    int i;
+
+    if (!ks->mvcc)
+        return -ESTALE;
+    mvcc_expire(ks->mvcc);
+    i = mvcc_slot(ks->mvcc, snap);
+    if (i < 0)
+        return -ESTALE;
+
+    ks->mvcc->expires[i] = jiffies + MVCC_TIMEOUT;
+    return 0;
+}
+
+/*
+ * whether a held snapshot reads the value of version cas, which is the latest one of its key.
+ */
+int mvcc_pinned(struct kkv_keyspace *ks, uint64_t cas)
+{
+    if (!ks->mvcc || !ks->mvcc->nr_snapshots)
+        return 0;
+    mvcc_expire(ks->mvcc);
+    return mvcc_visible(ks->mvcc, cas, (uint64_t) -1);
+}
+
+/*
+ * keep the value of the itemx, about to be replaced by version end or deleted,
+ * for the snapshots reading it. every snapshot is older than end.
+ * if the value can't be kept, those snapshots are dropped instead of reading a wrong value.
+ */
+void mvcc_keep(struct kkv_keyspace *ks, struct itemx *itx, uint64_t end)
+{
+    struct mvcc_version *v;
+    struct itemx **header;
+    int i;
+
+    if (!mvcc_pinned(ks, itx->cas))
+        return;
+
+    v = kmalloc(sizeof(struct mvcc_version), GFP_KERNEL);
+    if (!v) {
+#ifdef DEBUG_KKV_ENGINE
+        printk("kmalloc() failed in mvcc_keep()\n");
+#endif
+        for (i = 0; i < MVCC_SNAPSHOT_MAX; i++) {
+            if (ks->mvcc->snap[i] >= itx->cas) {
+                ks->mvcc->snap[i] = 0;
+                ks->mvcc->nr_snapshots--;
+            }
+        }
+        mvcc_prune(ks->mvcc);
+        return;
+    }
+
+    v->itx = *itx;
+    v->itx.it->refcount++;
+    v->end = end;
+    header = &ks->mvcc->versions[itx->key_md & (MVCC_NR - 1)];
+    v->itx.pre = NULL;
+    v->itx.next = *header;
+    *header = &v->itx;
+}
+
+/*
+ * find the version of the key read by the snapshot snap, itx being its latest version,
+ * or NULL if it is missing. a snapshot of 0 reads the latest version.
+ * @return: the itemx of the version, or NULL if the key was missing at the snapshot.
+ */
+struct itemx *mvcc_find(struct kkv_keyspace *ks, struct itemx *itx, uint32_t key_md, char *key, ssize_t nkey, uint64_t snap)
+{
+    struct itemx *cur;
+
+    if (!snap || (itx && itx->cas <= snap))
+        return itx;
+    if (!ks->mvcc)
+        return NULL;
+
+    for (cur = ks->mvcc->versions[key_md & (MVCC_NR - 1)]; cur; cur = cur->next) {
+        if (cur->key_md == key_md && cur->cas <= snap && snap < MVCC_VERSION(cur)->end && itemx_has_key(cur, key, nkey))
+            return cur;
+    }
+    return NULL;
+}
+
+void mvcc_destroy(struct kkv_keyspace *ks)
+{
+    if (!ks->mvcc)
+        return;
+    ks->mvcc->nr_snapshots = 0;
+    mvcc_prune(ks->mvcc);
+    kfree(ks->mvcc);
+    ks->mvcc = NULL;
+}
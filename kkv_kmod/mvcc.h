@@ -0,0 +1,22 @@
+/*
+ * In-Kernel Key/Value Store.
+ *
+ * Copyright (C) 2013-2014 jilinxpd.
+ *
+ * This file is released under the GPL.
+ */
+
+#ifndef _KKV_MVCC_H
+#define _KKV_MVCC_H
+
+
+int mvcc_open(struct kkv_keyspace *ks, uint64_t *snap);
+int mvcc_release(struct kkv_keyspace *ks, uint64_t snap);
+int mvcc_check(struct kkv_keyspace *ks, uint64_t snap);
+int mvcc_pinned(struct kkv_keyspace *ks, uint64_t cas);
+void mvcc_keep(struct kkv_keyspace *ks, struct itemx *itx, uint64_t end);
+struct itemx *mvcc_find(struct kkv_keyspace *ks, struct itemx *itx, uint32_t key_md, char *key, ssize_t nkey, uint64_t snap);
+void mvcc_destroy(struct kkv_keyspace *ks);
+
+
+#endif
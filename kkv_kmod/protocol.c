@@ -15,9 +15,13 @@
 #include <linux/aio.h>
 #include <linux/kernel.h>
 #include <linux/mutex.h>
+#include <linux/sched.h>
 #include <asm/atomic.h>
 #include "kkv.h"
+#include "hash.h"
 #include "server.h"
+#include "hotkey.h"
+#include "dedup.h"
 
 
 #define COMMAND_CONFIG 0
@@ -30,6 +34,49 @@
 #define COMMAND_SHRINK 15
 #define COMMAND_ACK 20
 #define COMMAND_NACK 21
+#define COMMAND_RETRY 22
+#define COMMAND_MGET 30
+#define COMMAND_MSET 31
+#define COMMAND_MDELETE 32
+#define COMMAND_INCR 33
+#define COMMAND_DECR 34
+#define COMMAND_APPEND 35
+#define COMMAND_PREPEND 36
+#define COMMAND_CAS 37
+#define COMMAND_GETRANGE 38
+#define COMMAND_SETRANGE 39
+#define COMMAND_MULTI 40
+#define COMMAND_STATS 41
+#define COMMAND_FLUSH 42
+#define COMMAND_HGET 43
+#define COMMAND_HSET 44
+#define COMMAND_HDEL 45
+#define COMMAND_HGETALL 46
+#define COMMAND_SETBIT 47
+#define COMMAND_GETBIT 48
+#define COMMAND_BITCOUNT 49
+#define COMMAND_BITOP 50
+#define COMMAND_PFADD 51
+#define COMMAND_PFCOUNT 52
+#define COMMAND_PFMERGE 53
+#define COMMAND_LGET 54
+#define COMMAND_LSET 55
+#define COMMAND_DELETE_PREFIX 56
+#define COMMAND_SNAPSHOT 57
+#define COMMAND_RELEASE 58
+#define COMMAND_NOOP 59
+
+//the stats groups, named by the key part of a stats request.
+#define KKV_STATS_HOTKEYS "hotkeys"
+#define KKV_STATS_KEYSPACE "keyspace"
+#define KKV_STATS_DEDUP "dedup"
+
+//the flags of a request packet.
+#define KKV_FLAG_HASH 0x1 //the hash field holds key_hash() of the key.
+#define KKV_FLAG_ASYNC 0x2 //the response may be sent after those of the requests behind it, matched by id.
+#define KKV_FLAG_QUIET 0x4 //no response to a set, add, replace or delete unless it fails.
+#define KKV_FLAG_NOREPLY 0x8 //no response to a set, add, replace or delete at all.
+#define KKV_FLAG_CLIENT 0x10 //the hash field holds the client flags stored with the value, and read back by a get, not with KKV_FLAG_HASH.
 
 
 typedef struct {
@@ -37,15 +84,79 @@ typedef struct {
     __u32 command;
     __u32 key_len;
     __u32 value_len;
+    __u64 cas;
+    __u32 hash;
+    __u32 flags;
     char data[0];
 } kkv_packet;
 
+/*
+ * one key in the key part of a multi-key packet,
+ * the key is padded to 4 bytes so the next kkv_mkey stays aligned.
+ */
+typedef struct {
+    __u32 key_len;
+    char key[0];
+} kkv_mkey;
+
+/*
+ * one key/value pair in the key part of a multi-key packet,
+ * the key and the value are both padded to 4 bytes.
+ */
+typedef struct {
+    __u32 key_len;
+    __u32 value_len;
+    char data[0];
+} kkv_mkv;
+
+/*
+ * one operation in the key part of a multi request, command is one of
+ * COMMAND_SET, COMMAND_ADD, COMMAND_REPLACE and COMMAND_DELETE.
+ * the key and the value are both padded to 4 bytes.
+ */
+typedef struct {
+    __u32 command;
+    __u32 key_len;
+    __u32 value_len;
+    char data[0];
+} kkv_mop;
+
+/*
+ * the value part of a getrange request,
+ * or the head of the value part of a setrange request followed by the bytes to write.
+ */
+typedef struct {
+    __u32 offset;
+    __u32 length;
+} kkv_range;
+
+/*
+ * the value part of a setbit request.
+ */
+typedef struct {
+    __u64 offset;
+    __u64 bit;
+} kkv_bit;
+
+/*
+ * the value part of a stats response for the keyspace.
+ */
+typedef struct {
+    __u64 nr_items;
+    __u64 mem;
+} kkv_keyspace_stats;
+
 struct kkv_request {
+    __u32 id;
     __u32 command;
     char *key;
     ssize_t nkey;
     char *value;
     ssize_t nvalue;
+    __u64 cas;
+    __u32 flags;
+    __u32 key_md;
+    __u32 client_flags; //see KKV_FLAG_CLIENT.
 };
 
 static struct mutex engine_lock;
@@ -53,16 +164,35 @@ static struct mutex engine_lock;
 void init_protocol(void){
 
 	mutex_init(&engine_lock);
+	init_hotkey();
+
+}
 
+
+void kkv_get_keyspace(struct kkv_keyspace *ks)
+{
+    atomic_inc(&ks->refcount);
 }
 
+/*
+ * the keyspace is destroyed with its last reference,
+ * under engine_lock since its items go back to the slab allocator.
+ */
+void kkv_put_keyspace(struct kkv_keyspace *ks)
+{
+    if (atomic_dec_and_test(&ks->refcount)) {
+        mutex_lock(&engine_lock);
+        destroy_keyspace(ks);
+        mutex_unlock(&engine_lock);
+    }
+}
 
-static int kkv_process_network(void *conf, int init)
+static int kkv_process_network(struct kkv_keyspace *ks, void *conf, int init)
 {
     int ret=0;
 
     if(init) {
-        ret=init_server(conf);
+        ret=init_server(conf, ks);
 #ifdef DEBUG_KKV_ENGINE
         printk("init_server=%d\n",ret);
 #endif
@@ -82,41 +212,668 @@ static int kkv_parse_req(char *req_buf, ssize_t max_len, struct kkv_request *req
     kkv_packet *pk;
 
     pk=(kkv_packet*)req_buf;
+    req->id=pk->id;
     req->command=pk->command;
     req->nkey=pk->key_len;
     req->nvalue=pk->value_len ? pk->value_len : (max_len-sizeof(kkv_packet)-req->nkey);
     req->key=req_buf+sizeof(kkv_packet);
     req->value=req->key+req->nkey;
+    req->cas=pk->cas;
+    req->flags=pk->flags;
+    req->key_md=pk->hash;
+    req->client_flags=(pk->flags & KKV_FLAG_CLIENT) ? pk->hash : 0;
+    //the hash field holds either the hash of the key or the client flags, so a request claiming both is refused.
+    if ((pk->flags & KKV_FLAG_HASH) && (pk->flags & KKV_FLAG_CLIENT))
+        req->command=COMMAND_NACK;
 
     return 0;
 }
 
+/*
+ * fetch the kkv_mkey at pos.
+ * @return: the position of the next kkv_mkey, or NULL if there's no more.
+ */
+static char *kkv_next_mkey(char *pos, char *end, char **key, ssize_t *nkey)
+{
+    kkv_mkey *mk;
+
+    if (pos + sizeof(kkv_mkey) > end)
+        return NULL;
+
+    mk=(kkv_mkey*)pos;
+    if (mk->key_len > end - pos - sizeof(kkv_mkey))
+        return NULL;
+
+    *key=mk->key;
+    *nkey=mk->key_len;
+    return pos + sizeof(kkv_mkey) + PADDED_KEY_SIZE(mk->key_len);
+}
+
+/*
+ * locate the key and the value of the record at pos, whose header of nhdr bytes is already checked
+ * to be within end and holds their lengths. the key is padded to 4 bytes, and so is the value,
+ * except that the padding of the last value may be left out.
+ * the lengths come from the client, so they're summed in 64 bits, where padding can't wrap them to 0.
+ * @return: the position of the next record, or NULL if the record runs past end.
+ */
+static char *kkv_next_record(char *pos, char *end, ssize_t nhdr, __u32 key_len, __u32 value_len, char **key, char **value)
+{
+    __u64 nkey=PADDED_KEY_SIZE((__u64)key_len);
+
+    if (nkey + value_len > (__u64)(end - pos - nhdr))
+        return NULL;
+
+    *key=pos+nhdr;
+    *value=*key+nkey;
+    if (PADDED_KEY_SIZE((__u64)value_len) > end - *value)
+        return end;
+    return *value + PADDED_KEY_SIZE((__u64)value_len);
+}
+
+/*
+ * fetch the kkv_mkv at pos.
+ * @return: the position of the next kkv_mkv, or NULL if there's no more.
+ */
+static char *kkv_next_mkv(char *pos, char *end, char **key, ssize_t *nkey, char **value, ssize_t *nvalue)
+{
+    kkv_mkv *mkv;
+
+    if (pos + sizeof(kkv_mkv) > end)
+        return NULL;
+
+    mkv=(kkv_mkv*)pos;
+    pos=kkv_next_record(pos, end, sizeof(kkv_mkv), mkv->key_len, mkv->value_len, key, value);
+    if (!pos)
+        return NULL;
+
+    *nkey=mkv->key_len;
+    *nvalue=mkv->value_len;
+    return pos;
+}
+
+/*
+ * the key part of the request is a list of kkv_mkey, read at the snapshot in the cas if not 0.
+ * the value part of the response is the __s32 length of each value,
+ * negative if the key is not found, followed by the found values back to back.
+ * @return: the length of the value part of the response.
+ */
+static ssize_t kkv_process_mget(struct kkv_keyspace *ks, struct kkv_request *req)
+{
+    char *key[KKV_MGET_BATCH];
+    ssize_t nkey[KKV_MGET_BATCH];
+    ssize_t nvalue[KKV_MGET_BATCH];
+    char *pos, *end, *value;
+    __s32 *lens;
+    ssize_t nr, len, max, ret;
+    int i, n;
+
+    nr=0;
+    end=req->key+req->nkey;
+    for (pos=req->key; (pos=kkv_next_mkey(pos, end, key, nkey)); nr++)
+        hotkey_access(key[0], nkey[0]);
+
+    lens=(__s32*)req->value;
+    value=req->value+nr*sizeof(__s32);
+    max=req->nvalue-nr*sizeof(__s32);
+    if (max < 0)
+        return -ENOSPC;
+
+    len=0;
+    pos=req->key;
+    mutex_lock(&engine_lock);
+    while (nr > 0) {
+        for (n=0; n < KKV_MGET_BATCH && n < nr; n++)
+            pos=kkv_next_mkey(pos, end, &key[n], &nkey[n]);
+        ret=engine_mget(ks, key, nkey, nvalue, n, value+len, max-len, req->cas);
+        if (ret < 0) {
+            mutex_unlock(&engine_lock);
+            return ret;
+        }
+        len+=ret;
+        for (i=0; i < n; i++)
+            *lens++=nvalue[i];
+        nr-=n;
+    }
+    mutex_unlock(&engine_lock);
+
+    return (char*)lens-req->value+len;
+}
+
+/*
+ * the key part of the request is a list of kkv_mkv for mset,
+ * or a list of kkv_mkey for mdelete.
+ * the value part of the response is the __s32 result of each operation,
+ * 0 on success or a negative error.
+ * @return: the length of the value part of the response.
+ */
+static ssize_t kkv_process_mupdate(struct kkv_keyspace *ks, struct kkv_request *req)
+{
+    char *key, *value;
+    ssize_t nkey, nvalue;
+    char *pos, *end;
+    __s32 *results;
+    ssize_t nr;
+
+    nr=0;
+    end=req->key+req->nkey;
+    pos=req->key;
+    while (pos) {
+        if (req->command == COMMAND_MSET)
+            pos=kkv_next_mkv(pos, end, &key, &nkey, &value, &nvalue);
+        else
+            pos=kkv_next_mkey(pos, end, &key, &nkey);
+        if (pos) {
+            hotkey_access(key, nkey);
+            nr++;
+        }
+    }
+
+    if (req->nvalue < (ssize_t)(nr*sizeof(__s32)))
+        return -ENOSPC;
+
+    results=(__s32*)req->value;
+    pos=req->key;
+    mutex_lock(&engine_lock);
+    while (nr-- > 0) {
+        if (req->command == COMMAND_MSET) {
+            pos=kkv_next_mkv(pos, end, &key, &nkey, &value, &nvalue);
+            *results++=engine_set(ks, key, nkey, value, nvalue);
+        } else {
+            pos=kkv_next_mkey(pos, end, &key, &nkey);
+            *results++=engine_delete(ks, key, nkey);
+        }
+    }
+    mutex_unlock(&engine_lock);
+
+    return (char*)results-req->value;
+}
+
+/*
+ * fetch the kkv_mop at pos into op.
+ * @return: the position of the next kkv_mop, or NULL if it's malformed.
+ */
+static char *kkv_next_mop(char *pos, char *end, struct kkv_op *op)
+{
+    kkv_mop *mop;
+    char *next;
+
+    if (pos + sizeof(kkv_mop) > end)
+        return NULL;
+
+    mop=(kkv_mop*)pos;
+    next=kkv_next_record(pos, end, sizeof(kkv_mop), mop->key_len, mop->value_len, &op->key, &op->value);
+    if (!next)
+        return NULL;
+
+    switch (mop->command) {
+    case COMMAND_SET:
+        op->op=KKV_OP_SET;
+        break;
+    case COMMAND_ADD:
+        op->op=KKV_OP_ADD;
+        break;
+    case COMMAND_REPLACE:
+        op->op=KKV_OP_REPLACE;
+        break;
+    case COMMAND_DELETE:
+        op->op=KKV_OP_DELETE;
+        break;
+    default:
+        return NULL;
+    }
+
+    op->nkey=mop->key_len;
+    op->nvalue=mop->value_len;
+    return next;
+}
+
+/*
+ * the key part of the request is a list of kkv_mop, applied all or nothing.
+ * the value part of the response is the __s32 result of each operation, see engine_multi().
+ * req->nvalue is set to the length of the value part of the response,
+ * which is 0 if the request is rejected before reaching the engine.
+ * @return: 0 if the batch is applied, or a negative error.
+ */
+static ssize_t kkv_process_multi(struct kkv_keyspace *ks, struct kkv_request *req)
+{
+    struct kkv_op op, *ops;
+    char *pos, *end;
+    __s32 *results;
+    ssize_t ret, max;
+    int nr, i;
+
+    max=req->nvalue;
+    req->nvalue=0;
+
+    nr=0;
+    end=req->key+req->nkey;
+    for (pos=req->key; pos && pos < end; nr++) {
+        pos=kkv_next_mop(pos, end, &op);
+        if (pos)
+            hotkey_access(op.key, op.nkey);
+    }
+    if (!pos || nr == 0 || nr > KKV_MULTI_MAX)
+        return -EINVAL;
+    if (max < (ssize_t)(nr*sizeof(__s32)))
+        return -ENOSPC;
+
+    ops=kmalloc(nr*sizeof(struct kkv_op), GFP_KERNEL);
+    if (!ops)
+        return -ENOMEM;
+    pos=req->key;
+    for (i=0; i < nr; i++)
+        pos=kkv_next_mop(pos, end, &ops[i]);
+
+    mutex_lock(&engine_lock);
+    ret=engine_multi(ks, ops, nr);
+    mutex_unlock(&engine_lock);
+
+    results=(__s32*)req->value;
+    for (i=0; i < nr; i++)
+        results[i]=ops[i].ret;
+    kfree(ops);
+
+    req->nvalue=nr*sizeof(__s32);
+    return ret;
+}
+
+/*
+ * fetch the keys from the list of kkv_mkey in the key part of the request,
+ * and sample them for the hot-key tracker.
+ * @return: the # of keys, or -EINVAL if the list is malformed or has more than max keys.
+ */
+static int kkv_parse_mkeys(struct kkv_request *req, char **key, ssize_t *nkey, int max)
+{
+    char *pos, *end;
+    int nr;
+
+    nr=0;
+    end=req->key+req->nkey;
+    for (pos=req->key; pos < end && nr < max; nr++) {
+        pos=kkv_next_mkey(pos, end, &key[nr], &nkey[nr]);
+        if (!pos)
+            return -EINVAL;
+        hotkey_access(key[nr], nkey[nr]);
+    }
+    if (pos < end)
+        return -EINVAL;
+    return nr;
+}
+
+/*
+ * the key part of the request is a list of kkv_mkey, the destination key
+ * followed by the source keys, and the value part is the __u32 op.
+ * @return: 0 with the length of the result in *len, or a negative error.
+ */
+static ssize_t kkv_process_bitop(struct kkv_keyspace *ks, struct kkv_request *req, __u64 *len)
+{
+    char *key[KKV_BITOP_MAX + 1];
+    ssize_t nkey[KKV_BITOP_MAX + 1];
+    __u32 op;
+    ssize_t ret;
+    int nr;
+
+    if (req->nvalue < sizeof(__u32))
+        return -EINVAL;
+    memcpy(&op, req->value, sizeof(__u32));
+
+    nr=kkv_parse_mkeys(req, key, nkey, KKV_BITOP_MAX + 1);
+    if (nr < 2)
+        return -EINVAL;
+
+    mutex_lock(&engine_lock);
+    ret=engine_bitop(ks, op, key[0], nkey[0], key+1, nkey+1, nr-1, len);
+    mutex_unlock(&engine_lock);
+    return ret;
+}
+
+/*
+ * the key part of the request is a list of kkv_mkey, the HyperLogLog key
+ * followed by the elements, which are added under the lock in batches.
+ * @return: 0 with *changed set to whether the registers changed, or a negative error.
+ */
+static ssize_t kkv_process_pfadd(struct kkv_keyspace *ks, struct kkv_request *req, __u64 *changed)
+{
+    char *elem[KKV_HLL_BATCH];
+    ssize_t nelem[KKV_HLL_BATCH];
+    char *key, *pos, *end, *p;
+    ssize_t nkey, ret;
+    uint64_t c;
+    int n;
+
+    end=req->key+req->nkey;
+    pos=kkv_next_mkey(req->key, end, &key, &nkey);
+    if (!pos)
+        return -EINVAL;
+    hotkey_access(key, nkey);
+    //check the whole list first, so that a malformed request adds nothing.
+    for (p=pos; p < end; ) {
+        p=kkv_next_mkey(p, end, &elem[0], &nelem[0]);
+        if (!p)
+            return -EINVAL;
+    }
+
+    *changed=0;
+    mutex_lock(&engine_lock);
+    do {
+        for (n=0; n < KKV_HLL_BATCH && pos < end; n++)
+            pos=kkv_next_mkey(pos, end, &elem[n], &nelem[n]);
+        c=0;
+        ret=engine_pfadd(ks, key, nkey, elem, nelem, n, &c);
+        *changed|=c;
+    } while (!ret && pos < end);
+    mutex_unlock(&engine_lock);
+    return ret;
+}
+
+/*
+ * the key part of the request is a list of kkv_mkey:
+ * the keys to count for PFCOUNT, or the destination key followed by the source keys for PFMERGE.
+ * @return: 0 with the estimated cardinality in *count, or a negative error.
+ */
+static ssize_t kkv_process_pfcount(struct kkv_keyspace *ks, struct kkv_request *req, __u64 *count)
+{
+    char *key[KKV_HLL_MAX + 1];
+    ssize_t nkey[KKV_HLL_MAX + 1];
+    uint64_t c;
+    ssize_t ret;
+    int nr;
+
+    nr=kkv_parse_mkeys(req, key, nkey, KKV_HLL_MAX + 1);
+    if (nr < 1 || (req->command == COMMAND_PFCOUNT && nr > KKV_HLL_MAX))
+        return -EINVAL;
+
+    mutex_lock(&engine_lock);
+    if (req->command == COMMAND_PFCOUNT)
+        ret=engine_pfcount(ks, key, nkey, nr, &c);
+    else
+        ret=engine_pfmerge(ks, key[0], nkey[0], key+1, nkey+1, nr-1, &c);
+    mutex_unlock(&engine_lock);
+    if (!ret)
+        *count=c;
+    return ret;
+}
+
+/*
+ * the key part of the request is the prefix.
+ * the index is walked in batches, and the lock is released between them,
+ * so the other requests aren't held up, keys added meanwhile may be missed.
+ * @return: 0 with the # of keys deleted in *nr, or a negative error.
+ */
+static ssize_t kkv_process_delete_prefix(struct kkv_keyspace *ks, struct kkv_request *req, __u64 *nr)
+{
+    uint64_t cursor=0;
+    ssize_t ret;
+
+    *nr=0;
+    do {
+        mutex_lock(&engine_lock);
+        ret=engine_delete_prefix(ks, req->key, req->nkey, &cursor, nr);
+        mutex_unlock(&engine_lock);
+        cond_resched();
+    } while (!ret && cursor);
+    return ret;
+}
+
+/*
+ * the key part of the request names the stats group.
+ * the key isn't echoed, so that the value part of the response stays aligned.
+ * @return: the length of the value part of the response.
+ */
+static ssize_t kkv_process_stats(struct kkv_keyspace *ks, struct kkv_request *req)
+{
+    kkv_keyspace_stats *kss;
+    char *value=req->key;
+    ssize_t max=req->nkey+req->nvalue;
+    ssize_t ret=-EINVAL;
+
+    if (req->nkey == strlen(KKV_STATS_HOTKEYS) && !memcmp(req->key, KKV_STATS_HOTKEYS, req->nkey)) {
+        ret=hotkey_stats(value, max);
+    } else if (req->nkey == strlen(KKV_STATS_KEYSPACE) && !memcmp(req->key, KKV_STATS_KEYSPACE, req->nkey)) {
+        kss=(kkv_keyspace_stats*)value;
+        mutex_lock(&engine_lock);
+        kss->nr_items=ks->nr_items;
+        kss->mem=ks->mem;
+        mutex_unlock(&engine_lock);
+        ret=sizeof(kkv_keyspace_stats);
+    } else if (req->nkey == strlen(KKV_STATS_DEDUP) && !memcmp(req->key, KKV_STATS_DEDUP, req->nkey)) {
+        mutex_lock(&engine_lock);
+        ret=dedup_stats(value, max);
+        mutex_unlock(&engine_lock);
+    }
+
+    if (ret >= 0) {
+        req->key=NULL;
+        req->nkey=0;
+        req->value=value;
+    }
+    return ret;
+}
+
+/*
+ * whether the command accesses the single key in its key part.
+ */
+static int kkv_single_key(__u32 command)
+{
+    switch (command) {
+    case COMMAND_GET:
+    case COMMAND_SET:
+    case COMMAND_ADD:
+    case COMMAND_REPLACE:
+    case COMMAND_DELETE:
+    case COMMAND_INCR:
+    case COMMAND_DECR:
+    case COMMAND_APPEND:
+    case COMMAND_PREPEND:
+    case COMMAND_CAS:
+    case COMMAND_GETRANGE:
+    case COMMAND_SETRANGE:
+    case COMMAND_HGET:
+    case COMMAND_HSET:
+    case COMMAND_HDEL:
+    case COMMAND_HGETALL:
+    case COMMAND_SETBIT:
+    case COMMAND_GETBIT:
+    case COMMAND_BITCOUNT:
+    case COMMAND_LGET:
+    case COMMAND_LSET:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/*
+ * take engine_lock for the request,
+ * and hand the hash of its key, or the client flags to store, to the engine if the client supplied it.
+ */
+static void kkv_lock(struct kkv_request *req)
+{
+    mutex_lock(&engine_lock);
+    if ((req->flags & KKV_FLAG_HASH) && kkv_single_key(req->command))
+        engine_hint(req->key, req->key_md);
+    else if ((req->flags & KKV_FLAG_CLIENT) && kkv_single_key(req->command))
+        engine_hint_flags(req->client_flags);
+}
+
+static void kkv_unlock(void)
+{
+    engine_hint(NULL, 0);
+    engine_hint_flags(0);
+    mutex_unlock(&engine_lock);
+}
+
+#ifdef DEBUG_KKV_HASH
+/*
+ * a wrong hash files the key under another bucket, so the request is refused as unknown.
+ */
+static void kkv_check_hash(struct kkv_request *req)
+{
+    if ((req->flags & KKV_FLAG_HASH) && kkv_single_key(req->command) && req->key_md != key_hash(req->key, req->nkey)) {
+        printk("bad key hash %u in command %d\n", req->key_md, req->command);
+        req->command = COMMAND_NACK;
+    }
+}
+#endif
+
 static ssize_t kkv_create_rsp(char *rsp_buf, struct kkv_request *req)
 {
     ssize_t len;
     kkv_packet *pk;
     pk=(kkv_packet*)rsp_buf;
+    pk->id=req->id;
     pk->command=req->command;
     pk->key_len=req->nkey;
     pk->value_len=req->nvalue;
+    pk->cas=req->cas;
+    pk->hash=req->client_flags;
+    pk->flags=0;
     len=sizeof(kkv_packet)+req->nkey+req->nvalue;
 
     return len;
 }
 
+/*
+ * whether the command stores the value part as the value of the key.
+ */
+static int kkv_store_command(__u32 command)
+{
+    return command == COMMAND_SET || command == COMMAND_ADD || command == COMMAND_REPLACE;
+}
+
+/*
+ * whether the response to the request, whose result is ret, is left out.
+ * quiet requests are followed by a COMMAND_NOOP, whose response tells they're all done.
+ */
+static int kkv_quiet(struct kkv_request *req, ssize_t ret)
+{
+    if (!(req->flags & (KKV_FLAG_QUIET | KKV_FLAG_NOREPLY)))
+        return 0;
+    if (!kkv_store_command(req->command) && req->command != COMMAND_DELETE)
+        return 0;
+    return (req->flags & KKV_FLAG_NOREPLY) || ret >= 0;
+}
+
+/*
+ * the length of the part of the request packet at buf held in the request buffer,
+ * of which len bytes have arrived.
+ * a value of at least KKV_LARGE_VALUE bytes to store is left out, and its length is put in *nlarge,
+ * which is 0 otherwise, see kkv_create_large().
+ * @return: the length, 0 if the header hasn't arrived yet,
+ * or -EINVAL if it can't fit in a request buffer.
+ */
+ssize_t kkv_req_len(char *buf, ssize_t len, ssize_t *nlarge)
+{
+    kkv_packet *pk=(kkv_packet*)buf;
+    ssize_t n;
+
+    *nlarge=0;
+    if (len < (ssize_t)sizeof(kkv_packet))
+        return 0;
+    n=sizeof(kkv_packet)+(ssize_t)pk->key_len;
+    if (kkv_store_command(pk->command) && pk->value_len >= KKV_LARGE_VALUE)
+        *nlarge=pk->value_len;
+    else
+        n+=pk->value_len;
+    if (n > KKV_REQ_BUF_SIZE)
+        return -EINVAL;
+    return n;
+}
+
+/*
+ * whether the response to the request at buf may be sent out of order, see KKV_FLAG_ASYNC.
+ */
+int kkv_req_async(char *buf)
+{
+    kkv_packet *pk=(kkv_packet*)buf;
+
+    return (pk->flags & KKV_FLAG_ASYNC) != 0;
+}
+
+/*
+ * create the item chain of the key of the request at buf with room for its large value,
+ * into which the value is received in place, see kkv_req_len().
+ * @return: the chain, or NULL if no memory or the value is too large.
+ */
+struct item *kkv_create_large(char *buf)
+{
+    kkv_packet *pk=(kkv_packet*)buf;
+    struct item *it;
+
+    if (pk->value_len > KKV_LARGE_MAX)
+        return NULL;
+
+    mutex_lock(&engine_lock);
+    it=create_item_raw(pk->data, pk->key_len, pk->value_len);
+    mutex_unlock(&engine_lock);
+    return it;
+}
+
+/*
+ * store the chain it holding the large value of the request in io_buf,
+ * the value is lost if it is NULL, and then put the response packet into io_buf.
+ * @return: 0 if stored, or a negative error.
+ */
+ssize_t kkv_process_large(struct kkv_keyspace *ks, char *io_buf, struct item *it, ssize_t *rsp_len)
+{
+    struct kkv_request req;
+    ssize_t ret;
+
+    kkv_parse_req(io_buf, KKV_REQ_BUF_SIZE, &req);
+#ifdef DEBUG_KKV_HASH
+    kkv_check_hash(&req);
+#endif
+    hotkey_access(req.key, req.nkey);
+
+    ret=-ENOSPC;
+    kkv_lock(&req);
+    if (it && kkv_store_command(req.command)) {
+        if (req.command == COMMAND_ADD)
+            ret=engine_store_item(ks, req.key, req.nkey, it, KKV_OP_ADD);
+        else if (req.command == COMMAND_REPLACE)
+            ret=engine_store_item(ks, req.key, req.nkey, it, KKV_OP_REPLACE);
+        else
+            ret=engine_store_item(ks, req.key, req.nkey, it, KKV_OP_SET);
+    } else if (it) {
+        unlink_item(it);
+        ret=-EINVAL;
+    }
+    kkv_unlock();
+
+    if (kkv_quiet(&req, ret)) {
+        *rsp_len=0;
+        return ret;
+    }
+    req.command=ret < 0 ? COMMAND_NACK : COMMAND_ACK;
+    req.nkey=0;
+    req.nvalue=0;
+    req.cas=0;
+    *rsp_len=kkv_create_rsp(io_buf,&req);
+    return ret;
+}
+
 /*
  * process the request packet in io_buf, and then put the response packet into io_buf.
  * @return: indicates whether the response packet contains payload or not
  */
-ssize_t kkv_process_req(char *io_buf, ssize_t max_len, ssize_t *rsp_len)
+ssize_t kkv_process_req(struct kkv_keyspace *ks, char *io_buf, ssize_t max_len, ssize_t *rsp_len)
 {
     ssize_t ret;
+    ssize_t len;
+    __u64 num;
+    __u32 flags;
+    kkv_range range;
+    kkv_bit bit;
+    kkv_mkv mkv;
+    char *field, *value;
     struct kkv_request req= {
+        .id=0,
         .command=0,
         .nkey=0,
         .key=0,
         .nvalue=0,
-        .value=0
+        .value=0,
+        .cas=0
     };
 
     ret = kkv_parse_req(io_buf, max_len,&req);
@@ -134,23 +891,256 @@ ssize_t kkv_process_req(char *io_buf, ssize_t max_len, ssize_t *rsp_len)
         printk("the value is: %s\n", req.value);
 #endif
 
+#ifdef DEBUG_KKV_HASH
+    kkv_check_hash(&req);
+#endif
+
+    if (kkv_single_key(req.command))
+        hotkey_access(req.key, req.nkey);
+
     ret = -EINVAL;
     switch (req.command) {
     case COMMAND_CONFIG:
-        ret=kkv_process_network(req.value,1);
+        ret=kkv_process_network(ks,req.value,1);
         break;
 
     case COMMAND_DECONFIG:
-        ret=kkv_process_network(0,0);
+        ret=kkv_process_network(ks,0,0);
         break;
 
     case COMMAND_GET:
-		mutex_lock(&engine_lock);
-        ret = engine_get(req.key, req.nkey, req.value, req.nvalue);
-		mutex_unlock(&engine_lock);
+        //a cas in the request is the snapshot to read at.
+		kkv_lock(&req);
+        ret = engine_get(ks, req.key, req.nkey, req.value, req.nvalue, req.cas, &req.cas, &flags);
+		kkv_unlock();
         if (ret > 0) {
             req.command=COMMAND_ACK;
             req.nvalue=ret;
+            if (req.flags & KKV_FLAG_CLIENT)
+                req.client_flags=flags;
+        } else if (ret == -ESTALE) {
+            goto stale;
+        } else {
+            req.command=COMMAND_NACK;
+            req.nvalue=0;
+            req.cas=0;
+        }
+        goto rsp;
+
+    case COMMAND_SNAPSHOT:
+		kkv_lock(&req);
+        ret = engine_snapshot(ks, &req.cas);
+		kkv_unlock();
+        //the snapshot is carried in the header.
+        if (ret != 0)
+            break;
+        req.command=COMMAND_ACK;
+        ret = sizeof(kkv_packet);
+        req.nkey=0;
+        req.nvalue=0;
+        goto rsp;
+
+    case COMMAND_RELEASE:
+		kkv_lock(&req);
+        ret = engine_release(ks, req.cas);
+		kkv_unlock();
+        break;
+
+    case COMMAND_LGET:
+		kkv_lock(&req);
+        ret = engine_lget(ks, req.key, req.nkey, req.value, req.nvalue, &req.cas);
+		kkv_unlock();
+        //a miss carries the lease token, or 0 if none was handed out, in the header,
+        //and a client missing the key while another one holds the lease is told to retry.
+        if (ret >= 0) {
+            req.command=COMMAND_ACK;
+            req.nvalue=ret;
+            ret=sizeof(kkv_packet)+req.nkey+req.nvalue;
+            goto rsp;
+        } else if (ret == -ENOENT) {
+            req.command=COMMAND_NACK;
+        } else if (ret == -EAGAIN) {
+            req.command=COMMAND_RETRY;
+            req.cas=0;
+        } else {
+            break;
+        }
+        ret = sizeof(kkv_packet);
+        req.nkey=0;
+        req.nvalue=0;
+        goto rsp;
+
+    case COMMAND_LSET:
+		kkv_lock(&req);
+        ret = engine_lset(ks, req.key, req.nkey, req.value, req.nvalue, req.cas);
+		kkv_unlock();
+        //a stale lease is told apart from a failure to store the value by echoing the token.
+        if (ret == -ESTALE) {
+            req.command=COMMAND_NACK;
+            ret = sizeof(kkv_packet);
+            req.nkey=0;
+            req.nvalue=0;
+            goto rsp;
+        }
+        break;
+
+    case COMMAND_GETRANGE:
+        ret = -EINVAL;
+        if (req.nvalue == sizeof(kkv_range)) {
+            memcpy(&range, req.value, sizeof(kkv_range));
+            len = io_buf + max_len - req.value;
+            if (range.length < len)
+                len = range.length;
+            kkv_lock(&req);
+            ret = engine_getrange(ks, req.key, req.nkey, range.offset, req.value, len, &req.cas);
+            kkv_unlock();
+        }
+        if (ret >= 0) {
+            req.command=COMMAND_ACK;
+            req.nvalue=ret;
+        } else {
+            req.command=COMMAND_NACK;
+            req.nvalue=0;
+        }
+        goto rsp;
+
+    case COMMAND_HGET:
+        //the value of the field is read over the field itself.
+        len = io_buf + max_len - req.value;
+        kkv_lock(&req);
+        ret = engine_hget(ks, req.key, req.nkey, req.value, req.nvalue, req.value, len, &req.cas);
+        kkv_unlock();
+        if (ret >= 0) {
+            req.command=COMMAND_ACK;
+            req.nvalue=ret;
+        } else {
+            req.command=COMMAND_NACK;
+            req.nvalue=0;
+        }
+        goto rsp;
+
+    case COMMAND_HGETALL:
+        //the fields are packed over the key, which isn't echoed, so that they stay aligned.
+        len = io_buf + max_len - req.key;
+        kkv_lock(&req);
+        ret = engine_hgetall(ks, req.key, req.nkey, req.key, len, &req.cas);
+        kkv_unlock();
+        req.nkey=0;
+        if (ret >= 0) {
+            req.command=COMMAND_ACK;
+            req.nvalue=ret;
+        } else {
+            req.command=COMMAND_NACK;
+            req.nvalue=0;
+        }
+        goto rsp;
+
+    case COMMAND_MGET:
+    case COMMAND_MSET:
+    case COMMAND_MDELETE:
+        if (req.command == COMMAND_MGET)
+            ret = kkv_process_mget(ks, &req);
+        else
+            ret = kkv_process_mupdate(ks, &req);
+        if (ret == -ESTALE)
+            goto stale;
+        if (ret >= 0) {
+            req.command=COMMAND_ACK;
+            req.nvalue=ret;
+        } else {
+            req.command=COMMAND_NACK;
+            req.nvalue=0;
+        }
+        goto rsp;
+
+    case COMMAND_STATS:
+        ret = kkv_process_stats(ks, &req);
+        if (ret >= 0) {
+            req.command=COMMAND_ACK;
+            req.nvalue=ret;
+        } else {
+            req.command=COMMAND_NACK;
+            req.nvalue=0;
+        }
+        goto rsp;
+
+    case COMMAND_MULTI:
+        ret = kkv_process_multi(ks, &req);
+        req.command = ret == 0 ? COMMAND_ACK : COMMAND_NACK;
+        //the results tell which op aborted the batch.
+        if (req.nvalue > 0)
+            ret = req.nvalue;
+        goto rsp;
+
+    case COMMAND_INCR:
+    case COMMAND_DECR:
+        ret = -EINVAL;
+        if (req.nvalue == sizeof(__u64)) {
+            memcpy(&num, req.value, sizeof(__u64));
+            kkv_lock(&req);
+            ret = engine_incr(ks, req.key, req.nkey, num, req.command == COMMAND_INCR, &num);
+            kkv_unlock();
+        }
+        if (ret == 0) {
+            memcpy(req.value, &num, sizeof(__u64));
+            ret = sizeof(__u64);
+            req.command=COMMAND_ACK;
+            req.nvalue=ret;
+        } else {
+            req.command=COMMAND_NACK;
+            req.nvalue=0;
+        }
+        goto rsp;
+
+    case COMMAND_SETBIT:
+    case COMMAND_GETBIT:
+    case COMMAND_BITCOUNT:
+    case COMMAND_BITOP:
+    case COMMAND_PFADD:
+    case COMMAND_PFCOUNT:
+    case COMMAND_PFMERGE:
+    case COMMAND_DELETE_PREFIX:
+        //the result is a __u64: the previous bit, the bit, the # of set bits, the length,
+        //whether the HyperLogLog changed, the estimated cardinality or the # of keys deleted.
+        ret = -EINVAL;
+        if (req.command == COMMAND_BITOP || req.command == COMMAND_PFADD ||
+                req.command == COMMAND_PFCOUNT || req.command == COMMAND_PFMERGE ||
+                req.command == COMMAND_DELETE_PREFIX) {
+            if (req.command == COMMAND_BITOP)
+                ret = kkv_process_bitop(ks, &req, &num);
+            else if (req.command == COMMAND_PFADD)
+                ret = kkv_process_pfadd(ks, &req, &num);
+            else if (req.command == COMMAND_DELETE_PREFIX)
+                ret = kkv_process_delete_prefix(ks, &req, &num);
+            else
+                ret = kkv_process_pfcount(ks, &req, &num);
+            req.nkey = 0;
+            req.value = req.key;
+        } else if (req.command == COMMAND_SETBIT && req.nvalue == sizeof(kkv_bit)) {
+            memcpy(&bit, req.value, sizeof(kkv_bit));
+            kkv_lock(&req);
+            ret = engine_setbit(ks, req.key, req.nkey, bit.offset, bit.bit != 0, &num);
+            kkv_unlock();
+        } else if (req.command == COMMAND_GETBIT && req.nvalue == sizeof(__u64)) {
+            memcpy(&num, req.value, sizeof(__u64));
+            kkv_lock(&req);
+            ret = engine_getbit(ks, req.key, req.nkey, num, &num);
+            kkv_unlock();
+        } else if (req.command == COMMAND_BITCOUNT) {
+            //the whole value is counted without a kkv_range.
+            range.offset = 0;
+            range.length = 0;
+            if (req.nvalue == sizeof(kkv_range))
+                memcpy(&range, req.value, sizeof(kkv_range));
+            kkv_lock(&req);
+            ret = engine_bitcount(ks, req.key, req.nkey, range.offset, range.length, &num);
+            kkv_unlock();
+        }
+        if (ret == 0) {
+            memcpy(req.value, &num, sizeof(__u64));
+            ret = sizeof(__u64);
+            req.command=COMMAND_ACK;
+            req.nvalue=ret;
         } else {
             req.command=COMMAND_NACK;
             req.nvalue=0;
@@ -158,34 +1148,103 @@ ssize_t kkv_process_req(char *io_buf, ssize_t max_len, ssize_t *rsp_len)
         goto rsp;
 
     case COMMAND_SET:
-		mutex_lock(&engine_lock);
-        ret = engine_set(req.key, req.nkey, req.value, req.nvalue);
-		mutex_unlock(&engine_lock);
+		kkv_lock(&req);
+        ret = engine_set(ks, req.key, req.nkey, req.value, req.nvalue);
+		kkv_unlock();
         break;
 
     case COMMAND_ADD:
-		mutex_lock(&engine_lock);
-        ret = engine_add(req.key, req.nkey, req.value, req.nvalue);
-		mutex_unlock(&engine_lock);
+		kkv_lock(&req);
+        ret = engine_add(ks, req.key, req.nkey, req.value, req.nvalue);
+		kkv_unlock();
         break;
 
     case COMMAND_REPLACE:
-		mutex_lock(&engine_lock);
-        ret = engine_replace(req.key, req.nkey, req.value, req.nvalue);
-		mutex_unlock(&engine_lock);
+		kkv_lock(&req);
+        ret = engine_replace(ks, req.key, req.nkey, req.value, req.nvalue);
+		kkv_unlock();
+        break;
+
+    case COMMAND_CAS:
+		kkv_lock(&req);
+        ret = engine_cas(ks, req.key, req.nkey, req.value, req.nvalue, &req.cas);
+		kkv_unlock();
+        //the new version, or the current one on mismatch, is carried in the header.
+        if (ret == 0) {
+            req.command=COMMAND_ACK;
+        } else if (ret == -EEXIST) {
+            req.command=COMMAND_NACK;
+        } else {
+            break;
+        }
+        ret = sizeof(kkv_packet);
+        req.nkey=0;
+        req.nvalue=0;
+        goto rsp;
+
+    case COMMAND_SETRANGE:
+        ret = -EINVAL;
+        if (req.nvalue >= sizeof(kkv_range)) {
+            memcpy(&range, req.value, sizeof(kkv_range));
+            if (range.length == req.nvalue - sizeof(kkv_range)) {
+                kkv_lock(&req);
+                ret = engine_setrange(ks, req.key, req.nkey, range.offset, req.value + sizeof(kkv_range), range.length);
+                kkv_unlock();
+            }
+        }
+        break;
+
+    case COMMAND_HSET:
+        //the value part is a single kkv_mkv of the field and its value, not aligned.
+        ret = -EINVAL;
+        if (req.nvalue >= sizeof(kkv_mkv)) {
+            memcpy(&mkv, req.value, sizeof(kkv_mkv));
+            if (kkv_next_record(req.value, req.value + req.nvalue, sizeof(kkv_mkv), mkv.key_len, mkv.value_len, &field, &value)) {
+                kkv_lock(&req);
+                ret = engine_hset(ks, req.key, req.nkey, field, mkv.key_len, value, mkv.value_len);
+                kkv_unlock();
+            }
+        }
+        break;
+
+    case COMMAND_HDEL:
+		kkv_lock(&req);
+        ret = engine_hdel(ks, req.key, req.nkey, req.value, req.nvalue);
+		kkv_unlock();
+        break;
+
+    case COMMAND_APPEND:
+    case COMMAND_PREPEND:
+		kkv_lock(&req);
+        ret = engine_append(ks, req.key, req.nkey, req.value, req.nvalue, req.command == COMMAND_APPEND);
+		kkv_unlock();
         break;
 
     case COMMAND_DELETE:
-		mutex_lock(&engine_lock);
-        ret = engine_delete(req.key, req.nkey);
-		mutex_unlock(&engine_lock);
+		kkv_lock(&req);
+        ret = engine_delete(ks, req.key, req.nkey);
+		kkv_unlock();
         break;
 
     case COMMAND_SHRINK:
         ret = engine_shrink();
         break;
+
+    case COMMAND_FLUSH:
+		kkv_lock(&req);
+        ret = engine_flush(ks);
+		kkv_unlock();
+        break;
+
+    case COMMAND_NOOP:
+        ret = 0;
+        break;
     }
 
+    if (kkv_quiet(&req, ret)) {
+        *rsp_len=0;
+        return ret;
+    }
     if (ret < 0) {
         req.command=COMMAND_NACK;
     } else {
@@ -193,9 +1252,93 @@ ssize_t kkv_process_req(char *io_buf, ssize_t max_len, ssize_t *rsp_len)
     }
     req.nkey=0;
     req.nvalue=0;
+    req.cas=0;
+    goto rsp;
+
+stale:
+    //a snapshot which is no longer held is told apart from a miss by echoing it.
+    req.command=COMMAND_NACK;
+    ret = sizeof(kkv_packet);
+    req.nkey=0;
+    req.nvalue=0;
 
 rsp:
     *rsp_len=kkv_create_rsp(io_buf,&req);
 
     return ret;
 }
+
+/*
+ * process the request packet in io_buf like kkv_process_req(), except that a get of the latest version
+ * leaves a value of at least KKV_LARGE_VALUE bytes, or too large for io_buf, in its item chain:
+ * the chain is pinned in *it, which is NULL otherwise, and the response packet put into io_buf
+ * stops short of the value, which the caller sends from the regions in place before kkv_put_items().
+ * @return: the same as kkv_process_req().
+ */
+ssize_t kkv_process_req_pinned(struct kkv_keyspace *ks, char *io_buf, ssize_t max_len, ssize_t *rsp_len, struct item **it)
+{
+    kkv_packet *pk=(kkv_packet*)io_buf;
+    struct kkv_request req;
+    ssize_t ret=-ENOENT;
+    __u32 flags;
+
+    *it=NULL;
+    if (pk->command != COMMAND_GET || pk->cas)
+        return kkv_process_req(ks, io_buf, max_len, rsp_len);
+
+    kkv_parse_req(io_buf, max_len, &req);
+#ifdef DEBUG_KKV_HASH
+    kkv_check_hash(&req);
+#endif
+    if (req.command != COMMAND_GET)
+        return kkv_process_req(ks, io_buf, max_len, rsp_len);
+    hotkey_access(req.key, req.nkey);
+
+    kkv_lock(&req);
+    *it = engine_get_item(ks, req.key, req.nkey, &ret, &req.cas, &flags);
+    if (*it && ret < KKV_LARGE_VALUE && ret <= req.nvalue) {
+        read_item(*it, req.value, ret);
+        engine_put_item(*it);
+        *it = NULL;
+    }
+    kkv_unlock();
+
+    if (ret < 0) {
+        req.command=COMMAND_NACK;
+        req.nvalue=0;
+        req.cas=0;
+    } else {
+        req.command=COMMAND_ACK;
+        req.nvalue=ret;
+        if (req.flags & KKV_FLAG_CLIENT)
+            req.client_flags=flags;
+    }
+    *rsp_len=kkv_create_rsp(io_buf,&req);
+    if (*it)
+        *rsp_len-=ret;
+    return ret;
+}
+
+/*
+ * drop the chain created by kkv_create_large() or mc_create_large() for a value never stored,
+ * as when the connection closes while the value is being received.
+ */
+void kkv_drop_large(struct item *it)
+{
+    mutex_lock(&engine_lock);
+    unlink_item(it);
+    mutex_unlock(&engine_lock);
+}
+
+/*
+ * unpin the item chains got by kkv_process_req_pinned().
+ */
+void kkv_put_items(struct item **it, int nr)
+{
+    int i;
+
+    mutex_lock(&engine_lock);
+    for (i = 0; i < nr; i++)
+        engine_put_item(it[i]);
+    mutex_unlock(&engine_lock);
+}
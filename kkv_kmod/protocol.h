@@ -10,7 +10,20 @@
 #define _KKV_PROTOCOL_H
 
 
-ssize_t kkv_process_req(char *io_buf, ssize_t max_len, ssize_t *rsp_len);
+struct kkv_keyspace;
+
+struct item;
+
+ssize_t kkv_req_len(char *buf, ssize_t len, ssize_t *nlarge);
+int kkv_req_async(char *buf);
+struct item *kkv_create_large(char *buf);
+ssize_t kkv_process_large(struct kkv_keyspace *ks, char *io_buf, struct item *it, ssize_t *rsp_len);
+ssize_t kkv_process_req(struct kkv_keyspace *ks, char *io_buf, ssize_t max_len, ssize_t *rsp_len);
+ssize_t kkv_process_req_pinned(struct kkv_keyspace *ks, char *io_buf, ssize_t max_len, ssize_t *rsp_len, struct item **it);
+void kkv_put_items(struct item **it, int nr);
+void kkv_drop_large(struct item *it);
+void kkv_get_keyspace(struct kkv_keyspace *ks);
+void kkv_put_keyspace(struct kkv_keyspace *ks);
 
 
 #endif
\ No newline at end of file
@@ -22,11 +22,13 @@
 #include "kkv.h"
 #include "socket.h"
 #include "session.h"
+#include "protocol.h"
 
 typedef struct {
     __s32 family;
     __s32 type;
     __s32 protocol;
+    __s32 frontend;//the protocol spoken to the clients, one of KKV_FRONTEND_*
     __s32 addrlen;
     __u8  addr[0];
 } sock_entry_t ;//__attribute__((aligned(sizeof(int))));
@@ -34,10 +36,15 @@ typedef struct {
 typedef struct {
     struct work_struct work;
     struct socket *socket;
+    struct kkv_keyspace *ks;//the keyspace served, that of the file which configured the server
+    int frontend;
 } kkv_server;
 
+//max # of listeners, each one is configured by a config request.
+#define KKV_SERVERS 4
+
 static struct workqueue_struct *wq=NULL;
-static kkv_server *svr=NULL;
+static kkv_server *svrs[KKV_SERVERS];
 
 static void server_work(struct work_struct *work)
 {
@@ -53,7 +60,7 @@ again:
 	if (!slave_socket)
 		return;
 
-    session=create_session(session_work_socket,slave_socket);
+    session=create_session(session_work_socket,slave_socket,server->ks,server->frontend);
     if(!session) {
 #ifdef DEBUG_KKV_NETWORK
 		        printk("create_session() failed\n");
@@ -107,13 +114,22 @@ static void set_server_sock_callbacks(struct socket *sock,void *data)
     write_unlock_bh(&sk->sk_callback_lock);
 }
 
-int init_server(void *conf)
+/*
+ * start one more listener, which serves the keyspace in the protocol configured.
+ */
+int init_server(void *conf, struct kkv_keyspace *ks)
 {
     int ret=0;
     int flags=1;
+    int i;
     sock_entry_t *se;
+    kkv_server *svr;
     struct linger ling= {0,0};
 
+    se=(sock_entry_t *)conf;
+    if(se->frontend!=KKV_FRONTEND_KKV&&se->frontend!=KKV_FRONTEND_MEMCACHED)
+        return -EINVAL;
+
     //create workqueue
     if(!wq) {
         wq=create_singlethread_workqueue("kkvserver");
@@ -125,13 +141,16 @@ int init_server(void *conf)
         }
     }
 
-    if(!svr) {
-        svr=kmalloc(sizeof(kkv_server),GFP_KERNEL);
-        INIT_WORK(&svr->work,server_work);
-    }
+    for(i=0; i<KKV_SERVERS&&svrs[i]; i++);
+    if(i==KKV_SERVERS)
+        return -EBUSY;
+    svr=kmalloc(sizeof(kkv_server),GFP_KERNEL);
+    if(!svr)
+        return -ENOMEM;
+    INIT_WORK(&svr->work,server_work);
+    svr->frontend=se->frontend;
 
     //create socket
-    se=(sock_entry_t *)conf;
     ret=sock_create_kern(se->family,se->type,se->protocol,&svr->socket);
     if(ret<0) {
 #ifdef DEBUG_KKV_NETWORK
@@ -191,29 +210,36 @@ int init_server(void *conf)
         goto out1;
     }
 
+    kkv_get_keyspace(ks);
+    svr->ks=ks;
+    svrs[i]=svr;
+
     return 0;
 
 out1:
     sock_release(svr->socket);
 
 out0:
-    svr->socket=NULL;
+    kfree(svr);
 
     return ret;
 }
 
 void close_server(void)
 {
+    int i;
+
     if(wq) {
         destroy_workqueue(wq);
         wq=NULL;
     }
 
-    if(svr) {
-        if(svr->socket) {
-            sock_release(svr->socket);
+    for(i=0; i<KKV_SERVERS; i++) {
+        if(svrs[i]) {
+            sock_release(svrs[i]->socket);
+            kkv_put_keyspace(svrs[i]->ks);
+            kfree(svrs[i]);
+            svrs[i]=NULL;
         }
-        kfree(svr);
-        svr=NULL;
     }
 }
@@ -10,7 +10,9 @@
 #define _KKV_SERVER_H
 
 
-int init_server(void *conf);
+struct kkv_keyspace;
+
+int init_server(void *conf, struct kkv_keyspace *ks);
 void close_server(void);
 
 
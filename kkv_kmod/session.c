@@ -14,6 +14,7 @@
 #include <linux/pagemap.h>
 #include <linux/mm.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <linux/workqueue.h>
 #include <linux/poll.h>
 #include <linux/net.h>
@@ -25,6 +26,7 @@
 #include <linux/percpu.h>
 #include <asm/atomic.h>
 #include "session.h"
+#include "protocol.h"
 
 
 #define POLLRD (POLLIN|POLLRDNORM|POLLPRI)
@@ -55,7 +57,34 @@ static int get_balancer_counter(void)
     return cur_counter;
 }
 
-kkv_session* create_session(void (*worker_main)(struct work_struct *), struct socket *slave_socket)
+/*
+ * the buffers are allocated apart from the session, so the session itself
+ * stays small and none of them needs a high-order allocation:
+ * the response buffer, the largest, is virtually contiguous.
+ */
+static int alloc_session_buffers(kkv_session *s)
+{
+    s->kkv_req_buffer=kmalloc(KKV_REQ_BUF_SIZE,GFP_KERNEL);
+    s->kkv_rsp_buffer=vmalloc(KKV_RSP_BUF_SIZE);
+    s->kkv_defer_buffer=kmalloc(SESSION_DEFER_SIZE,GFP_KERNEL);
+    s->mc_pkt=NULL;
+    if(s->frontend==KKV_FRONTEND_MEMCACHED)
+        s->mc_pkt=kmalloc(KKV_REQ_BUF_SIZE,GFP_KERNEL);
+    if(!s->kkv_req_buffer||!s->kkv_rsp_buffer||!s->kkv_defer_buffer||
+            (s->frontend==KKV_FRONTEND_MEMCACHED&&!s->mc_pkt))
+        return -ENOMEM;
+    return 0;
+}
+
+static void free_session_buffers(kkv_session *s)
+{
+    kfree(s->kkv_req_buffer);
+    vfree(s->kkv_rsp_buffer);
+    kfree(s->kkv_defer_buffer);
+    kfree(s->mc_pkt);
+}
+
+kkv_session* create_session(void (*worker_main)(struct work_struct *), struct socket *slave_socket, struct kkv_keyspace *ks, int frontend)
 {
     int ret;
     int cpu;
@@ -66,8 +95,28 @@ kkv_session* create_session(void (*worker_main)(struct work_struct *), struct so
     if(!s) {
         goto out;
     }
+    s->frontend=frontend;
+    if(alloc_session_buffers(s)) {
+        free_session_buffers(s);
+        kmem_cache_free(session_store,s);
+        s=NULL;
+        goto out;
+    }
     INIT_WORK(&s->work,worker_main);
     s->skt=slave_socket;
+    s->state=0;
+    s->req_len=0;
+    s->rsp_len=0;
+    s->rsp_sent=0;
+    s->large_left=0;
+    s->large_it=NULL;
+    s->nr_send_its=0;
+    s->send_done=0;
+    s->send_cur=NULL;
+    s->send_deferred=0;
+    s->defer_len=0;
+    kkv_get_keyspace(ks);
+    s->ks=ks;
     set_bit(SESSION_STATE_RCV,&s->state);
 
     cpu=get_balancer_counter();
@@ -123,10 +172,30 @@ int continue_session(kkv_session *s)
     return 0;
 }
 
+/*
+ * queue the work of the session again without waiting for the socket.
+ */
+int requeue_session(kkv_session *s)
+{
+    if(!queue_work_on(s->cpu,wq,&s->work)) {
+#ifdef DEBUG_KKV_SESSION
+        printk("queue_work() failed in requeue_session()\n");
+#endif
+        return -EFAULT;
+    }
+    return 0;
+}
+
 void destroy_session(kkv_session *s)
 {
     s->skt->ops->shutdown(s->skt,SHUT_RDWR);
     sock_release(s->skt);
+    if(s->nr_send_its)
+        kkv_put_items(s->send_its,s->nr_send_its);
+    if(s->large_it)
+        kkv_drop_large(s->large_it);
+    kkv_put_keyspace(s->ks);
+    free_session_buffers(s);
     //other cleanups...
     kmem_cache_free(session_store,s);
 }
@@ -23,6 +23,25 @@
 #define SESSION_STATE_BUSY 3//in processing
 #define SESSION_STATE_CLOSE 4//closed
 
+//the protocols a listener speaks.
+#define KKV_FRONTEND_KKV 0 //kkv_packet, see protocol.c
+#define KKV_FRONTEND_MEMCACHED 1 //the text and the binary protocols of memcached, see memcached.c
+
+//the responses to the pipelined requests are batched in the response buffer,
+//each one is built in place over a copy of its request, which needs KKV_REQ_BUF_SIZE bytes.
+#define KKV_RSP_BUF_SIZE (4 * KKV_REQ_BUF_SIZE)
+//max # of rounds of receiving and processing of a session in one work,
+//so that a busy session can't hold up the others on the cpu.
+#define SESSION_ROUNDS 8
+//max # of regions of an item chain received into by one receive.
+#define SESSION_LARGE_IOVS 16
+//max # of values of gets sent from their item chains in one batch of responses.
+#define SESSION_SEND_ITEMS 16
+//max # of pieces of the responses sent by one send.
+#define SESSION_SEND_IOVS 64
+//room for the headers of the deferred responses of a batch, see KKV_FLAG_ASYNC.
+#define SESSION_DEFER_SIZE 2048
+
 typedef struct {
     struct list_head list;//linked into the per_cpu session list
     unsigned long state;//state of this session
@@ -30,11 +49,37 @@ typedef struct {
     struct work_struct work;
     struct socket *skt;
     struct file *filp;
-    char kkv_req_buffer[KKV_REQ_BUF_SIZE];
+    struct kkv_keyspace *ks;//the keyspace served by this session
+    int frontend;//the protocol spoken, one of KKV_FRONTEND_*
+    char *mc_pkt;//the kkv_packet a memcached request is translated into, of KKV_REQ_BUF_SIZE bytes
+    ssize_t req_len;//# of bytes received but not processed yet, from the head of kkv_req_buffer
+    ssize_t rsp_len;//# of bytes of responses in kkv_rsp_buffer
+    ssize_t rsp_sent;//# of bytes of them already sent
+    //the large value being received, its request stays at the head of kkv_req_buffer meanwhile.
+    ssize_t large_left;//# of bytes of the value to receive, 0 if none is being received
+    struct item *large_it;//the chain receiving the value, NULL if the value is dropped
+    struct item *large_cur;//the region receiving the next byte
+    ssize_t large_off;//offset of the next byte within the value part of large_cur
+    //the values of gets sent straight from their item chains, pinned until they're sent,
+    //value i follows the first send_pos[i] bytes of kkv_rsp_buffer.
+    struct item *send_its[SESSION_SEND_ITEMS];
+    ssize_t send_pos[SESSION_SEND_ITEMS];
+    int nr_send_its;//# of them
+    int send_done;//# of them already sent
+    struct item *send_cur;//the region sending the next byte of the value send_done
+    ssize_t send_off;//offset of the next byte within the value part of send_cur
+    //the responses of async gets sent from their item chains are deferred behind the others of the batch,
+    //with their headers kept in kkv_defer_buffer, which is sent right after kkv_rsp_buffer.
+    unsigned long send_deferred;//bit i is set while value i follows the first send_pos[i] bytes of kkv_defer_buffer
+    ssize_t defer_len;//# of bytes of headers in kkv_defer_buffer
+    char *kkv_req_buffer;//of KKV_REQ_BUF_SIZE bytes
+    char *kkv_rsp_buffer;//of KKV_RSP_BUF_SIZE bytes
+    char *kkv_defer_buffer;//of SESSION_DEFER_SIZE bytes
 } kkv_session;
 
-kkv_session*  create_session(void (*worker_main)(struct work_struct *), struct socket *slave_socket);
+kkv_session*  create_session(void (*worker_main)(struct work_struct *), struct socket *slave_socket, struct kkv_keyspace *ks, int frontend);
 int continue_session(kkv_session *s);
+int requeue_session(kkv_session *s);
 void destroy_session(kkv_session *s);
 int init_workers(void);
 void destroy_workers(void);
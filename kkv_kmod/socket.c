@@ -23,6 +23,7 @@
 #include "socket.h"
 #include "session.h"
 #include "protocol.h"
+#include "memcached.h"
 
 static ssize_t receive_data(struct socket *sk,void *buf, ssize_t len)
 {
@@ -32,12 +33,11 @@ static ssize_t receive_data(struct socket *sk,void *buf, ssize_t len)
     return kernel_recvmsg(sk,&msg,&iov,1,len,msg.msg_flags);
 }
 
-static ssize_t send_data(struct socket *sk,void *buf,ssize_t len)
+static ssize_t send_data(struct socket *sk,struct kvec *iov,int n,ssize_t len)
 {
-    struct kvec iov= {buf,len};
     struct msghdr msg= {.msg_flags=MSG_DONTWAIT|MSG_NOSIGNAL};
 
-    return kernel_sendmsg(sk,&msg,&iov,1,len);
+    return kernel_sendmsg(sk,&msg,iov,n,len);
 }
 
 static void slave_sk_state_change(struct sock *sk)
@@ -100,43 +100,464 @@ void set_slave_sk_callbacks(struct socket *sock,void *data)
     write_unlock_bh(&sk->sk_callback_lock);
 }
 
-void session_work_socket(struct work_struct *work)
+/*
+ * gather the next pieces of the batched responses to send into iov,
+ * the values of gets are taken from the regions of their item chains in place,
+ * and the deferred responses from kkv_defer_buffer after kkv_rsp_buffer.
+ * @return: the # of pieces, their total length is put in *len.
+ */
+static int gather_session(kkv_session *s, struct kvec *iov, ssize_t *len)
 {
-    int ret;
-    ssize_t rsp_len;
+    ssize_t pos=s->rsp_sent;
+    ssize_t end;
+    struct item *it=s->send_cur;
+    ssize_t off=s->send_off;
+    int i=s->send_done;
+    int n=0;
+
+    *len=0;
+    while(n<SESSION_SEND_IOVS) {
+        end=i<s->nr_send_its?s->send_pos[i]:s->rsp_len+s->defer_len;
+        if(pos<end) {
+            if(pos<s->rsp_len) {
+                iov[n].iov_base=s->kkv_rsp_buffer+pos;
+                iov[n].iov_len=min_t(ssize_t,end,s->rsp_len)-pos;
+            } else {
+                iov[n].iov_base=s->kkv_defer_buffer+pos-s->rsp_len;
+                iov[n].iov_len=end-pos;
+            }
+            *len+=iov[n].iov_len;
+            pos+=iov[n].iov_len;
+            n++;
+            continue;
+        }
+        if(i==s->nr_send_its)
+            break;
+
+        for(; it&&n<SESSION_SEND_IOVS; it=it->next,off=0) {
+            if(off==VALUE_SIZE_OF_ITEM(it))
+                continue;
+            iov[n].iov_base=VALUE_OF_ITEM(it)+off;
+            iov[n].iov_len=VALUE_SIZE_OF_ITEM(it)-off;
+            *len+=iov[n].iov_len;
+            n++;
+        }
+        if(it)
+            break;
+        i++;
+        it=i<s->nr_send_its?s->send_its[i]:NULL;
+        off=0;
+    }
+    return n;
+}
+
+/*
+ * move the regions of the value being sent behind the cursor once they're done,
+ * and the cursor on to the next value once all of them are.
+ */
+static void skip_sent(kkv_session *s)
+{
+    while(s->send_done<s->nr_send_its) {
+        while(s->send_cur&&s->send_off==VALUE_SIZE_OF_ITEM(s->send_cur)) {
+            s->send_cur=s->send_cur->next;
+            s->send_off=0;
+        }
+        if(s->send_cur)
+            break;
+        s->send_done++;
+        s->send_cur=s->send_done<s->nr_send_its?s->send_its[s->send_done]:NULL;
+    }
+}
+
+/*
+ * account n bytes of the batched responses as sent, in the order of gather_session().
+ */
+static void advance_session(kkv_session *s, ssize_t n)
+{
+    ssize_t len, end;
+
+    while(n>0) {
+        end=s->send_done<s->nr_send_its?s->send_pos[s->send_done]:s->rsp_len+s->defer_len;
+        if(s->rsp_sent<end) {
+            len=min_t(ssize_t,end-s->rsp_sent,n);
+            s->rsp_sent+=len;
+        } else {
+            len=min_t(ssize_t,VALUE_SIZE_OF_ITEM(s->send_cur)-s->send_off,n);
+            s->send_off+=len;
+            skip_sent(s);
+        }
+        n-=len;
+    }
+}
+
+/*
+ * keep the value of a get in its chain it to be sent after the first pos bytes of the responses,
+ * the chain stays pinned until then.
+ */
+static void add_send_item(kkv_session *s, struct item *it, ssize_t pos)
+{
+    s->send_its[s->nr_send_its]=it;
+    s->send_pos[s->nr_send_its]=pos;
+    if(s->nr_send_its++==s->send_done) {
+        s->send_cur=it;
+        s->send_off=0;
+        skip_sent(s);
+    }
+}
+
+/*
+ * defer the response of rsp_len bytes at rsp to an async get, whose value is sent from its chain it,
+ * behind the other responses of the batch, see order_session().
+ * @return: 0, or -ENOSPC if there's no room for its header.
+ */
+static int defer_send_item(kkv_session *s, char *rsp, ssize_t rsp_len, struct item *it)
+{
+    if(s->defer_len+rsp_len>SESSION_DEFER_SIZE)
+        return -ENOSPC;
+
+    memcpy(s->kkv_defer_buffer+s->defer_len,rsp,rsp_len);
+    set_bit(s->nr_send_its,&s->send_deferred);
+    add_send_item(s,it,s->defer_len+rsp_len);
+    s->defer_len+=rsp_len;
+    return 0;
+}
+
+/*
+ * move the values of the deferred responses behind all the others once the batch is complete,
+ * and restart the cursor at the first value.
+ */
+static void order_session(kkv_session *s)
+{
+    struct item *its[SESSION_SEND_ITEMS];
+    ssize_t pos[SESSION_SEND_ITEMS];
+    int i, n=0;
+
+    for(i=0; i<s->nr_send_its; i++) {
+        if(!test_bit(i,&s->send_deferred)) {
+            its[n]=s->send_its[i];
+            pos[n++]=s->send_pos[i];
+        }
+    }
+    for(i=0; i<s->nr_send_its; i++) {
+        if(test_bit(i,&s->send_deferred)) {
+            its[n]=s->send_its[i];
+            pos[n++]=s->rsp_len+s->send_pos[i];
+        }
+    }
+    memcpy(s->send_its,its,n*sizeof(struct item*));
+    memcpy(s->send_pos,pos,n*sizeof(ssize_t));
+    s->send_deferred=0;
+
+    s->send_done=0;
+    s->send_cur=s->send_its[0];
+    s->send_off=0;
+    skip_sent(s);
+}
+
+/*
+ * send the batched responses, and unpin the item chains the values of gets are sent from.
+ * @return: 0 if all of them are sent, or -EAGAIN if the socket is full.
+ */
+static int flush_session(kkv_session *s)
+{
+    struct kvec iov[SESSION_SEND_IOVS];
     ssize_t len;
-    kkv_session *s=container_of(work,kkv_session,work);
-    struct socket *slave_socket=s->skt;
-    char *kkv_req_buf=s->kkv_req_buffer;
+    int n;
 
-    len=receive_data(slave_socket,kkv_req_buf,KKV_REQ_BUF_SIZE);
-    if(len<=0) {
+    while(s->rsp_sent<s->rsp_len+s->defer_len||s->send_done<s->nr_send_its) {
+        n=gather_session(s,iov,&len);
+        len=send_data(s->skt,iov,n,len);
+        if(len<=0) {
 #ifdef DEBUG_KKV_NETWORK
-        printk("receive_data() failed in worker_main(), len=%ld\n",len);
+            printk("send_data() imcomplete in flush_session(), len=%ld\n",len);
 #endif
-        goto again;
+            return -EAGAIN;
+        }
+        advance_session(s,len);
+    }
+    if(s->nr_send_its) {
+        kkv_put_items(s->send_its,s->nr_send_its);
+        s->nr_send_its=0;
+        s->send_done=0;
+    }
+    s->rsp_len=0;
+    s->rsp_sent=0;
+    s->defer_len=0;
+    return 0;
+}
+
+/*
+ * take in n bytes of the large value, copied from data unless they're received in place.
+ */
+static void fill_large(kkv_session *s, char *data, ssize_t n)
+{
+    ssize_t len;
+
+    s->large_left-=n;
+    while(s->large_cur&&n>0) {
+        len=VALUE_SIZE_OF_ITEM(s->large_cur)-s->large_off;
+        if(len>n)
+            len=n;
+        if(data) {
+            memcpy(VALUE_OF_ITEM(s->large_cur)+s->large_off,data,len);
+            data+=len;
+        }
+        n-=len;
+        s->large_off+=len;
+        if(s->large_off==VALUE_SIZE_OF_ITEM(s->large_cur)) {
+            s->large_cur=s->large_cur->next;
+            s->large_off=0;
+        }
+    }
+}
+
+/*
+ * receive the large value straight into the regions of its item chain,
+ * or into the response buffer to be dropped if there's no chain or the chain is full,
+ * as with the trailing "\r\n" of a memcached value, the buffer is empty by then.
+ * @return: the # of bytes received, or a negative error.
+ */
+static ssize_t receive_large(kkv_session *s)
+{
+    struct kvec iov[SESSION_LARGE_IOVS];
+    struct msghdr msg= {.msg_flags=MSG_DONTWAIT|MSG_NOSIGNAL};
+    struct item *it=s->large_cur;
+    ssize_t off=s->large_off;
+    ssize_t len=0;
+    ssize_t ret;
+    int n=0;
+
+    if(!it) {
+        iov[0].iov_base=s->kkv_rsp_buffer;
+        iov[0].iov_len=min_t(ssize_t,s->large_left,KKV_RSP_BUF_SIZE);
+        len=iov[0].iov_len;
+        n=1;
     }
+    for(; it&&n<SESSION_LARGE_IOVS&&len<s->large_left; it=it->next,off=0) {
+        if(off==VALUE_SIZE_OF_ITEM(it))
+            continue;
+        iov[n].iov_base=VALUE_OF_ITEM(it)+off;
+        iov[n].iov_len=min_t(ssize_t,VALUE_SIZE_OF_ITEM(it)-off,s->large_left-len);
+        len+=iov[n].iov_len;
+        n++;
+    }
+
+    ret=kernel_recvmsg(s->skt,&msg,iov,n,len,msg.msg_flags);
+    if(ret>0)
+        fill_large(s,NULL,ret);
+    return ret;
+}
+
+/*
+ * the length of the part of the request at buf held in the request buffer, see kkv_req_len().
+ */
+static ssize_t session_req_len(kkv_session *s, char *buf, ssize_t len, ssize_t *nlarge)
+{
+    if(s->frontend==KKV_FRONTEND_MEMCACHED)
+        return mc_req_len(buf,len,nlarge);
+    return kkv_req_len(buf,len,nlarge);
+}
+
+/*
+ * start receiving the large value of the request of len bytes at the head of the request buffer,
+ * the part of the value received with the request is copied into the chain.
+ */
+static void start_large(kkv_session *s, ssize_t len, ssize_t nlarge)
+{
+    char *buf=s->kkv_req_buffer;
+    ssize_t n;
+
+    if(s->frontend==KKV_FRONTEND_MEMCACHED)
+        s->large_it=mc_create_large(s->mc_pkt,buf,len);
+    else
+        s->large_it=kkv_create_large(buf);
+    s->large_cur=s->large_it;
+    s->large_off=0;
+    s->large_left=nlarge;
+
+    n=min_t(ssize_t,s->req_len-len,nlarge);
+    fill_large(s,buf+len,n);
+    memmove(buf+len,buf+len+n,s->req_len-len-n);
+    s->req_len-=n;
+}
+
+/*
+ * store the large value received, and drop its request from the head of the request buffer.
+ */
+static void finish_large(kkv_session *s)
+{
+    ssize_t len, nlarge, rsp_len;
+    char *rsp=s->kkv_rsp_buffer+s->rsp_len;
+    struct mc_rsp mc= {.buf=rsp,.room=KKV_RSP_BUF_SIZE-s->rsp_len};
+
+    len=session_req_len(s,s->kkv_req_buffer,s->req_len,&nlarge);
+    if(s->frontend==KKV_FRONTEND_MEMCACHED) {
+        mc_process_large(s->mc_pkt,s->ks,s->kkv_req_buffer,len,s->large_it,&mc);
+        rsp_len=mc.len;
+    } else {
+        memcpy(rsp,s->kkv_req_buffer,len);
+        kkv_process_large(s->ks,rsp,s->large_it,&rsp_len);
+    }
+    s->rsp_len+=rsp_len;
+    s->large_it=NULL;
+
+    memmove(s->kkv_req_buffer,s->kkv_req_buffer+len,s->req_len-len);
+    s->req_len-=len;
+}
+
+/*
+ * process the memcached request of len bytes at buf, see mc_process_req().
+ * a get that doesn't fit in the batch waits for the batch to be sent, unless it's empty.
+ * @return: 0, or a negative error.
+ */
+static int process_mc(kkv_session *s, char *buf, ssize_t len)
+{
+    struct item *its[SESSION_SEND_ITEMS];
+    ssize_t pos[SESSION_SEND_ITEMS];
+    struct mc_rsp mc= {
+        .buf=s->kkv_rsp_buffer+s->rsp_len,
+        .room=KKV_RSP_BUF_SIZE-s->rsp_len,
+        .its=its,
+        .pos=pos,
+        .max=SESSION_SEND_ITEMS-s->nr_send_its,
+        .retry=s->rsp_len||s->nr_send_its
+    };
+    int ret;
+    int i;
+
+    ret=mc_process_req(s->mc_pkt,s->ks,buf,len,&mc);
+    if(ret<0)
+        return ret;
+    for(i=0; i<mc.nr; i++)
+        add_send_item(s,its[i],s->rsp_len+pos[i]);
+    s->rsp_len+=mc.len;
+    return 0;
+}
 
-    clear_bit(SESSION_STATE_RCV,&s->state);
+/*
+ * process the complete requests received, in order, while their responses fit in the response buffer.
+ * the tail of a request split across segments is kept for the next receive,
+ * and a large value is received into its item chain before the requests after it are processed,
+ * while the large value of a get is left in its item chain to be sent from there, see flush_session(),
+ * after the responses to the requests behind it if the get is async.
+ * @return: the # of requests processed, -EINVAL if a request can't fit in the request buffer,
+ * or -ECONNRESET if a memcached client quits.
+ */
+static int process_session(kkv_session *s)
+{
+    ssize_t pos=0;
+    ssize_t len, nlarge, rsp_len;
+    struct item *it;
+    char *rsp;
+    int nr=0;
+    int async;
+    int ret;
 
     set_bit(SESSION_STATE_BUSY,&s->state);
-    ret=kkv_process_req(kkv_req_buf,KKV_REQ_BUF_SIZE,&rsp_len);
+    while(!s->large_left&&s->rsp_len+KKV_REQ_BUF_SIZE<=KKV_RSP_BUF_SIZE&&s->nr_send_its<SESSION_SEND_ITEMS) {
+        len=session_req_len(s,s->kkv_req_buffer+pos,s->req_len-pos,&nlarge);
+        if(len<0) {
+            nr=len;
+            break;
+        }
+        if(len==0||len>s->req_len-pos)
+            break;
+
+        if(nlarge) {
+            memmove(s->kkv_req_buffer,s->kkv_req_buffer+pos,s->req_len-pos);
+            s->req_len-=pos;
+            pos=0;
+            start_large(s,len,nlarge);
+            if(!s->large_left) {
+                finish_large(s);
+                nr++;
+            }
+            continue;
+        }
+
+        if(s->frontend==KKV_FRONTEND_MEMCACHED) {
+            ret=process_mc(s,s->kkv_req_buffer+pos,len);
+            if(ret==-EAGAIN)
+                break;
+            if(ret<0) {
+                nr=ret;
+                break;
+            }
+        } else {
+            rsp=s->kkv_rsp_buffer+s->rsp_len;
+            memcpy(rsp,s->kkv_req_buffer+pos,len);
+            async=kkv_req_async(rsp);
+            kkv_process_req_pinned(s->ks,rsp,KKV_REQ_BUF_SIZE,&rsp_len,&it);
+            if(!it||!async||defer_send_item(s,rsp,rsp_len,it)<0) {
+                if(it)
+                    add_send_item(s,it,s->rsp_len+rsp_len);
+                s->rsp_len+=rsp_len;
+            }
+        }
+        pos+=len;
+        nr++;
+    }
+    if(s->send_deferred)
+        order_session(s);
     clear_bit(SESSION_STATE_BUSY,&s->state);
-//    if(ret>0) {
-    //currently we send out all of the data in one shot.
-    //which is not proper for the request with multiple sub-requests, of course.
-    set_bit(SESSION_STATE_SND,&s->state);
-    len=send_data(slave_socket,kkv_req_buf,rsp_len);
-    if(len>=rsp_len) {
+
+    if(pos>0) {
+        memmove(s->kkv_req_buffer,s->kkv_req_buffer+pos,s->req_len-pos);
+        s->req_len-=pos;
+    }
+    return nr;
+}
+
+/*
+ * the requests may be pipelined, so every complete one received is processed,
+ * and the responses are sent back together.
+ */
+void session_work_socket(struct work_struct *work)
+{
+    int ret;
+    int round;
+    ssize_t len;
+    kkv_session *s=container_of(work,kkv_session,work);
+    struct socket *slave_socket=s->skt;
+
+    for(round=0; ; round++) {
+        if(flush_session(s)<0) {
+            clear_bit(SESSION_STATE_RCV,&s->state);
+            set_bit(SESSION_STATE_SND,&s->state);
+            goto again;
+        }
         clear_bit(SESSION_STATE_SND,&s->state);
         set_bit(SESSION_STATE_RCV,&s->state);
-    }
+
+        //the requests left are picked up by the next work, even if no more data arrives.
+        if(round==SESSION_ROUNDS) {
+            requeue_session(s);
+            return;
+        }
+
+        len=0;
+        if(s->large_left) {
+            len=receive_large(s);
+            if(len>0&&!s->large_left)
+                finish_large(s);
+        } else if(s->req_len<KKV_REQ_BUF_SIZE) {
+            len=receive_data(slave_socket,s->kkv_req_buffer+s->req_len,KKV_REQ_BUF_SIZE-s->req_len);
+            if(len>0)
+                s->req_len+=len;
+        }
+
+        ret=process_session(s);
+        if(ret<0) {
 #ifdef DEBUG_KKV_NETWORK
-    else {
-        printk("send_data() imcomplete in worker_main()\n");
-    }
+            printk("malformed request or quit in session_work_socket(), ret=%d\n",ret);
 #endif
-//    }
+            slave_socket->ops->shutdown(slave_socket,SHUT_RDWR);
+            return;
+        }
+        if(len<=0&&ret==0&&!s->rsp_len&&!s->defer_len)
+            break;
+    }
+
 again:
     if(slave_socket->sk->sk_state==TCP_ESTABLISHED) {
         ret=continue_session(s);
@@ -19,14 +19,17 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 
 #include "libkkv-net.h"
+#include "../client/kkv-hash.h"
 
 
-#define BUF_SIZE 1024
+#define BUF_SIZE 8192 //same as KKV_REQ_BUF_SIZE in kkv_kmod.
+#define LARGE_VALUE 4096 //same as KKV_LARGE_VALUE in kkv_kmod.
 
 #define COMMAND_CONFIG 0
 #define COMMAND_DECONFIG 1
@@ -38,6 +41,49 @@
 #define COMMAND_SHRINK 15
 #define COMMAND_ACK 20
 #define COMMAND_NACK 21
+#define COMMAND_RETRY 22
+#define COMMAND_MGET 30
+#define COMMAND_MSET 31
+#define COMMAND_MDELETE 32
+#define COMMAND_INCR 33
+#define COMMAND_DECR 34
+#define COMMAND_APPEND 35
+#define COMMAND_PREPEND 36
+#define COMMAND_CAS 37
+#define COMMAND_GETRANGE 38
+#define COMMAND_SETRANGE 39
+#define COMMAND_MULTI 40
+#define COMMAND_STATS 41
+#define COMMAND_FLUSH 42
+#define COMMAND_HGET 43
+#define COMMAND_HSET 44
+#define COMMAND_HDEL 45
+#define COMMAND_HGETALL 46
+#define COMMAND_SETBIT 47
+#define COMMAND_GETBIT 48
+#define COMMAND_BITCOUNT 49
+#define COMMAND_BITOP 50
+#define COMMAND_PFADD 51
+#define COMMAND_PFCOUNT 52
+#define COMMAND_PFMERGE 53
+#define COMMAND_LGET 54
+#define COMMAND_LSET 55
+#define COMMAND_DELETE_PREFIX 56
+#define COMMAND_SNAPSHOT 57
+#define COMMAND_RELEASE 58
+#define COMMAND_NOOP 59
+
+#define KKV_STATS_HOTKEYS "hotkeys"
+#define KKV_STATS_KEYSPACE "keyspace"
+#define KKV_STATS_DEDUP "dedup"
+
+//the flags of a request packet.
+#define KKV_FLAG_HASH 0x1 //the hash field holds libkkv_key_hash() of the key.
+#define KKV_FLAG_ASYNC 0x2 //the response may come after those of the requests behind it, matched by id.
+#define KKV_FLAG_QUIET 0x4 //no response to a set, add, replace or delete unless it fails.
+#define KKV_FLAG_NOREPLY 0x8 //no response to a set, add, replace or delete at all.
+
+#define PADDED_KEY_SIZE(size) ((uint32_t)((size + 3) / 4) * 4)
 
 
 typedef struct {
@@ -51,9 +97,84 @@ typedef struct {
     uint32_t command;
     uint32_t key_len;
     uint32_t value_len;
+    uint64_t cas;
+    uint32_t hash;
+    uint32_t flags;
     char data[0];
 } kkv_packet;
 
+typedef struct {
+    uint32_t key_len;
+    char key[0];
+} kkv_mkey;
+
+typedef struct {
+    uint32_t key_len;
+    uint32_t value_len;
+    char data[0];
+} kkv_mkv;
+
+typedef struct {
+    uint32_t command;
+    uint32_t key_len;
+    uint32_t value_len;
+    char data[0];
+} kkv_mop;
+
+typedef struct {
+    uint32_t key_len;
+    uint32_t rate;
+    char key[0];
+} kkv_hotkey;
+
+typedef struct {
+    uint64_t offset;
+    uint64_t bit;
+} kkv_bit;
+
+typedef struct {
+    uint64_t nr_items;
+    uint64_t mem;
+} kkv_keyspace_stats;
+
+typedef struct {
+    uint64_t nr_values;
+    uint64_t nr_refs;
+    uint64_t saved;
+} kkv_dedup_stats;
+
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+} kkv_range;
+
+/*
+ * receive a whole response packet, which may span several segments.
+ */
+static int recv_response(int fd, char *buf)
+{
+    int ret;
+    uint32_t len=0;
+    uint32_t total=sizeof(kkv_packet);
+    kkv_packet *pk=(kkv_packet*)buf;
+
+    while(len<total) {
+        ret=recv(fd,buf+len,total-len,0);
+        if(ret<=0) {
+            printf("recv() failed in recv_response(): errno=%d\n",errno);
+            return -1;
+        }
+        len+=ret;
+        if(len>=sizeof(kkv_packet))
+            total=sizeof(kkv_packet)+pk->key_len+pk->value_len;
+        if(total>BUF_SIZE) {
+            printf("response too large in recv_response(): len=%u\n",total);
+            return -1;
+        }
+    }
+    return len;
+}
+
 static int send_request(int fd, char *buf, uint32_t len)
 {
     int ret;
@@ -63,14 +184,61 @@ static int send_request(int fd, char *buf, uint32_t len)
         printf("send() failed in send_request(): errno=%d\n",errno);
         goto out;
     }
-    ret=recv(fd,buf,BUF_SIZE,0);
-    if(ret<0) {
-        printf("recv() failed in send_request(): errno=%d\n",errno);
-    }
+    ret=recv_response(fd,buf);
 out:
     return ret;
 }
 
+/*
+ * the hash the server files the key under, same as key_hash() in kkv_kmod,
+ * it's sent with the request so that the server doesn't hash the key again.
+ */
+uint32_t libkkv_key_hash(char *key, uint32_t key_len)
+{
+    return key_hash(key,key_len);
+}
+
+/*
+ * send the request in buf followed by value, which is sent from where it is, without waiting for the response.
+ */
+static int send_packet(int fd, char *buf, uint32_t len, char *value, uint32_t value_len)
+{
+    int ret;
+    struct iovec iov[2]= {{buf,len},{value,value_len}};
+    struct msghdr msg= {.msg_iov=iov,.msg_iovlen=2};
+
+    while(iov[0].iov_len+iov[1].iov_len>0) {
+        ret=sendmsg(fd,&msg,MSG_NOSIGNAL);
+        if(ret<0) {
+            printf("sendmsg() failed in send_packet(): errno=%d\n",errno);
+            return ret;
+        }
+        if(ret>=iov[0].iov_len) {
+            ret-=iov[0].iov_len;
+            iov[0].iov_len=0;
+            iov[1].iov_base=(char*)iov[1].iov_base+ret;
+            iov[1].iov_len-=ret;
+        } else {
+            iov[0].iov_base=(char*)iov[0].iov_base+ret;
+            iov[0].iov_len-=ret;
+        }
+    }
+    return 0;
+}
+
+/*
+ * send the request in buf followed by its large value, which is sent from where it is.
+ */
+static int send_large_request(int fd, char *buf, uint32_t len, char *value, uint32_t value_len)
+{
+    int ret;
+
+    ret=send_packet(fd,buf,len,value,value_len);
+    if(ret<0)
+        return ret;
+    return recv_response(fd,buf);
+}
+
 static uint32_t create_request(char *buf, uint32_t id, uint32_t command, char *key, uint32_t key_len, char *value, uint32_t value_len)
 {
     kkv_packet *pk;
@@ -88,10 +256,241 @@ static uint32_t create_request(char *buf, uint32_t id, uint32_t command, char *k
     if(value_len) {
         memcpy(pk->data+key_len,value,value_len);
     }
+    pk->cas=0;
+    pk->hash=key_len?libkkv_key_hash(key,key_len):0;
+    pk->flags=key_len?KKV_FLAG_HASH:0;
 
     return sizeof(kkv_packet)+key_len+value_len;
 }
 
+/*
+ * pack the keys into the key part as a list of kkv_mkey.
+ */
+static uint32_t create_multi_request(char *buf, uint32_t id, uint32_t command, uint32_t nr, char **keys, uint32_t *key_lens)
+{
+    uint32_t i;
+    char *pos;
+    kkv_packet *pk;
+    kkv_mkey *mk;
+
+    pk=(kkv_packet*)buf;
+    pk->id=id;
+    pk->command=command;
+
+    pos=pk->data;
+    for(i=0; i<nr; i++) {
+        if(pos+sizeof(kkv_mkey)+PADDED_KEY_SIZE(key_lens[i])>buf+BUF_SIZE)
+            return 0;
+        mk=(kkv_mkey*)pos;
+        mk->key_len=key_lens[i];
+        memcpy(mk->key,keys[i],key_lens[i]);
+        pos+=sizeof(kkv_mkey)+PADDED_KEY_SIZE(key_lens[i]);
+    }
+    pk->key_len=pos-pk->data;
+    pk->value_len=0;
+    pk->cas=0;
+    pk->hash=0;
+    pk->flags=0;
+
+    return sizeof(kkv_packet)+pk->key_len;
+}
+
+/*
+ * pack the key/value pairs into the key part as a list of kkv_mkv.
+ */
+static uint32_t create_mset_request(char *buf, uint32_t id, uint32_t nr, char **keys, uint32_t *key_lens, char **values, uint32_t *value_lens)
+{
+    uint32_t i;
+    char *pos;
+    kkv_packet *pk;
+    kkv_mkv *mkv;
+
+    pk=(kkv_packet*)buf;
+    pk->id=id;
+    pk->command=COMMAND_MSET;
+
+    pos=pk->data;
+    for(i=0; i<nr; i++) {
+        if(pos+sizeof(kkv_mkv)+PADDED_KEY_SIZE(key_lens[i])+PADDED_KEY_SIZE(value_lens[i])>buf+BUF_SIZE)
+            return 0;
+        mkv=(kkv_mkv*)pos;
+        mkv->key_len=key_lens[i];
+        mkv->value_len=value_lens[i];
+        memcpy(mkv->data,keys[i],key_lens[i]);
+        pos=mkv->data+PADDED_KEY_SIZE(key_lens[i]);
+        memcpy(pos,values[i],value_lens[i]);
+        pos+=PADDED_KEY_SIZE(value_lens[i]);
+    }
+    pk->key_len=pos-pk->data;
+    pk->value_len=0;
+    pk->cas=0;
+    pk->hash=0;
+    pk->flags=0;
+
+    return sizeof(kkv_packet)+pk->key_len;
+}
+
+/*
+ * pack the operations into the key part as a list of kkv_mop.
+ */
+static uint32_t create_mop_request(char *buf, uint32_t id, uint32_t nr, uint32_t *ops, char **keys, uint32_t *key_lens, char **values, uint32_t *value_lens)
+{
+    static const uint32_t commands[]= {COMMAND_SET,COMMAND_ADD,COMMAND_REPLACE,COMMAND_DELETE};
+    uint32_t i;
+    uint32_t value_len;
+    char *pos;
+    kkv_packet *pk;
+    kkv_mop *mop;
+
+    pk=(kkv_packet*)buf;
+    pk->id=id;
+    pk->command=COMMAND_MULTI;
+
+    pos=pk->data;
+    for(i=0; i<nr; i++) {
+        if(ops[i]>LIBKKV_OP_DELETE)
+            return 0;
+        value_len=ops[i]==LIBKKV_OP_DELETE?0:value_lens[i];
+        if(pos+sizeof(kkv_mop)+PADDED_KEY_SIZE(key_lens[i])+PADDED_KEY_SIZE(value_len)>buf+BUF_SIZE)
+            return 0;
+        mop=(kkv_mop*)pos;
+        mop->command=commands[ops[i]];
+        mop->key_len=key_lens[i];
+        mop->value_len=value_len;
+        memcpy(mop->data,keys[i],key_lens[i]);
+        pos=mop->data+PADDED_KEY_SIZE(key_lens[i]);
+        if(value_len)
+            memcpy(pos,values[i],value_len);
+        pos+=PADDED_KEY_SIZE(value_len);
+    }
+    pk->key_len=pos-pk->data;
+    pk->value_len=0;
+    pk->cas=0;
+    pk->hash=0;
+    pk->flags=0;
+
+    return sizeof(kkv_packet)+pk->key_len;
+}
+
+/*
+ * the value part carries the result of each operation, 0 on success.
+ * an aborted multi request is answered with NACK, but still carries the results.
+ * @return: the # of failed operations.
+ */
+static int parse_multi_response(char *buf, uint32_t id, uint32_t nr, int *results)
+{
+    uint32_t i;
+    int failed=0;
+    int32_t *res;
+    kkv_packet *pk;
+
+    pk=(kkv_packet*)buf;
+    if(pk->id!=id)
+        return -1;
+
+    if(pk->value_len<nr*sizeof(int32_t))
+        return -2;
+
+    res=(int32_t*)(pk->data+pk->key_len);
+    for(i=0; i<nr; i++) {
+        if(res[i]<0)
+            failed++;
+        if(results)
+            results[i]=res[i]<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+    }
+    return failed;
+}
+
+/*
+ * the value part carries the length of each value, negative if not found,
+ * followed by the found values back to back.
+ */
+static int parse_mget_response(char *buf, uint32_t id, uint32_t nr, char **values, uint32_t *value_lens)
+{
+    uint32_t i;
+    int32_t *lens;
+    char *pos;
+    kkv_packet *pk;
+
+    pk=(kkv_packet*)buf;
+    if(pk->id!=id)
+        return -1;
+
+    if(pk->command==COMMAND_NACK||pk->value_len<nr*sizeof(int32_t))
+        return -2;
+
+    lens=(int32_t*)(pk->data+pk->key_len);
+    pos=(char*)(lens+nr);
+    for(i=0; i<nr; i++) {
+        if(lens[i]<0) {
+            values[i]=NULL;
+            value_lens[i]=0;
+            continue;
+        }
+        values[i]=malloc(lens[i]);
+        memcpy(values[i],pos,lens[i]);
+        value_lens[i]=lens[i];
+        pos+=lens[i];
+    }
+    return nr;
+}
+
+/*
+ * the value part starts with a kkv_range, followed by the bytes to write if value is given.
+ */
+static uint32_t create_range_request(char *buf, uint32_t id, uint32_t command, char *key, uint32_t key_len, uint32_t offset, uint32_t length, char *value)
+{
+    uint32_t len;
+    kkv_packet *pk;
+    kkv_range range;
+
+    len=create_request(buf,id,command,key,key_len,NULL,0);
+    if(len+sizeof(kkv_range)+(value?length:0)>BUF_SIZE)
+        return 0;
+
+    range.offset=offset;
+    range.length=length;
+    memcpy(buf+len,&range,sizeof(kkv_range));
+    len+=sizeof(kkv_range);
+    if(value) {
+        memcpy(buf+len,value,length);
+        len+=length;
+    }
+
+    pk=(kkv_packet*)buf;
+    pk->value_len=len-sizeof(kkv_packet)-key_len;
+    return len;
+}
+
+/*
+ * put the field and its value into the value part as a kkv_mkv.
+ */
+static uint32_t create_hset_request(char *buf, uint32_t id, char *key, uint32_t key_len, char *field, uint32_t field_len, char *value, uint32_t value_len)
+{
+    uint32_t len;
+    kkv_packet *pk;
+    kkv_mkv mkv;
+
+    len=create_request(buf,id,COMMAND_HSET,key,key_len,NULL,0);
+    if(len+sizeof(kkv_mkv)+PADDED_KEY_SIZE(field_len)+value_len>BUF_SIZE)
+        return 0;
+
+    //the kkv_mkv follows the key, so it may be unaligned.
+    mkv.key_len=field_len;
+    mkv.value_len=value_len;
+    memcpy(buf+len,&mkv,sizeof(kkv_mkv));
+    len+=sizeof(kkv_mkv);
+    memset(buf+len,0,PADDED_KEY_SIZE(field_len));
+    memcpy(buf+len,field,field_len);
+    len+=PADDED_KEY_SIZE(field_len);
+    memcpy(buf+len,value,value_len);
+    len+=value_len;
+
+    pk=(kkv_packet*)buf;
+    pk->value_len=len-sizeof(kkv_packet)-key_len;
+    return len;
+}
+
 static int parse_response(char *buf, uint32_t id, char **value, uint32_t *value_len)
 {
     uint32_t len;
@@ -185,8 +584,15 @@ static int __libkkv_add(kkv_handler *kh, char *key, uint32_t key_len, char *valu
     int ret;
     __u32 id=kh->accu_id++;
 
-    len=create_request(kh->buf,id,command,key,key_len,value,value_len);
-    ret=send_request(kh->fd,kh->buf,len);
+    //a large value isn't copied into the buffer, the packet on the wire is the same.
+    if(value_len>=LARGE_VALUE) {
+        len=create_request(kh->buf,id,command,key,key_len,NULL,0);
+        ((kkv_packet*)kh->buf)->value_len=value_len;
+        ret=send_large_request(kh->fd,kh->buf,len,value,value_len);
+    } else {
+        len=create_request(kh->buf,id,command,key,key_len,value,value_len);
+        ret=send_request(kh->fd,kh->buf,len);
+    }
     if(ret>=0)
         ret=parse_response(kh->buf,id,NULL,NULL);
     return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
@@ -207,7 +613,22 @@ int libkkv_replace(void *kh, char *key, uint32_t key_len, char *value, uint32_t
     return __libkkv_add(kh,key,key_len,value,value_len,COMMAND_REPLACE);
 }
 
+int libkkv_append(void *kh, char *key, uint32_t key_len, char *value, uint32_t value_len)
+{
+    return __libkkv_add(kh,key,key_len,value,value_len,COMMAND_APPEND);
+}
+
+int libkkv_prepend(void *kh, char *key, uint32_t key_len, char *value, uint32_t value_len)
+{
+    return __libkkv_add(kh,key,key_len,value,value_len,COMMAND_PREPEND);
+}
+
 int libkkv_get(void *kh0, char *key, uint32_t key_len, char **value, uint32_t *value_len)
+{
+    return libkkv_gets(kh0,key,key_len,value,value_len,NULL);
+}
+
+int libkkv_gets(void *kh0, char *key, uint32_t key_len, char **value, uint32_t *value_len, uint64_t *cas)
 {
     uint32_t len;
     int ret;
@@ -218,37 +639,922 @@ int libkkv_get(void *kh0, char *key, uint32_t key_len, char **value, uint32_t *v
     ret=send_request(kh->fd,kh->buf,len);
     if(ret>=0)
         ret=parse_response(kh->buf,id,value,value_len);
+    if(ret>=0&&cas)
+        *cas=((kkv_packet*)kh->buf)->cas;
     return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
 }
 
-int libkkv_delete(void *kh0, char *key, uint32_t key_len)
+/*
+ * store the value only if the version of the key is still *cas.
+ * *cas is updated to the new version on success,
+ * or to the current version if the key was modified by others.
+ */
+int libkkv_cas(void *kh0, char *key, uint32_t key_len, char *value, uint32_t value_len, uint64_t *cas)
 {
     uint32_t len;
     int ret;
+    kkv_packet *pk;
     kkv_handler *kh=(kkv_handler *)kh0;
     __u32 id=kh->accu_id++;
 
-    len=create_request(kh->buf,id,COMMAND_DELETE,key,key_len,NULL,0);
+    len=create_request(kh->buf,id,COMMAND_CAS,key,key_len,value,value_len);
+    pk=(kkv_packet*)kh->buf;
+    pk->cas=*cas;
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0||pk->id!=id)
+        return LIBKKV_RESULT_ERROR;
+    if(pk->command==COMMAND_ACK) {
+        *cas=pk->cas;
+        return LIBKKV_RESULT_OK;
+    }
+    if(pk->command==COMMAND_NACK&&pk->cas) {
+        *cas=pk->cas;
+        return LIBKKV_RESULT_EXISTS;
+    }
+    return LIBKKV_RESULT_ERROR;
+}
+
+/*
+ * get the value, or take a lease on the missing key.
+ * on LIBKKV_RESULT_MISS, *token is the lease to fill the key with libkkv_lset(),
+ * or 0 if none was handed out; on LIBKKV_RESULT_RETRY another client is filling the key,
+ * so the caller should retry shortly rather than going to the backing store.
+ */
+int libkkv_lget(void *kh0, char *key, uint32_t key_len, char **value, uint32_t *value_len, uint64_t *token)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_LGET,key,key_len,NULL,0);
+    ret=send_request(kh->fd,kh->buf,len);
+    pk=(kkv_packet*)kh->buf;
+    if(ret<0||pk->id!=id)
+        return LIBKKV_RESULT_ERROR;
+    *token=pk->cas;
+    if(pk->command==COMMAND_RETRY)
+        return LIBKKV_RESULT_RETRY;
+    if(pk->command==COMMAND_NACK)
+        return LIBKKV_RESULT_MISS;
+    *token=0;
+    ret=parse_response(kh->buf,id,value,value_len);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * fill the key with the lease token from libkkv_lget().
+ * LIBKKV_RESULT_STALE is returned if the key was written or deleted since, or the lease expired.
+ */
+int libkkv_lset(void *kh0, char *key, uint32_t key_len, char *value, uint32_t value_len, uint64_t token)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_LSET,key,key_len,value,value_len);
+    pk=(kkv_packet*)kh->buf;
+    pk->cas=token;
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0||pk->id!=id)
+        return LIBKKV_RESULT_ERROR;
+    if(pk->command==COMMAND_NACK&&pk->cas)
+        return LIBKKV_RESULT_STALE;
+    return pk->command==COMMAND_NACK?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * read at most length bytes of the value from offset.
+ */
+int libkkv_getrange(void *kh0, char *key, uint32_t key_len, uint32_t offset, uint32_t length, char **value, uint32_t *value_len)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_range_request(kh->buf,id,COMMAND_GETRANGE,key,key_len,offset,length,NULL);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0)
+        return LIBKKV_RESULT_ERROR;
+    pk=(kkv_packet*)kh->buf;
+    if(pk->command==COMMAND_NACK)
+        return LIBKKV_RESULT_ERROR;
+    ret=parse_response(kh->buf,id,value,value_len);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * overwrite the value from offset, the value is grown with zeros if needed.
+ */
+int libkkv_setrange(void *kh0, char *key, uint32_t key_len, uint32_t offset, char *value, uint32_t value_len)
+{
+    uint32_t len;
+    int ret;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_range_request(kh->buf,id,COMMAND_SETRANGE,key,key_len,offset,value_len,value);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
     ret=send_request(kh->fd,kh->buf,len);
     if(ret>=0)
         ret=parse_response(kh->buf,id,NULL,NULL);
     return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
 }
 
-int libkkv_shrink(void *kh0)
+int libkkv_mget(void *kh0, uint32_t nr, char **keys, uint32_t *key_lens, char **values, uint32_t *value_lens)
 {
     uint32_t len;
     int ret;
     kkv_handler *kh=(kkv_handler *)kh0;
     __u32 id=kh->accu_id++;
 
-    len=create_request(kh->buf,id,COMMAND_SHRINK,NULL,0,NULL,0);
+    len=create_multi_request(kh->buf,id,COMMAND_MGET,nr,keys,key_lens);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
     ret=send_request(kh->fd,kh->buf,len);
     if(ret>=0)
-        ret=parse_response(kh->buf,id,NULL,NULL);
+        ret=parse_mget_response(kh->buf,id,nr,values,value_lens);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * take a snapshot of the keyspace of the session: the keys read at it with
+ * libkkv_snapshot_get() and libkkv_snapshot_mget() are seen as they were when it was taken,
+ * however they are written meanwhile. a snapshot not read for a while expires.
+ */
+int libkkv_snapshot(void *kh0, uint64_t *snap)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_SNAPSHOT,NULL,0,NULL,0);
+    ret=send_request(kh->fd,kh->buf,len);
+    pk=(kkv_packet*)kh->buf;
+    if(ret<0||pk->id!=id||pk->command!=COMMAND_ACK||!pk->cas)
+        return LIBKKV_RESULT_ERROR;
+    *snap=pk->cas;
+    return LIBKKV_RESULT_OK;
+}
+
+int libkkv_release(void *kh0, uint64_t snap)
+{
+    uint32_t len;
+    int ret;
+    kkv_handler *kh=(kkv_handler *)kh0;
+
+    len=create_request(kh->buf,kh->accu_id++,COMMAND_RELEASE,NULL,0,NULL,0);
+    ((kkv_packet*)kh->buf)->cas=snap;
+    ret=send_request(kh->fd,kh->buf,len);
     return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
 }
 
+/*
+ * get the value as it was when the snapshot was taken,
+ * LIBKKV_RESULT_STALE is returned if the snapshot has been released or has expired.
+ */
+int libkkv_snapshot_get(void *kh0, uint64_t snap, char *key, uint32_t key_len, char **value, uint32_t *value_len)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_GET,key,key_len,NULL,0);
+    pk=(kkv_packet*)kh->buf;
+    pk->cas=snap;
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0||pk->id!=id)
+        return LIBKKV_RESULT_ERROR;
+    if(pk->command==COMMAND_NACK&&pk->cas)
+        return LIBKKV_RESULT_STALE;
+    ret=parse_response(kh->buf,id,value,value_len);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * get the values as they were when the snapshot was taken, see libkkv_mget().
+ */
+int libkkv_snapshot_mget(void *kh0, uint64_t snap, uint32_t nr, char **keys, uint32_t *key_lens, char **values, uint32_t *value_lens)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_multi_request(kh->buf,id,COMMAND_MGET,nr,keys,key_lens);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    pk=(kkv_packet*)kh->buf;
+    pk->cas=snap;
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0||pk->id!=id)
+        return LIBKKV_RESULT_ERROR;
+    if(pk->command==COMMAND_NACK&&pk->cas)
+        return LIBKKV_RESULT_STALE;
+    ret=parse_mget_response(kh->buf,id,nr,values,value_lens);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+int libkkv_mset(void *kh0, uint32_t nr, char **keys, uint32_t *key_lens, char **values, uint32_t *value_lens, int *results)
+{
+    uint32_t len;
+    int ret;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_mset_request(kh->buf,id,nr,keys,key_lens,values,value_lens);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret>=0)
+        ret=parse_multi_response(kh->buf,id,nr,results);
+    return ret!=0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+int libkkv_mdelete(void *kh0, uint32_t nr, char **keys, uint32_t *key_lens, int *results)
+{
+    uint32_t len;
+    int ret;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_multi_request(kh->buf,id,COMMAND_MDELETE,nr,keys,key_lens);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret>=0)
+        ret=parse_multi_response(kh->buf,id,nr,results);
+    return ret!=0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * apply the operations all or nothing, ops[i] is one of LIBKKV_OP_*,
+ * values[i] is ignored for LIBKKV_OP_DELETE.
+ * if the batch is aborted, results[i] tells which operations failed.
+ */
+int libkkv_multi(void *kh0, uint32_t nr, uint32_t *ops, char **keys, uint32_t *key_lens, char **values, uint32_t *value_lens, int *results)
+{
+    uint32_t len;
+    int ret;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_mop_request(kh->buf,id,nr,ops,keys,key_lens,values,value_lens);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret>=0)
+        ret=parse_multi_response(kh->buf,id,nr,results);
+    return ret!=0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * fetch at most *nr of the hottest keys with their accesses per second, the hottest first.
+ * keys[i] is malloc()ed, and *nr is set to the # of keys fetched.
+ */
+int libkkv_hotkeys(void *kh0, uint32_t *nr, char **keys, uint32_t *key_lens, uint32_t *rates)
+{
+    uint32_t len;
+    uint32_t n=0;
+    int ret;
+    char *pos, *end;
+    kkv_packet *pk;
+    kkv_hotkey *hk;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_STATS,KKV_STATS_HOTKEYS,strlen(KKV_STATS_HOTKEYS),NULL,0);
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0)
+        return LIBKKV_RESULT_ERROR;
+    pk=(kkv_packet*)kh->buf;
+    if(pk->id!=id||pk->command==COMMAND_NACK)
+        return LIBKKV_RESULT_ERROR;
+
+    //nothing is copied back if no key is tracked yet.
+    if(pk->command==COMMAND_ACK) {
+        pos=pk->data+pk->key_len;
+        end=pos+pk->value_len;
+        while(n<*nr&&pos+sizeof(kkv_hotkey)<=end) {
+            hk=(kkv_hotkey*)pos;
+            keys[n]=malloc(hk->key_len);
+            memcpy(keys[n],hk->key,hk->key_len);
+            key_lens[n]=hk->key_len;
+            rates[n]=hk->rate;
+            n++;
+            pos+=sizeof(kkv_hotkey)+PADDED_KEY_SIZE(hk->key_len);
+        }
+    }
+    *nr=n;
+    return LIBKKV_RESULT_OK;
+}
+
+/*
+ * fetch the value of a field of the hash-map key.
+ */
+int libkkv_hget(void *kh0, char *key, uint32_t key_len, char *field, uint32_t field_len, char **value, uint32_t *value_len)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_HGET,key,key_len,field,field_len);
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0)
+        return LIBKKV_RESULT_ERROR;
+    pk=(kkv_packet*)kh->buf;
+    if(pk->command==COMMAND_NACK)
+        return LIBKKV_RESULT_ERROR;
+    ret=parse_response(kh->buf,id,value,value_len);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * store the value into a field of the hash-map key, the key is created if missing.
+ */
+int libkkv_hset(void *kh0, char *key, uint32_t key_len, char *field, uint32_t field_len, char *value, uint32_t value_len)
+{
+    uint32_t len;
+    int ret;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_hset_request(kh->buf,id,key,key_len,field,field_len,value,value_len);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret>=0)
+        ret=parse_response(kh->buf,id,NULL,NULL);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * remove a field of the hash-map key, the key is removed with its last field.
+ */
+int libkkv_hdel(void *kh0, char *key, uint32_t key_len, char *field, uint32_t field_len)
+{
+    uint32_t len;
+    int ret;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_HDEL,key,key_len,field,field_len);
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret>=0)
+        ret=parse_response(kh->buf,id,NULL,NULL);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * fetch at most *nr fields of the hash-map key and their values,
+ * *nr is set to the # of fields fetched.
+ */
+int libkkv_hgetall(void *kh0, char *key, uint32_t key_len, uint32_t *nr, char **fields, uint32_t *field_lens, char **values, uint32_t *value_lens)
+{
+    uint32_t len;
+    uint32_t n=0;
+    int ret;
+    char *pos, *end;
+    kkv_packet *pk;
+    kkv_mkv *mkv;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_HGETALL,key,key_len,NULL,0);
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0)
+        return LIBKKV_RESULT_ERROR;
+    pk=(kkv_packet*)kh->buf;
+    if(pk->id!=id||pk->command!=COMMAND_ACK)
+        return LIBKKV_RESULT_ERROR;
+
+    pos=pk->data+pk->key_len;
+    end=pos+pk->value_len;
+    while(n<*nr&&pos+sizeof(kkv_mkv)<=end) {
+        mkv=(kkv_mkv*)pos;
+        fields[n]=malloc(mkv->key_len);
+        memcpy(fields[n],mkv->data,mkv->key_len);
+        field_lens[n]=mkv->key_len;
+        values[n]=malloc(mkv->value_len);
+        memcpy(values[n],mkv->data+PADDED_KEY_SIZE(mkv->key_len),mkv->value_len);
+        value_lens[n]=mkv->value_len;
+        n++;
+        pos+=sizeof(kkv_mkv)+PADDED_KEY_SIZE(mkv->key_len)+PADDED_KEY_SIZE(mkv->value_len);
+    }
+    *nr=n;
+    return LIBKKV_RESULT_OK;
+}
+
+/*
+ * send the request and fetch the __u64 result of a bit operation.
+ */
+static int bit_request(kkv_handler *kh, uint32_t id, uint32_t len, uint64_t *result)
+{
+    int ret;
+    kkv_packet *pk;
+
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0)
+        return LIBKKV_RESULT_ERROR;
+    pk=(kkv_packet*)kh->buf;
+    if(pk->id!=id||pk->command!=COMMAND_ACK||pk->value_len!=sizeof(uint64_t))
+        return LIBKKV_RESULT_ERROR;
+    if(result)
+        memcpy(result,pk->data+pk->key_len,sizeof(uint64_t));
+    return LIBKKV_RESULT_OK;
+}
+
+/*
+ * set or clear the bit at offset, the value is grown with zeros if needed.
+ * bit 0 is the highest bit of the first byte. the previous bit is put into *old.
+ */
+int libkkv_setbit(void *kh0, char *key, uint32_t key_len, uint64_t offset, uint32_t bit, uint32_t *old)
+{
+    uint32_t len;
+    int ret;
+    uint64_t result;
+    kkv_bit kb;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    kb.offset=offset;
+    kb.bit=bit;
+    len=create_request(kh->buf,id,COMMAND_SETBIT,key,key_len,(char*)&kb,sizeof(kkv_bit));
+    ret=bit_request(kh,id,len,&result);
+    if(ret==LIBKKV_RESULT_OK&&old)
+        *old=result;
+    return ret;
+}
+
+/*
+ * fetch the bit at offset, a missing key or a bit past the end reads as 0.
+ */
+int libkkv_getbit(void *kh0, char *key, uint32_t key_len, uint64_t offset, uint32_t *bit)
+{
+    uint32_t len;
+    int ret;
+    uint64_t result;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_GETBIT,key,key_len,(char*)&offset,sizeof(uint64_t));
+    ret=bit_request(kh,id,len,&result);
+    if(ret==LIBKKV_RESULT_OK)
+        *bit=result;
+    return ret;
+}
+
+/*
+ * count the set bits in length bytes of the value from offset,
+ * or up to the end if length is 0.
+ */
+int libkkv_bitcount(void *kh0, char *key, uint32_t key_len, uint32_t offset, uint32_t length, uint64_t *nr)
+{
+    uint32_t len;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_range_request(kh->buf,id,COMMAND_BITCOUNT,key,key_len,offset,length,NULL);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    return bit_request(kh,id,len,nr);
+}
+
+/*
+ * store the values of the nr source keys combined by op, one of LIBKKV_BITOP_*, into dkey.
+ * the length of the result is put into *result_len.
+ */
+int libkkv_bitop(void *kh0, uint32_t op, char *dkey, uint32_t dkey_len, uint32_t nr, char **keys, uint32_t *key_lens, uint64_t *result_len)
+{
+    uint32_t len, i;
+    char *all_keys[LIBKKV_BITOP_MAX+1];
+    uint32_t all_key_lens[LIBKKV_BITOP_MAX+1];
+    kkv_packet *pk;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    if(nr>LIBKKV_BITOP_MAX)
+        return LIBKKV_RESULT_ERROR;
+    all_keys[0]=dkey;
+    all_key_lens[0]=dkey_len;
+    for(i=0; i<nr; i++) {
+        all_keys[i+1]=keys[i];
+        all_key_lens[i+1]=key_lens[i];
+    }
+    len=create_multi_request(kh->buf,id,COMMAND_BITOP,nr+1,all_keys,all_key_lens);
+    if(!len||len+sizeof(uint32_t)>BUF_SIZE)
+        return LIBKKV_RESULT_ERROR;
+    memcpy(kh->buf+len,&op,sizeof(uint32_t));
+    len+=sizeof(uint32_t);
+    pk=(kkv_packet*)kh->buf;
+    pk->value_len=sizeof(uint32_t);
+    return bit_request(kh,id,len,result_len);
+}
+
+/*
+ * add the nr elements to the HyperLogLog of key, which is created if missing.
+ * *changed is set to 1 if the estimated cardinality may have changed, or to 0.
+ */
+int libkkv_pfadd(void *kh0, char *key, uint32_t key_len, uint32_t nr, char **elems, uint32_t *elem_lens, uint64_t *changed)
+{
+    uint32_t len, i;
+    char **all_keys;
+    uint32_t *all_key_lens;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    all_keys=malloc((nr+1)*sizeof(char*));
+    all_key_lens=malloc((nr+1)*sizeof(uint32_t));
+    if(!all_keys||!all_key_lens) {
+        free(all_keys);
+        free(all_key_lens);
+        return LIBKKV_RESULT_ERROR;
+    }
+    all_keys[0]=key;
+    all_key_lens[0]=key_len;
+    for(i=0; i<nr; i++) {
+        all_keys[i+1]=elems[i];
+        all_key_lens[i+1]=elem_lens[i];
+    }
+    len=create_multi_request(kh->buf,id,COMMAND_PFADD,nr+1,all_keys,all_key_lens);
+    free(all_keys);
+    free(all_key_lens);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    return bit_request(kh,id,len,changed);
+}
+
+/*
+ * estimate the cardinality of the union of the HyperLogLogs of the nr keys,
+ * missing keys count as empty.
+ */
+int libkkv_pfcount(void *kh0, uint32_t nr, char **keys, uint32_t *key_lens, uint64_t *count)
+{
+    uint32_t len;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    if(!nr||nr>LIBKKV_HLL_MAX)
+        return LIBKKV_RESULT_ERROR;
+    len=create_multi_request(kh->buf,id,COMMAND_PFCOUNT,nr,keys,key_lens);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    return bit_request(kh,id,len,count);
+}
+
+/*
+ * merge the HyperLogLogs of the nr source keys into that of dkey,
+ * and fetch the estimated cardinality of the result.
+ */
+int libkkv_pfmerge(void *kh0, char *dkey, uint32_t dkey_len, uint32_t nr, char **keys, uint32_t *key_lens, uint64_t *count)
+{
+    uint32_t len, i;
+    char *all_keys[LIBKKV_HLL_MAX+1];
+    uint32_t all_key_lens[LIBKKV_HLL_MAX+1];
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    if(nr>LIBKKV_HLL_MAX)
+        return LIBKKV_RESULT_ERROR;
+    all_keys[0]=dkey;
+    all_key_lens[0]=dkey_len;
+    for(i=0; i<nr; i++) {
+        all_keys[i+1]=keys[i];
+        all_key_lens[i+1]=key_lens[i];
+    }
+    len=create_multi_request(kh->buf,id,COMMAND_PFMERGE,nr+1,all_keys,all_key_lens);
+    if(!len)
+        return LIBKKV_RESULT_ERROR;
+    return bit_request(kh,id,len,count);
+}
+
+/*
+ * delete all the keys starting with prefix, *nr is set to the # of keys deleted.
+ */
+int libkkv_delete_prefix(void *kh0, char *prefix, uint32_t prefix_len, uint64_t *nr)
+{
+    uint32_t len;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_DELETE_PREFIX,prefix,prefix_len,NULL,0);
+    return bit_request(kh,id,len,nr);
+}
+
+/*
+ * fetch the # of keys and the memory taken by them in the keyspace of the session.
+ */
+int libkkv_keyspace_stats(void *kh0, uint64_t *nr_items, uint64_t *mem)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    kkv_keyspace_stats *kss;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_STATS,KKV_STATS_KEYSPACE,strlen(KKV_STATS_KEYSPACE),NULL,0);
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0)
+        return LIBKKV_RESULT_ERROR;
+    pk=(kkv_packet*)kh->buf;
+    if(pk->id!=id||pk->command!=COMMAND_ACK||pk->value_len!=sizeof(kkv_keyspace_stats))
+        return LIBKKV_RESULT_ERROR;
+    kss=(kkv_keyspace_stats*)(pk->data+pk->key_len);
+    *nr_items=kss->nr_items;
+    *mem=kss->mem;
+    return LIBKKV_RESULT_OK;
+}
+
+/*
+ * fetch the # of values shared by the keys holding the same bytes,
+ * the # of keys holding them and the bytes saved by the sharing, in all the keyspaces.
+ */
+int libkkv_dedup_stats(void *kh0, uint64_t *nr_values, uint64_t *nr_refs, uint64_t *saved)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    kkv_dedup_stats *ds;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_STATS,KKV_STATS_DEDUP,strlen(KKV_STATS_DEDUP),NULL,0);
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret<0)
+        return LIBKKV_RESULT_ERROR;
+    pk=(kkv_packet*)kh->buf;
+    if(pk->id!=id||pk->command!=COMMAND_ACK||pk->value_len!=sizeof(kkv_dedup_stats))
+        return LIBKKV_RESULT_ERROR;
+    ds=(kkv_dedup_stats*)(pk->data+pk->key_len);
+    *nr_values=ds->nr_values;
+    *nr_refs=ds->nr_refs;
+    *saved=ds->saved;
+    return LIBKKV_RESULT_OK;
+}
+
+/*
+ * drop all the keys in the keyspace of the session.
+ */
+int libkkv_flush(void *kh0)
+{
+    uint32_t len;
+    int ret;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_FLUSH,NULL,0,NULL,0);
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret>=0)
+        ret=parse_response(kh->buf,id,NULL,NULL);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+static int __libkkv_incr(kkv_handler *kh, char *key, uint32_t key_len, uint64_t delta, uint64_t *value, uint32_t command)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,command,key,key_len,(char*)&delta,sizeof(uint64_t));
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret>=0) {
+        pk=(kkv_packet*)kh->buf;
+        if(pk->id!=id||pk->command!=COMMAND_ACK||pk->value_len!=sizeof(uint64_t))
+            return LIBKKV_RESULT_ERROR;
+        if(value)
+            memcpy(value,pk->data+pk->key_len,sizeof(uint64_t));
+    }
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+int libkkv_incr(void *kh, char *key, uint32_t key_len, uint64_t delta, uint64_t *value)
+{
+    return __libkkv_incr(kh,key,key_len,delta,value,COMMAND_INCR);
+}
+
+int libkkv_decr(void *kh, char *key, uint32_t key_len, uint64_t delta, uint64_t *value)
+{
+    return __libkkv_incr(kh,key,key_len,delta,value,COMMAND_DECR);
+}
+
+int libkkv_delete(void *kh0, char *key, uint32_t key_len)
+{
+    uint32_t len;
+    int ret;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_DELETE,key,key_len,NULL,0);
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret>=0)
+        ret=parse_response(kh->buf,id,NULL,NULL);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+int libkkv_shrink(void *kh0)
+{
+    uint32_t len;
+    int ret;
+    kkv_handler *kh=(kkv_handler *)kh0;
+    __u32 id=kh->accu_id++;
+
+    len=create_request(kh->buf,id,COMMAND_SHRINK,NULL,0,NULL,0);
+    ret=send_request(kh->fd,kh->buf,len);
+    if(ret>=0)
+        ret=parse_response(kh->buf,id,NULL,NULL);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * send a request with the flags without waiting for its response, see libkkv_async_wait() and libkkv_noop().
+ * a large value isn't copied into the buffer, as in __libkkv_add().
+ */
+static int send_nowait_request(kkv_handler *kh, uint32_t command, uint32_t flags, char *key, uint32_t key_len, char *value, uint32_t value_len, uint32_t *id)
+{
+    uint32_t len;
+    int ret;
+    kkv_packet *pk;
+
+    *id=kh->accu_id++;
+    if(sizeof(kkv_packet)+key_len>BUF_SIZE||(value_len<LARGE_VALUE&&sizeof(kkv_packet)+key_len+value_len>BUF_SIZE))
+        return LIBKKV_RESULT_ERROR;
+    len=create_request(kh->buf,*id,command,key,key_len,NULL,0);
+    pk=(kkv_packet*)kh->buf;
+    pk->value_len=value_len;
+    pk->flags|=flags;
+    ret=send_packet(kh->fd,kh->buf,len,value,value_len);
+    return ret<0?LIBKKV_RESULT_ERROR:LIBKKV_RESULT_OK;
+}
+
+/*
+ * the async requests return at once with the id of the request in *id,
+ * their responses are picked up by libkkv_async_wait() in whatever order they come back.
+ * the responses are only sent back as fast as they're picked up,
+ * so keep waiting for them while sending more requests,
+ * and pick all of them up before making a sync request.
+ */
+int libkkv_async_get(void *kh, char *key, uint32_t key_len, uint32_t *id)
+{
+    return send_nowait_request(kh,COMMAND_GET,KKV_FLAG_ASYNC,key,key_len,NULL,0,id);
+}
+
+int libkkv_async_set(void *kh, char *key, uint32_t key_len, char *value, uint32_t value_len, uint32_t *id)
+{
+    return send_nowait_request(kh,COMMAND_SET,KKV_FLAG_ASYNC,key,key_len,value,value_len,id);
+}
+
+int libkkv_async_delete(void *kh, char *key, uint32_t key_len, uint32_t *id)
+{
+    return send_nowait_request(kh,COMMAND_DELETE,KKV_FLAG_ASYNC,key,key_len,NULL,0,id);
+}
+
+static int recv_all(int fd, char *buf, uint32_t len)
+{
+    int ret;
+    uint32_t done=0;
+
+    while(done<len) {
+        ret=recv(fd,buf+done,len-done,0);
+        if(ret<=0) {
+            printf("recv() failed in recv_all(): errno=%d\n",errno);
+            return -1;
+        }
+        done+=ret;
+    }
+    return done;
+}
+
+/*
+ * receive the next response, whichever request it's for, into the buffer,
+ * except its value, of any size, which is put in *value.
+ */
+static int recv_any_response(kkv_handler *kh, char **value)
+{
+    kkv_packet *pk=(kkv_packet*)kh->buf;
+
+    *value=NULL;
+    if(recv_all(kh->fd,kh->buf,sizeof(kkv_packet))<0)
+        return -1;
+    if(pk->key_len>BUF_SIZE-sizeof(kkv_packet)) {
+        printf("response too large in recv_any_response(): key_len=%u\n",pk->key_len);
+        return -1;
+    }
+    if(recv_all(kh->fd,pk->data,pk->key_len)<0)
+        return -1;
+    if(pk->value_len) {
+        *value=malloc(pk->value_len);
+        if(!*value||recv_all(kh->fd,*value,pk->value_len)<0) {
+            free(*value);
+            *value=NULL;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * wait for the next response to an async request, which may be of any one in flight,
+ * its id is put in *id, and its value, of any size, in *value, which the caller frees.
+ * @return: the result of the request, as that of the sync one.
+ */
+int libkkv_async_wait(void *kh0, uint32_t *id, char **value, uint32_t *value_len)
+{
+    kkv_handler *kh=(kkv_handler *)kh0;
+    kkv_packet *pk=(kkv_packet*)kh->buf;
+    char *value_buf;
+
+    if(recv_any_response(kh,&value_buf)<0)
+        return LIBKKV_RESULT_ERROR;
+
+    *id=pk->id;
+    if(value)
+        *value=value_buf;
+    else
+        free(value_buf);
+    if(value_len)
+        *value_len=pk->value_len;
+    return pk->command==COMMAND_ACK?LIBKKV_RESULT_OK:LIBKKV_RESULT_ERROR;
+}
+
+static int __libkkv_quiet(kkv_handler *kh, uint32_t op, char *key, uint32_t key_len, char *value, uint32_t value_len, uint32_t flags)
+{
+    static const uint32_t commands[]= {COMMAND_SET,COMMAND_ADD,COMMAND_REPLACE,COMMAND_DELETE};
+    uint32_t id;
+
+    if(op>LIBKKV_OP_DELETE)
+        return LIBKKV_RESULT_ERROR;
+    if(op==LIBKKV_OP_DELETE)
+        value_len=0;
+    return send_nowait_request(kh,commands[op],flags,key,key_len,value,value_len,&id);
+}
+
+/*
+ * send a set, add, replace or delete, one of LIBKKV_OP_*, which is answered only if it fails,
+ * the failures are counted by the next libkkv_noop().
+ * quiet requests must not be mixed with async ones in flight.
+ */
+int libkkv_quiet(void *kh, uint32_t op, char *key, uint32_t key_len, char *value, uint32_t value_len)
+{
+    return __libkkv_quiet(kh,op,key,key_len,value,value_len,KKV_FLAG_QUIET);
+}
+
+/*
+ * send a set, add, replace or delete like libkkv_quiet(), which is never answered, even if it fails.
+ */
+int libkkv_noreply(void *kh, uint32_t op, char *key, uint32_t key_len, char *value, uint32_t value_len)
+{
+    return __libkkv_quiet(kh,op,key,key_len,value,value_len,KKV_FLAG_NOREPLY);
+}
+
+/*
+ * wait until all the quiet requests sent before are done,
+ * the # of them that failed is put in *nr_failed.
+ * the failures are only sent back as fast as they're picked up,
+ * so call it every so often during a bulk load.
+ */
+int libkkv_noop(void *kh0, uint32_t *nr_failed)
+{
+    uint32_t id;
+    int ret;
+    char *value;
+    kkv_packet *pk;
+    kkv_handler *kh=(kkv_handler *)kh0;
+
+    ret=send_nowait_request(kh,COMMAND_NOOP,0,NULL,0,NULL,0,&id);
+    if(ret!=LIBKKV_RESULT_OK)
+        return ret;
+    if(nr_failed)
+        *nr_failed=0;
+    pk=(kkv_packet*)kh->buf;
+    for(;;) {
+        if(recv_any_response(kh,&value)<0)
+            return LIBKKV_RESULT_ERROR;
+        free(value);
+        if(pk->id==id)
+            return pk->command==COMMAND_ACK?LIBKKV_RESULT_OK:LIBKKV_RESULT_ERROR;
+        //anything else before it is a failed quiet request.
+        if(nr_failed)
+            (*nr_failed)++;
+    }
+}
+
 int libkkv_free(void *kh0)
 {
     kkv_handler *kh=(kkv_handler *)kh0;
@@ -11,14 +11,75 @@
 
 #define LIBKKV_RESULT_OK 0
 #define LIBKKV_RESULT_ERROR 1
+#define LIBKKV_RESULT_EXISTS 2 //the version of the key doesn't match in libkkv_cas().
+#define LIBKKV_RESULT_MISS 3 //the key is missing in libkkv_lget().
+#define LIBKKV_RESULT_RETRY 4 //another client holds the lease on the missing key in libkkv_lget().
+#define LIBKKV_RESULT_STALE 5 //the lease in libkkv_lset(), or the snapshot, is no longer valid.
+
+//the operations of libkkv_multi().
+#define LIBKKV_OP_SET 0
+#define LIBKKV_OP_ADD 1
+#define LIBKKV_OP_REPLACE 2
+#define LIBKKV_OP_DELETE 3
+
+//the operations of libkkv_bitop().
+#define LIBKKV_BITOP_AND 0
+#define LIBKKV_BITOP_OR 1
+#define LIBKKV_BITOP_XOR 2
+#define LIBKKV_BITOP_NOT 3 //takes a single source key.
+
+#define LIBKKV_BITOP_MAX 16 //max # of source keys of libkkv_bitop().
+#define LIBKKV_HLL_MAX 16 //max # of keys of libkkv_pfcount() and source keys of libkkv_pfmerge().
 
 
 void *libkkv_create(char *ip, char *port);
 int libkkv_set(void *kh, char *key, uint32_t key_len, char *value, uint32_t value_len);
 int libkkv_add(void *kh, char *key, uint32_t key_len, char *value, uint32_t value_len);
 int libkkv_replace(void *kh, char *key, uint32_t key_len, char *value, uint32_t value_len);
+int libkkv_append(void *kh, char *key, uint32_t key_len, char *value, uint32_t value_len);
+int libkkv_prepend(void *kh, char *key, uint32_t key_len, char *value, uint32_t value_len);
 int libkkv_get(void *kh, char *key, uint32_t key_len, char **value, uint32_t *value_len);
+int libkkv_gets(void *kh, char *key, uint32_t key_len, char **value, uint32_t *value_len, uint64_t *cas);
+int libkkv_cas(void *kh, char *key, uint32_t key_len, char *value, uint32_t value_len, uint64_t *cas);
+int libkkv_lget(void *kh, char *key, uint32_t key_len, char **value, uint32_t *value_len, uint64_t *token);
+int libkkv_lset(void *kh, char *key, uint32_t key_len, char *value, uint32_t value_len, uint64_t token);
+int libkkv_getrange(void *kh, char *key, uint32_t key_len, uint32_t offset, uint32_t length, char **value, uint32_t *value_len);
+int libkkv_setrange(void *kh, char *key, uint32_t key_len, uint32_t offset, char *value, uint32_t value_len);
+int libkkv_mget(void *kh, uint32_t nr, char **keys, uint32_t *key_lens, char **values, uint32_t *value_lens);
+int libkkv_snapshot(void *kh, uint64_t *snap);
+int libkkv_release(void *kh, uint64_t snap);
+int libkkv_snapshot_get(void *kh, uint64_t snap, char *key, uint32_t key_len, char **value, uint32_t *value_len);
+int libkkv_snapshot_mget(void *kh, uint64_t snap, uint32_t nr, char **keys, uint32_t *key_lens, char **values, uint32_t *value_lens);
+int libkkv_mset(void *kh, uint32_t nr, char **keys, uint32_t *key_lens, char **values, uint32_t *value_lens, int *results);
+int libkkv_mdelete(void *kh, uint32_t nr, char **keys, uint32_t *key_lens, int *results);
+int libkkv_multi(void *kh, uint32_t nr, uint32_t *ops, char **keys, uint32_t *key_lens, char **values, uint32_t *value_lens, int *results);
+int libkkv_hget(void *kh, char *key, uint32_t key_len, char *field, uint32_t field_len, char **value, uint32_t *value_len);
+int libkkv_hset(void *kh, char *key, uint32_t key_len, char *field, uint32_t field_len, char *value, uint32_t value_len);
+int libkkv_hdel(void *kh, char *key, uint32_t key_len, char *field, uint32_t field_len);
+int libkkv_hgetall(void *kh, char *key, uint32_t key_len, uint32_t *nr, char **fields, uint32_t *field_lens, char **values, uint32_t *value_lens);
+int libkkv_setbit(void *kh, char *key, uint32_t key_len, uint64_t offset, uint32_t bit, uint32_t *old);
+int libkkv_getbit(void *kh, char *key, uint32_t key_len, uint64_t offset, uint32_t *bit);
+int libkkv_bitcount(void *kh, char *key, uint32_t key_len, uint32_t offset, uint32_t length, uint64_t *nr);
+int libkkv_bitop(void *kh, uint32_t op, char *dkey, uint32_t dkey_len, uint32_t nr, char **keys, uint32_t *key_lens, uint64_t *result_len);
+int libkkv_pfadd(void *kh, char *key, uint32_t key_len, uint32_t nr, char **elems, uint32_t *elem_lens, uint64_t *changed);
+int libkkv_pfcount(void *kh, uint32_t nr, char **keys, uint32_t *key_lens, uint64_t *count);
+int libkkv_pfmerge(void *kh, char *dkey, uint32_t dkey_len, uint32_t nr, char **keys, uint32_t *key_lens, uint64_t *count);
+int libkkv_hotkeys(void *kh, uint32_t *nr, char **keys, uint32_t *key_lens, uint32_t *rates);
+int libkkv_keyspace_stats(void *kh, uint64_t *nr_items, uint64_t *mem);
+int libkkv_dedup_stats(void *kh, uint64_t *nr_values, uint64_t *nr_refs, uint64_t *saved);
+int libkkv_flush(void *kh);
+int libkkv_incr(void *kh, char *key, uint32_t key_len, uint64_t delta, uint64_t *value);
+int libkkv_decr(void *kh, char *key, uint32_t key_len, uint64_t delta, uint64_t *value);
 int libkkv_delete(void *kh, char *key, uint32_t key_len);
+int libkkv_delete_prefix(void *kh, char *prefix, uint32_t prefix_len, uint64_t *nr);
+uint32_t libkkv_key_hash(char *key, uint32_t key_len);
 int libkkv_shrink(void *kh);
+int libkkv_async_get(void *kh, char *key, uint32_t key_len, uint32_t *id);
+int libkkv_async_set(void *kh, char *key, uint32_t key_len, char *value, uint32_t value_len, uint32_t *id);
+int libkkv_async_delete(void *kh, char *key, uint32_t key_len, uint32_t *id);
+int libkkv_async_wait(void *kh, uint32_t *id, char **value, uint32_t *value_len);
+int libkkv_quiet(void *kh, uint32_t op, char *key, uint32_t key_len, char *value, uint32_t value_len);
+int libkkv_noreply(void *kh, uint32_t op, char *key, uint32_t key_len, char *value, uint32_t value_len);
+int libkkv_noop(void *kh, uint32_t *nr_failed);
 int libkkv_free(void *kh);
 